@@ -0,0 +1,5 @@
+cd ../services/benchmarks/build/
+
+for codec in scalar sse4.1 avx2; do
+    ex_base64_codec=$codec ./base64_bench ../../model_tests_1/dataset 20
+done
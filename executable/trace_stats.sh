@@ -0,0 +1,5 @@
+current_dir=$(pwd)
+export ex_cfg_path="$current_dir/../credentials.json"
+
+cd ../services/trace_stats/build/
+./trace_stats "$@"
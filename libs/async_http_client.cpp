@@ -0,0 +1,302 @@
+#include "async_http_client.hpp"
+
+static size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::string *userp)
+{
+    size_t total_size = size * nmemb;
+    userp->append((char *)contents, total_size);
+    return total_size;
+}
+
+AsyncHttpClient &AsyncHttpClient::getInstance()
+{
+    static AsyncHttpClient s{};
+    return s;
+}
+
+AsyncHttpClient::AsyncHttpClient()
+{
+    // Constructs the pool first so it outlives this client.
+    HttpClient::getInstance();
+
+    _multi = curl_multi_init();
+    if (!_multi)
+    {
+        LOG_ERROR("if(!_multi)");
+        return;
+    }
+
+    // HTTP/2 streams to one host share a connection instead of opening one per request.
+    curl_multi_setopt(_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    _thread = std::thread{&AsyncHttpClient::loop, this};
+}
+
+AsyncHttpClient::~AsyncHttpClient()
+{
+    _stop = true;
+    if (_multi)
+    {
+        curl_multi_wakeup(_multi);
+    }
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+    if (_multi)
+    {
+        curl_multi_cleanup(_multi);
+    }
+}
+
+void AsyncHttpClient::post(HttpClient::Request request, std::function<void(HttpClient::Attempt &&attempt)> on_done)
+{
+    std::vector<HttpClient::Request> requests{};
+    requests.push_back(std::move(request));
+    postHedged(std::move(requests), std::chrono::hours{24}, [on_done = std::move(on_done)](HttpClient::Attempt &attempt)
+               {
+                   on_done(std::move(attempt));
+                   return true; },
+               [](bool, size_t) {});
+}
+
+std::future<HttpClient::Attempt> AsyncHttpClient::post(HttpClient::Request request)
+{
+    auto promise = std::make_shared<std::promise<HttpClient::Attempt>>();
+    auto future = promise->get_future();
+    post(std::move(request), [promise](HttpClient::Attempt &&attempt)
+         { promise->set_value(std::move(attempt)); });
+    return future;
+}
+
+void AsyncHttpClient::postHedged(std::vector<HttpClient::Request> requests, std::chrono::steady_clock::duration hedge_after, Accept accept, OnDone on_done)
+{
+    auto group = std::make_unique<Group>();
+    group->transfers.resize(requests.size());
+    group->requests = std::move(requests);
+    // Keeps the deadline arithmetic away from overflow, a day is "never" for an HTTP request.
+    group->hedge_after = std::min<std::chrono::steady_clock::duration>(hedge_after, std::chrono::hours{24});
+    group->accept = std::move(accept);
+    group->on_done = std::move(on_done);
+
+    if (!_multi)
+    {
+        group->on_done(false, 0);
+        return;
+    }
+
+    {
+        std::lock_guard lock{_mut};
+        _submitted.push_back(std::move(group));
+    }
+    curl_multi_wakeup(_multi);
+}
+
+bool AsyncHttpClient::startNext(Group &group)
+{
+    const size_t index = group.next++;
+    auto &transfer = group.transfers[index];
+    const auto &request = group.requests[index];
+    transfer.group = &group;
+    transfer.attempt.index = index;
+    transfer.start = std::chrono::steady_clock::now();
+
+    transfer.curl = HttpClient::getInstance().acquire(request.url);
+    if (!transfer.curl)
+    {
+        transfer.attempt.error = "if(!curl)";
+    }
+    else
+    {
+        for (const auto &header : request.headers)
+        {
+            transfer.header_list = curl_slist_append(transfer.header_list, header.c_str());
+        }
+        // The body goes through the read callback, see HttpClient::post.
+        transfer.header_list = curl_slist_append(transfer.header_list, "Expect:");
+        transfer.body_reader.body = &request.body;
+        curl_easy_setopt(transfer.curl, CURLOPT_URL, request.url.c_str());
+        HttpClient::setPostBody(transfer.curl, transfer.body_reader);
+        curl_easy_setopt(transfer.curl, CURLOPT_HTTPHEADER, transfer.header_list);
+        curl_easy_setopt(transfer.curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+        curl_easy_setopt(transfer.curl, CURLOPT_WRITEDATA, &transfer.attempt.response.body);
+        curl_easy_setopt(transfer.curl, CURLOPT_PRIVATE, &transfer);
+        // Waiting for a connection that may multiplex only works inside one multi handle, a blocking
+        // HttpClient call on another thread would never hand it over. Plain http never gets HTTP/2 here.
+        if (request.url.rfind("https://", 0) == 0)
+        {
+            curl_easy_setopt(transfer.curl, CURLOPT_PIPEWAIT, 1L);
+        }
+
+        const CURLMcode add_res = curl_multi_add_handle(_multi, transfer.curl);
+        if (add_res == CURLM_OK)
+        {
+            ++group.running;
+            _in_flight.fetch_add(1, std::memory_order_relaxed);
+            group.deadline = transfer.start + group.hedge_after;
+            return true;
+        }
+
+        transfer.attempt.error = "curl_multi_add_handle failed: " + std::string(curl_multi_strerror(add_res));
+        curl_easy_setopt(transfer.curl, CURLOPT_HTTPHEADER, nullptr);
+        curl_slist_free_all(transfer.header_list);
+        transfer.header_list = nullptr;
+        curl_easy_cleanup(transfer.curl);
+        transfer.curl = nullptr;
+    }
+
+    transfer.attempt.elapsed = std::chrono::steady_clock::now() - transfer.start;
+    if (group.accept(transfer.attempt))
+    {
+        finishGroup(group, true);
+    }
+    return false;
+}
+
+void AsyncHttpClient::advance(Group &group)
+{
+    while (!group.finished && !group.running && group.next < group.requests.size())
+    {
+        startNext(group);
+    }
+    if (!group.finished && !group.running)
+    {
+        finishGroup(group, false);
+    }
+}
+
+void AsyncHttpClient::finishTransfer(Transfer &transfer, bool reuse)
+{
+    curl_multi_remove_handle(_multi, transfer.curl);
+    curl_easy_setopt(transfer.curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(transfer.header_list);
+    transfer.header_list = nullptr;
+    if (reuse)
+    {
+        HttpClient::getInstance().release(transfer.group->requests[transfer.attempt.index].url, transfer.curl);
+    }
+    else
+    {
+        // Cancelled or failed mid transfer, the connection must not go back to the pool.
+        curl_easy_cleanup(transfer.curl);
+    }
+    transfer.curl = nullptr;
+    --transfer.group->running;
+    _in_flight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void AsyncHttpClient::finishGroup(Group &group, bool accepted)
+{
+    // Cancels the losers.
+    for (auto &transfer : group.transfers)
+    {
+        if (transfer.curl)
+        {
+            finishTransfer(transfer, false);
+        }
+    }
+    group.finished = true;
+    group.on_done(accepted, group.hedges);
+}
+
+void AsyncHttpClient::loop()
+{
+    while (true)
+    {
+        std::vector<std::unique_ptr<Group>> submitted{};
+        {
+            std::lock_guard lock{_mut};
+            submitted.swap(_submitted);
+        }
+        for (auto &group : submitted)
+        {
+            advance(*_groups.emplace_back(std::move(group)));
+        }
+
+        if (_stop)
+        {
+            // Pending requests end as not accepted so nobody waits on them forever.
+            for (auto &group : _groups)
+            {
+                if (!group->finished)
+                {
+                    finishGroup(*group, false);
+                }
+            }
+            _groups.clear();
+
+            std::lock_guard lock{_mut};
+            if (_submitted.empty())
+            {
+                return;
+            }
+            continue;
+        }
+
+        int still_running{0};
+        const CURLMcode perform_res = curl_multi_perform(_multi, &still_running);
+        if (perform_res != CURLM_OK)
+        {
+            LOG_ERROR("curl_multi_perform failed: " + std::string(curl_multi_strerror(perform_res)));
+        }
+
+        int msgs_left{0};
+        while (CURLMsg *msg = curl_multi_info_read(_multi, &msgs_left))
+        {
+            if (msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+
+            Transfer *transfer{nullptr};
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, reinterpret_cast<char **>(&transfer));
+            auto &group = *transfer->group;
+            transfer->attempt.elapsed = std::chrono::steady_clock::now() - transfer->start;
+            curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &transfer->attempt.response.status_code);
+            const bool transfer_ok = msg->data.result == CURLE_OK;
+            if (!transfer_ok)
+            {
+                transfer->attempt.error = "curl transfer failed: " + std::string(curl_easy_strerror(msg->data.result));
+            }
+            finishTransfer(*transfer, transfer_ok);
+
+            if (group.accept(transfer->attempt))
+            {
+                finishGroup(group, true);
+                continue;
+            }
+            // A failed attempt does not wait for the hedge deadline.
+            if (group.next < group.requests.size())
+            {
+                startNext(group);
+            }
+            advance(group);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        for (auto &group : _groups)
+        {
+            if (!group->finished && group->running && group->next < group->requests.size() && now >= group->deadline)
+            {
+                if (startNext(*group))
+                {
+                    ++group->hedges;
+                }
+                advance(*group);
+            }
+        }
+        _groups.remove_if([](const std::unique_ptr<Group> &group)
+                          { return group->finished; });
+
+        // Sleeps until a socket is ready, post() wakes it up or the next hedge deadline passes,
+        // curl shortens the wait for its own timers.
+        now = std::chrono::steady_clock::now();
+        int64_t wait_ms{1000};
+        for (const auto &group : _groups)
+        {
+            if (group->next < group->requests.size())
+            {
+                wait_ms = std::min<int64_t>(wait_ms, std::chrono::duration_cast<std::chrono::milliseconds>(group->deadline - now).count() + 1);
+            }
+        }
+        curl_multi_poll(_multi, nullptr, 0, static_cast<int>(std::max<int64_t>(0, wait_ms)), nullptr);
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "http_client.hpp"
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+#include <thread>
+
+// Event loop HTTP client: one thread drives every transfer through a single curl multi handle,
+// so hundreds of LLM calls can be in flight without a thread each. Handles come from the HttpClient
+// pool and share its caches and timeouts. post() only queues the request and wakes the loop.
+// Callbacks run on the loop thread and must not block, heavy work goes back to the caller's threads.
+class AsyncHttpClient
+{
+public:
+    // Called for every finished transfer, returning true ends the request. The attempt may be moved from.
+    using Accept = std::function<bool(HttpClient::Attempt &attempt)>;
+    // accepted is false when every request finished without being accepted.
+    using OnDone = std::function<void(bool accepted, size_t hedges)>;
+
+    AsyncHttpClient(const AsyncHttpClient &l) = delete;
+    AsyncHttpClient(AsyncHttpClient &&l) = delete;
+    AsyncHttpClient &operator=(const AsyncHttpClient &l) = delete;
+    AsyncHttpClient &operator=(AsyncHttpClient &&l) = delete;
+
+    static AsyncHttpClient &getInstance();
+
+    // One POST, on_done gets the finished attempt whatever its outcome.
+    void post(HttpClient::Request request, std::function<void(HttpClient::Attempt &&attempt)> on_done);
+    std::future<HttpClient::Attempt> post(HttpClient::Request request);
+
+    // Starts requests[0] and every hedge_after without a result the next request, a transfer that finishes
+    // without being accepted starts the next one at once. The first attempt accept returns true for wins
+    // and the transfers still running are cancelled. on_done runs once after the winner or the last failure,
+    // hedges counts the requests started because of the deadline. Pending requests end with accepted false
+    // when the process shuts down.
+    void postHedged(std::vector<HttpClient::Request> requests, std::chrono::steady_clock::duration hedge_after, Accept accept, OnDone on_done);
+
+    // Transfers currently on the multi handle.
+    inline size_t inFlight() const
+    {
+        return _in_flight.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Group;
+
+    struct Transfer
+    {
+        Group *group{nullptr};
+        CURL *curl{nullptr};
+        struct curl_slist *header_list{nullptr};
+        HttpClient::BodyReader body_reader{};
+        HttpClient::Attempt attempt{};
+        std::chrono::steady_clock::time_point start{};
+    };
+
+    struct Group
+    {
+        std::vector<HttpClient::Request> requests{};
+        std::chrono::steady_clock::duration hedge_after{};
+        Accept accept{};
+        OnDone on_done{};
+        std::vector<Transfer> transfers{};
+        size_t next{0};
+        size_t running{0};
+        size_t hedges{0};
+        std::chrono::steady_clock::time_point deadline{};
+        bool finished{false};
+    };
+
+    AsyncHttpClient();
+    ~AsyncHttpClient();
+
+    void loop();
+    // Starts the next request of the group, a request that can not start is handed to accept as failed.
+    bool startNext(Group &group);
+    // Starts requests until one is running, finishes the group when none is left.
+    void advance(Group &group);
+    void finishTransfer(Transfer &transfer, bool reuse);
+    void finishGroup(Group &group, bool accepted);
+
+    CURLM *_multi{nullptr};
+    std::mutex _mut{};
+    std::vector<std::unique_ptr<Group>> _submitted{};
+    // Loop thread only.
+    std::list<std::unique_ptr<Group>> _groups{};
+    std::atomic<size_t> _in_flight{0};
+    std::atomic<bool> _stop{false};
+    std::thread _thread{};
+};
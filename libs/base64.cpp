@@ -0,0 +1,401 @@
+#include "functions.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DD_BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+// Scalar codec is table driven and writes into a presized buffer.
+// On x86 the bulk of the input goes through SSE4.1 (16 chars per step) or AVX2 (32 chars per step) kernels,
+// picked once at startup from cpuid. Only whole blocks of valid characters are handled by SIMD,
+// the tail, padding and the first invalid character are always left to the scalar code so semantics stay identical.
+
+namespace
+{
+    struct DecodeTable
+    {
+        int8_t values[256]{};
+
+        constexpr DecodeTable()
+        {
+            for (auto &v : values)
+            {
+                v = -1;
+            }
+            for (int i = 0; i < 26; ++i)
+            {
+                values['A' + i] = static_cast<int8_t>(i);
+                values['a' + i] = static_cast<int8_t>(26 + i);
+            }
+            for (int i = 0; i < 10; ++i)
+            {
+                values['0' + i] = static_cast<int8_t>(52 + i);
+            }
+            values[static_cast<unsigned char>('+')] = 62;
+            values[static_cast<unsigned char>('/')] = 63;
+        }
+    };
+
+    constexpr DecodeTable decode_table{};
+    constexpr char encode_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    // Encodes whole 3 byte groups and the padded tail, returns number of chars written.
+    size_t encodeScalar(const unsigned char *data, size_t size, char *out)
+    {
+        char *out_begin = out;
+        size_t i = 0;
+        for (; i + 3 <= size; i += 3)
+        {
+            const uint32_t triple = (uint32_t{data[i]} << 16) | (uint32_t{data[i + 1]} << 8) | uint32_t{data[i + 2]};
+            out[0] = encode_table[(triple >> 18) & 0x3f];
+            out[1] = encode_table[(triple >> 12) & 0x3f];
+            out[2] = encode_table[(triple >> 6) & 0x3f];
+            out[3] = encode_table[triple & 0x3f];
+            out += 4;
+        }
+
+        const size_t rest = size - i;
+        if (rest)
+        {
+            const uint32_t triple = (uint32_t{data[i]} << 16) | (rest == 2 ? uint32_t{data[i + 1]} << 8 : 0);
+            out[0] = encode_table[(triple >> 18) & 0x3f];
+            out[1] = encode_table[(triple >> 12) & 0x3f];
+            out[2] = rest == 2 ? encode_table[(triple >> 6) & 0x3f] : '=';
+            out[3] = '=';
+            out += 4;
+        }
+
+        return out - out_begin;
+    }
+
+    // Decodes until the first '=' or non base64 char, same as the original implementation:
+    // a trailing group of 2 or 3 chars yields 1 or 2 bytes, a single dangling char yields nothing.
+    size_t decodeScalar(const char *in, size_t size, unsigned char *out)
+    {
+        unsigned char *out_begin = out;
+        size_t i = 0;
+        for (; i + 4 <= size; i += 4)
+        {
+            const int8_t a = decode_table.values[static_cast<unsigned char>(in[i])];
+            const int8_t b = decode_table.values[static_cast<unsigned char>(in[i + 1])];
+            const int8_t c = decode_table.values[static_cast<unsigned char>(in[i + 2])];
+            const int8_t d = decode_table.values[static_cast<unsigned char>(in[i + 3])];
+            if ((a | b | c | d) < 0)
+            {
+                break;
+            }
+
+            const uint32_t triple = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | uint32_t(d);
+            out[0] = static_cast<unsigned char>(triple >> 16);
+            out[1] = static_cast<unsigned char>(triple >> 8);
+            out[2] = static_cast<unsigned char>(triple);
+            out += 3;
+        }
+
+        uint32_t tail{0};
+        size_t tail_len{0};
+        for (; i < size && tail_len < 4; ++i)
+        {
+            const int8_t v = decode_table.values[static_cast<unsigned char>(in[i])];
+            if (v < 0)
+            {
+                break;
+            }
+            tail = (tail << 6) | uint32_t(v);
+            ++tail_len;
+        }
+
+        if (tail_len == 2)
+        {
+            out[0] = static_cast<unsigned char>(tail >> 4);
+            out += 1;
+        }
+        else if (tail_len == 3)
+        {
+            out[0] = static_cast<unsigned char>(tail >> 10);
+            out[1] = static_cast<unsigned char>(tail >> 2);
+            out += 2;
+        }
+
+        return out - out_begin;
+    }
+
+#ifdef DD_BASE64_X86
+    // Kernels below follow the well known pshufb based approach (W. Mula, D. Lemire, A. Klomp).
+
+    __attribute__((target("sse4.1"))) inline __m128i encodeLookupSse(__m128i indices)
+    {
+        const __m128i shift_lut = _mm_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0);
+
+        __m128i res = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        res = _mm_or_si128(res, _mm_and_si128(less, _mm_set1_epi8(13)));
+        res = _mm_shuffle_epi8(shift_lut, res);
+        return _mm_add_epi8(res, indices);
+    }
+
+    __attribute__((target("sse4.1"))) size_t encodeSse(const unsigned char *data, size_t size, char *out)
+    {
+        const __m128i shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+        size_t i = 0;
+        size_t o = 0;
+
+        // 12 input bytes per step, the 16 byte load needs 4 bytes of slack.
+        for (; i + 16 <= size; i += 12, o += 16)
+        {
+            __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            in = _mm_shuffle_epi8(in, shuf);
+
+            const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+            const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+            const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+            const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + o), encodeLookupSse(_mm_or_si128(t1, t3)));
+        }
+
+        return o + encodeScalar(data + i, size - i, out + o);
+    }
+
+    // Translates 16 chars into 6 bit values, returns false if any of them is not in the base64 alphabet.
+    __attribute__((target("sse4.1"))) inline bool decodeLookupSse(__m128i in, __m128i &values)
+    {
+        const __m128i lut_lo = _mm_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m128i lut_hi = _mm_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m128i lut_roll = _mm_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71,
+            0, 0, 0, 0, 0, 0, 0, 0);
+
+        const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+        const __m128i lo_nibbles = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+        const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm_testz_si128(lo, hi))
+        {
+            return false;
+        }
+
+        const __m128i eq_2f = _mm_cmpeq_epi8(in, _mm_set1_epi8(0x2f));
+        const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+        values = _mm_add_epi8(in, roll);
+        return true;
+    }
+
+    __attribute__((target("sse4.1"))) inline __m128i decodePackSse(__m128i values)
+    {
+        const __m128i merge_ab_bc = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        const __m128i merged = _mm_madd_epi16(merge_ab_bc, _mm_set1_epi32(0x00011000));
+        return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    }
+
+    __attribute__((target("sse4.1"))) size_t decodeSse(const char *in, size_t size, unsigned char *out)
+    {
+        size_t i = 0;
+        size_t o = 0;
+
+        // Each step stores 16 bytes of which 12 are valid, callers provide the slack.
+        for (; i + 16 <= size; i += 16, o += 12)
+        {
+            __m128i values{};
+            if (!decodeLookupSse(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), values))
+            {
+                break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + o), decodePackSse(values));
+        }
+
+        return o + decodeScalar(in + i, size - i, out + o);
+    }
+
+    __attribute__((target("avx2"))) size_t encodeAvx2(const unsigned char *data, size_t size, char *out)
+    {
+        const __m256i shuf = _mm256_set_epi8(
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+        const __m256i shift_lut = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0);
+
+        size_t i = 0;
+        size_t o = 0;
+
+        // 24 input bytes per step as two 12 byte lanes, the second 16 byte load ends at i + 28.
+        for (; i + 28 <= size; i += 24, o += 32)
+        {
+            const __m128i lo_half = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            const __m128i hi_half = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 12));
+            __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo_half), hi_half, 1);
+            in = _mm256_shuffle_epi8(in, shuf);
+
+            const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+            const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+            const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+            const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+            const __m256i indices = _mm256_or_si256(t1, t3);
+
+            __m256i res = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+            const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+            res = _mm256_or_si256(res, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+            res = _mm256_shuffle_epi8(shift_lut, res);
+            res = _mm256_add_epi8(res, indices);
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + o), res);
+        }
+
+        return o + encodeSse(data + i, size - i, out + o);
+    }
+
+    __attribute__((target("avx2"))) size_t decodeAvx2(const char *in, size_t size, unsigned char *out)
+    {
+        const __m256i lut_lo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m256i lut_hi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m256i lut_roll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71,
+            0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71,
+            0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i pack_shuf = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+        size_t i = 0;
+        size_t o = 0;
+
+        // Each step stores 32 bytes of which 24 are valid, callers provide the slack.
+        for (; i + 32 <= size; i += 32, o += 24)
+        {
+            const __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+            const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(chars, 4), _mm256_set1_epi8(0x0f));
+            const __m256i lo_nibbles = _mm256_and_si256(chars, _mm256_set1_epi8(0x0f));
+            const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+            const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+            if (!_mm256_testz_si256(lo, hi))
+            {
+                break;
+            }
+
+            const __m256i eq_2f = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(0x2f));
+            const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+            const __m256i values = _mm256_add_epi8(chars, roll);
+
+            const __m256i merge_ab_bc = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+            __m256i merged = _mm256_madd_epi16(merge_ab_bc, _mm256_set1_epi32(0x00011000));
+            merged = _mm256_shuffle_epi8(merged, pack_shuf);
+            merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + o), merged);
+        }
+
+        return o + decodeSse(in + i, size - i, out + o);
+    }
+#endif
+
+    struct Codec
+    {
+        const char *name{"scalar"};
+        size_t (*encode)(const unsigned char *, size_t, char *){encodeScalar};
+        size_t (*decode)(const char *, size_t, unsigned char *){decodeScalar};
+    };
+
+    // ex_base64_codec=scalar|sse4.1|avx2 forces a codec, used by base64_bench to compare them on one machine.
+    Codec selectCodec()
+    {
+        const char *forced = getenv("ex_base64_codec");
+        const std::string forced_name = forced ? forced : "";
+        if (forced_name == "scalar")
+        {
+            return Codec{};
+        }
+
+#ifdef DD_BASE64_X86
+        __builtin_cpu_init();
+        const bool has_avx2 = __builtin_cpu_supports("avx2");
+        const bool has_sse41 = __builtin_cpu_supports("sse4.1");
+
+        if (has_avx2 && (forced_name.empty() || forced_name == "avx2"))
+        {
+            return Codec{"avx2", encodeAvx2, decodeAvx2};
+        }
+        if (has_sse41 && (forced_name.empty() || forced_name == "sse4.1"))
+        {
+            return Codec{"sse4.1", encodeSse, decodeSse};
+        }
+#endif
+
+        return Codec{};
+    }
+
+    const Codec &codec()
+    {
+        static const Codec s = selectCodec();
+        return s;
+    }
+
+    // SIMD decode stores whole vectors, the output buffer gets this much room past the decoded size.
+    constexpr size_t decode_slack = 32;
+}
+
+const char *base64_codec_name()
+{
+    return codec().name;
+}
+
+size_t base64_encoded_size(size_t size)
+{
+    return (size + 2) / 3 * 4;
+}
+
+size_t base64_encode_to(const unsigned char *data, size_t size, char *out)
+{
+    return codec().encode(data, size, out);
+}
+
+std::string base64_encode(const unsigned char *data, size_t size)
+{
+    std::string ret(base64_encoded_size(size), '\0');
+    ret.resize(base64_encode_to(data, size, ret.data()));
+    return ret;
+}
+
+std::string base64_encode(const std::vector<unsigned char> &data)
+{
+    return base64_encode(data.data(), data.size());
+}
+
+size_t base64_decoded_max_size(size_t size)
+{
+    return size / 4 * 3 + 2 + decode_slack;
+}
+
+size_t base64_decode_to(std::string_view base64_string, unsigned char *out)
+{
+    return codec().decode(base64_string.data(), base64_string.size(), out);
+}
+
+const std::vector<unsigned char> base64_decode(const std::string &base64_string)
+{
+    std::vector<unsigned char> decoded_data(base64_decoded_max_size(base64_string.size()));
+    decoded_data.resize(base64_decode_to(base64_string, decoded_data.data()));
+    return decoded_data;
+}
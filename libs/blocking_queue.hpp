@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// Bounded multi producer / multi consumer queue used to hand work between threads.
+// close() wakes every waiter, pop() then drains what is left and returns nullopt once empty.
+template <typename T>
+class BlockingQueue
+{
+public:
+    explicit BlockingQueue(size_t capacity) : _capacity(capacity ? capacity : 1) {}
+
+    BlockingQueue(const BlockingQueue &l) = delete;
+    BlockingQueue(BlockingQueue &&l) = delete;
+    BlockingQueue &operator=(const BlockingQueue &l) = delete;
+    BlockingQueue &operator=(BlockingQueue &&l) = delete;
+
+    inline bool push(T value)
+    {
+        std::unique_lock lock{_mut};
+        _not_full.wait(lock, [&]()
+                       { return _closed || _items.size() < _capacity; });
+        if (_closed)
+        {
+            return false;
+        }
+
+        _items.push_back(std::move(value));
+        _not_empty.notify_one();
+        return true;
+    }
+
+    inline bool tryPush(T value)
+    {
+        std::lock_guard lock{_mut};
+        if (_closed || _items.size() >= _capacity)
+        {
+            return false;
+        }
+
+        _items.push_back(std::move(value));
+        _not_empty.notify_one();
+        return true;
+    }
+
+    inline std::optional<T> pop()
+    {
+        std::unique_lock lock{_mut};
+        _not_empty.wait(lock, [&]()
+                        { return _closed || !_items.empty(); });
+        return popLocked();
+    }
+
+    template <typename Rep, typename Period>
+    inline std::optional<T> popFor(const std::chrono::duration<Rep, Period> &timeout)
+    {
+        std::unique_lock lock{_mut};
+        _not_empty.wait_for(lock, timeout, [&]()
+                            { return _closed || !_items.empty(); });
+        return popLocked();
+    }
+
+    inline std::optional<T> tryPop()
+    {
+        std::lock_guard lock{_mut};
+        return popLocked();
+    }
+
+    inline void close()
+    {
+        std::lock_guard lock{_mut};
+        _closed = true;
+        _not_empty.notify_all();
+        _not_full.notify_all();
+    }
+
+    inline size_t size()
+    {
+        std::lock_guard lock{_mut};
+        return _items.size();
+    }
+
+private:
+    inline std::optional<T> popLocked()
+    {
+        if (_items.empty())
+        {
+            return std::nullopt;
+        }
+
+        T value = std::move(_items.front());
+        _items.pop_front();
+        _not_full.notify_one();
+        return value;
+    }
+
+    const size_t _capacity;
+    std::mutex _mut{};
+    std::condition_variable _not_empty{};
+    std::condition_variable _not_full{};
+    std::deque<T> _items{};
+    bool _closed{false};
+};
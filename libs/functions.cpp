@@ -1,10 +1,58 @@
 #include "functions.hpp"
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 
 const std::string FoodRecognitions::Status::Waiting = {"1"};
 const std::string FoodRecognitions::Status::Processing = {"2"};
 const std::string FoodRecognitions::Status::Done = {"3"};
 const std::string FoodRecognitions::Status::Error = {"4"};
 
+std::string sha256Hex(std::string_view data)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE]{};
+    unsigned int digest_size{0};
+    if (!EVP_Digest(data.data(), data.size(), digest, &digest_size, EVP_sha256(), nullptr))
+    {
+        LOG_ERROR("if(!EVP_Digest(data.data(), data.size(), digest, &digest_size, EVP_sha256(), nullptr))");
+        return {};
+    }
+
+    static constexpr char hex_digits[] = "0123456789abcdef";
+    std::string res(digest_size * 2, '0');
+    for (unsigned int i = 0; i < digest_size; ++i)
+    {
+        res[i * 2] = hex_digits[digest[i] >> 4];
+        res[i * 2 + 1] = hex_digits[digest[i] & 0x0f];
+    }
+    return res;
+}
+
+std::string newUuidV4()
+{
+    unsigned char bytes[16]{};
+    if (RAND_bytes(bytes, sizeof(bytes)) != 1)
+    {
+        LOG_ERROR("if(RAND_bytes(bytes, sizeof(bytes)) != 1)");
+        return {};
+    }
+    bytes[6] = static_cast<unsigned char>((bytes[6] & 0x0f) | 0x40);
+    bytes[8] = static_cast<unsigned char>((bytes[8] & 0x3f) | 0x80);
+
+    static constexpr char hex_digits[] = "0123456789abcdef";
+    std::string res{};
+    res.reserve(36);
+    for (size_t i = 0; i < sizeof(bytes); ++i)
+    {
+        if (i == 4 || i == 6 || i == 8 || i == 10)
+        {
+            res += '-';
+        }
+        res += hex_digits[bytes[i] >> 4];
+        res += hex_digits[bytes[i] & 0x0f];
+    }
+    return res;
+}
+
 const nlohmann::json Prompts::nutrition_schema = {
     {"type", "object"},
     {"properties", {{"products", {{"type", "array"}, {"items", {{"type", "object"}, {"properties", {{"name", {{"type", "string"}, {"description", "Exact food name identified in the image"}}}, {"grams", {{"type", "integer"}, {"description", "Detected weight in grams"}}}, {"carbs", {{"type", "integer"}, {"description", "Calculated total carbohydrates rounded to the nearest integer"}}}}}, {"required", {"name", "grams", "carbs"}}}}}}}},
@@ -2,10 +2,14 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include "nlohmann/json.hpp"
+#include "logger.hpp"
 #include <set>
 #include <unordered_set>
+#include <algorithm>
+#include <optional>
 
 struct FoodRecognitions
 {
@@ -34,62 +38,23 @@ ScopeExit<F> makeScopeExit(F f)
     return ScopeExit<F>(std::move(f));
 }
 
-class Logger
+// Validates and parses in one pass and never throws, replaces json::accept() followed by json::parse().
+// The out-param overload lets a caller keep one json object for repeated parses.
+inline bool parseJson(std::string_view str, nlohmann::json &out)
 {
-public:
-    Logger(const Logger &l) = delete;
-    Logger(Logger &&l) = delete;
-    Logger &operator=(const Logger &l) = delete;
-    Logger &operator=(Logger &&l) = delete;
-
-    static inline Logger &getInstance()
-    {
-        static Logger s{};
-        return s;
-    }
-
-    inline void bindInfo(std::ostream *stream)
-    {
-        _info_stream = stream;
-    }
-
-    inline void bindError(std::ostream *stream)
-    {
-        _error_stream = stream;
-    }
-
-    inline void info(const std::string &str)
-    {
-        (*_info_stream) << str << std::endl;
-    }
-
-    inline void error(const std::string &str)
-    {
-        (*_error_stream) << str << std::endl;
-    }
+    out = nlohmann::json::parse(str.begin(), str.end(), nullptr, false);
+    return !out.is_discarded();
+}
 
-private:
-    inline Logger()
+inline std::optional<nlohmann::json> parseJson(std::string_view str)
+{
+    auto res = nlohmann::json::parse(str.begin(), str.end(), nullptr, false);
+    if (res.is_discarded())
     {
+        return std::nullopt;
     }
-
-    std::ostream *_info_stream{&std::cout};
-    std::ostream *_error_stream{&std::cerr};
-};
-
-#undef LOG_ERROR
-#define LOG_ERROR(x)                                                                                                                     \
-    do                                                                                                                                   \
-    {                                                                                                                                    \
-        Logger::getInstance().error(std::string{__FILE__} + ":" + std::to_string(__LINE__) + " " + std::string{__FUNCTION__} + " " + x); \
-    } while (0)
-
-#undef LOG_INFO
-#define LOG_INFO(x)                                                                                                                     \
-    do                                                                                                                                  \
-    {                                                                                                                                   \
-        Logger::getInstance().info(std::string{__FILE__} + ":" + std::to_string(__LINE__) + " " + std::string{__FUNCTION__} + " " + x); \
-    } while (0)
+    return res;
+}
 
 inline std::string getFileAsString(const std::string &path)
 {
@@ -119,7 +84,7 @@ inline std::vector<uint8_t> getFileAsStringVecU8(const std::string &path)
     return res_vec;
 }
 
-inline bool writeBytesToFile(const std::string &filename, const std::vector<uint8_t> &data)
+inline bool writeBytesToFile(const std::string &filename, std::string_view data)
 {
     std::ofstream file(filename, std::ios::binary);
 
@@ -129,7 +94,7 @@ inline bool writeBytesToFile(const std::string &filename, const std::vector<uint
         return false;
     }
 
-    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    file.write(data.data(), data.size());
     if (file.fail())
     {
         LOG_ERROR("Can write to file: " + filename);
@@ -139,6 +104,17 @@ inline bool writeBytesToFile(const std::string &filename, const std::vector<uint
     return true;
 }
 
+inline bool writeBytesToFile(const std::string &filename, const std::vector<uint8_t> &data)
+{
+    return writeBytesToFile(filename, std::string_view{reinterpret_cast<const char *>(data.data()), data.size()});
+}
+
+inline bool isUnsignedNumber(const std::string &str)
+{
+    return !str.empty() && str.size() <= 19 && std::all_of(str.begin(), str.end(), [](char c)
+                                                            { return c >= '0' && c <= '9'; });
+}
+
 class Cfg
 {
 public:
@@ -168,14 +144,12 @@ public:
             return false;
         }
 
-        if (!nlohmann::json::accept(file_str))
+        if (!parseJson(file_str, _file_json))
         {
-            LOG_ERROR("if (!nlohmann::json::accept(file_str))");
+            LOG_ERROR("if (!parseJson(file_str, _file_json))");
             return false;
         }
 
-        _file_json = nlohmann::json::parse(file_str);
-
         return checkValues();
     }
 
@@ -195,14 +169,12 @@ public:
             return false;
         }
 
-        if (!nlohmann::json::accept(file_str))
+        if (!parseJson(file_str, _file_json))
         {
-            LOG_ERROR("if (!nlohmann::json::accept(file_str))");
+            LOG_ERROR("if (!parseJson(file_str, _file_json))");
             return false;
         }
 
-        _file_json = nlohmann::json::parse(file_str);
-
         return checkValues();
     }
 
@@ -252,120 +224,121 @@ public:
         return _file_json[key].get<std::string>();
     }
 
-private:
-    inline Cfg()
+    // Structured values such as arrays of objects, null when the key is missing.
+    inline nlohmann::json getCfgJson(const std::string &key) const
     {
-    }
-
-    nlohmann::json _file_json{};
-};
-
-inline static const std::string base64_chars =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-    "abcdefghijklmnopqrstuvwxyz"
-    "0123456789+/";
-
-inline const std::vector<unsigned char> base64_decode(const std::string &base64_string)
-{
-    std::vector<unsigned char> decoded_data;
-    decoded_data.reserve(base64_string.size() * 3 / 4);
-
-    int in_len = base64_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-
-    while (in_len-- && (base64_string[in_] != '=') &&
-           (isalnum(base64_string[in_]) || (base64_string[in_] == '+') || (base64_string[in_] == '/')))
-    {
-        char_array_4[i++] = base64_string[in_];
-        in_++;
-        if (i == 4)
+        if (!_file_json.contains(key))
         {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = base64_chars.find(char_array_4[i]);
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++)
-                decoded_data.push_back(char_array_3[i]);
-            i = 0;
+            return nullptr;
         }
+        return _file_json[key];
     }
 
-    if (i)
+    inline std::string getCfgValueOr(const std::string &key, const std::string &default_value) const
     {
-        for (j = i; j < 4; j++)
-            char_array_4[j] = 0;
+        const std::string value = getCfgValue(key);
+        return value.empty() ? default_value : value;
+    }
 
-        for (j = 0; j < 4; j++)
-            char_array_4[j] = base64_chars.find(char_array_4[j]);
+    inline size_t getCfgSizeT(const std::string &key, size_t default_value) const
+    {
+        if (!_file_json.contains(key))
+        {
+            return default_value;
+        }
 
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+        const auto &value = _file_json[key];
+        if (value.is_number_unsigned())
+        {
+            return value.get<size_t>();
+        }
+        if (value.is_string() && isUnsignedNumber(value.get<std::string>()))
+        {
+            return std::stoull(value.get<std::string>());
+        }
 
-        for (j = 0; (j < i - 1); j++)
-            decoded_data.push_back(char_array_3[j]);
+        LOG_ERROR("cfg value is not unsigned number: " + key);
+        return default_value;
     }
 
-    return decoded_data;
-}
-
-inline std::string base64_encode(const std::vector<unsigned char> &data)
-{
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-    size_t in_len = data.size();
-
-    while (in_len--)
+    inline double getCfgDouble(const std::string &key, double default_value) const
     {
-        char_array_3[i++] = data[j++];
-        if (i == 3)
+        if (!_file_json.contains(key))
         {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
+            return default_value;
+        }
 
-            for (i = 0; i < 4; i++)
+        const auto &value = _file_json[key];
+        if (value.is_number())
+        {
+            return value.get<double>();
+        }
+        if (value.is_string())
+        {
+            try
+            {
+                return std::stod(value.get<std::string>());
+            }
+            catch (...)
             {
-                ret += base64_chars[char_array_4[i]];
             }
-            i = 0;
         }
+
+        LOG_ERROR("cfg value is not number: " + key);
+        return default_value;
     }
 
-    if (i)
+    inline bool getCfgBool(const std::string &key, bool default_value) const
     {
-        for (int j = i; j < 3; j++)
+        if (!_file_json.contains(key))
         {
-            char_array_3[j] = '\0';
+            return default_value;
         }
 
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-
-        for (int j = 0; j < i + 1; j++)
+        const auto &value = _file_json[key];
+        if (value.is_boolean())
         {
-            ret += base64_chars[char_array_4[j]];
+            return value.get<bool>();
         }
-
-        while (i++ < 3)
+        if (value.is_string() && (value.get<std::string>() == "true" || value.get<std::string>() == "1"))
+        {
+            return true;
+        }
+        if (value.is_string() && (value.get<std::string>() == "false" || value.get<std::string>() == "0"))
         {
-            ret += '=';
+            return false;
         }
+
+        LOG_ERROR("cfg value is not bool: " + key);
+        return default_value;
     }
 
-    return ret;
-}
+private:
+    inline Cfg()
+    {
+    }
+
+    nlohmann::json _file_json{};
+};
+
+// Lowercase hex SHA-256, implemented in functions.cpp on top of OpenSSL.
+std::string sha256Hex(std::string_view data);
+
+// Random RFC 4122 version 4 UUID in the 8-4-4-4-12 form, from OpenSSL's CSPRNG. Empty if that fails.
+std::string newUuidV4();
+
+// Implemented in base64.cpp, dispatches at runtime to an AVX2, SSE4.1 or scalar codec.
+const char *base64_codec_name();
+size_t base64_encoded_size(size_t size);
+// out must have room for base64_encoded_size(size) chars, returns number of chars written.
+size_t base64_encode_to(const unsigned char *data, size_t size, char *out);
+std::string base64_encode(const unsigned char *data, size_t size);
+std::string base64_encode(const std::vector<unsigned char> &data);
+// Upper bound for base64_decode_to output including the scratch space the SIMD kernels need.
+size_t base64_decoded_max_size(size_t size);
+// Decodes up to the first '=' or non base64 char, returns number of bytes written.
+size_t base64_decode_to(std::string_view base64_string, unsigned char *out);
+const std::vector<unsigned char> base64_decode(const std::string &base64_string);
 
 inline std::string image_to_base64(const std::string &image_path)
 {
@@ -434,6 +407,30 @@ inline MimeTypeAndBase64 image_to_base64_data_uri(const std::string &image_path)
     return MimeTypeAndBase64{mime_type, base64_string};
 }
 
+// Implemented in image.cpp on top of libjpeg and libpng.
+// "image/jpeg" or "image/png" from the leading bytes, empty for anything else.
+std::string mime_type_of_image(const unsigned char *data, size_t size);
+
+struct DownscaledImage
+{
+    std::vector<unsigned char> jpeg{};
+    size_t width{0};
+    size_t height{0};
+    // Shrunk or turned upright, the original is not what the LLM should see.
+    bool resized{false};
+};
+
+// Decodes a JPEG or PNG, shrinks it so the longer side is at most max_dimension (0 keeps the size),
+// applies the EXIF orientation and encodes it as a JPEG of jpeg_quality.
+bool downscale_image(const unsigned char *data, size_t size, size_t max_dimension, int jpeg_quality, DownscaledImage &out, std::string &error);
+
+// The image as it goes to the LLM. The prepared copy is kept next to the original as
+// <image_path>.llm<max_dimension>q<jpeg_quality> and read from there next time. 0 for max_dimension
+// or an image that does not decode sends the original.
+MimeTypeAndBase64 image_to_llm_base64_data_uri(const std::string &image_path, size_t max_dimension, int jpeg_quality);
+// Same with llm_image_max_dimension (1024) and llm_image_jpeg_quality (85) from the cfg.
+MimeTypeAndBase64 image_to_llm_base64_data_uri(const std::string &image_path);
+
 inline std::string ext_of_mime_type(const std::string &mime_type)
 {
     if (!supported_mime_types.count(mime_type))
@@ -453,6 +450,24 @@ inline std::string ext_of_mime_type(const std::string &mime_type)
     return copy_str;
 }
 
+inline std::string mime_type_of_ext(const std::string &ext)
+{
+    std::string lower_ext = ext;
+    std::transform(lower_ext.begin(), lower_ext.end(), lower_ext.begin(), [](unsigned char c)
+                   { return std::tolower(c); });
+
+    if (lower_ext == "jpg" || lower_ext == "jpeg")
+    {
+        return "image/jpeg";
+    }
+    if (lower_ext == "png")
+    {
+        return "image/png";
+    }
+
+    return {};
+}
+
 inline bool isFloat(const std::string &str)
 {
     try
@@ -1,81 +1,53 @@
 #include "gemini.hpp"
-#include <curl/curl.h>
+#include "http_client.hpp"
+#include "metrics.hpp"
 
-static size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::string *userp)
-{
-    size_t total_size = size * nmemb;
-    userp->append((char *)contents, total_size);
-    return total_size;
-}
+// Stands in for the image in the request JSON, the body is sent around it so the base64 text is never copied.
+static const std::string image_placeholder = "@@image_base64@@";
 
-bool gemini::jsonTextImg(const std::string& model_type, const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, nlohmann::json &res_json)
+static nlohmann::json buildRequest(const std::string &prompt, const std::string &mime_type, const nlohmann::json &response_schema)
 {
-    const std::string api_key = Cfg::getInstance().getCfgValue("gemini_api_key");
-
-    struct curl_slist *headers = NULL;
-    CURL *curl = NULL;
-    CURLcode res;
-    std::string response_string;
-    bool success = false;
-
-    const auto cleanup = [&]()
-    {
-        if (headers)
-            curl_slist_free_all(headers);
-        if (curl)
-            curl_easy_cleanup(curl);
-    };
-
-    curl = curl_easy_init();
-    if (!curl)
-    {
-        cleanup();
-        res_json = {{"function_error", "if(!curl)"}};
-        LOG_ERROR(res_json.dump());
-        return false;
-    }
-
-    std::string url = "https://generativelanguage.googleapis.com/v1beta/models/" + model_type + ":generateContent?key=" + api_key;
-    
     nlohmann::json generation_config = {
         {"response_mime_type", "application/json"},
         {"response_schema", response_schema}};
 
     nlohmann::json request_json = {
-        {"contents", {{{"parts", {{{"text", prompt}}, {{"inline_data", {{"mime_type", mime_type}, {"data", base64_image}}}}}}}}},
+        {"contents", {{{"parts", {{{"text", prompt}}, {{"inline_data", {{"mime_type", mime_type}, {"data", image_placeholder}}}}}}}}},
         {"generation_config", generation_config}};
 
-    std::string json_str = request_json.dump();
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_str.c_str());
+    return request_json;
+}
 
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+static HttpClient::Request buildHttpRequest(const std::string& model_type, const std::string &prompt, const std::string &mime_type, std::string_view base64_image, std::shared_ptr<const std::string> base64_owner, const nlohmann::json &response_schema)
+{
+    const std::string api_key = Cfg::getInstance().getCfgValue("gemini_api_key");
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_string);
+    static const std::string base_url = Cfg::getInstance().getCfgValueOr("gemini_base_url", "https://generativelanguage.googleapis.com");
 
-    res = curl_easy_perform(curl);
+    HttpClient::Request request{};
+    request.url = base_url + "/v1beta/models/" + model_type + ":generateContent?key=" + api_key;
+    request.headers = {
+        "Content-Type: application/json",
+    };
+    request.body = HttpClient::Body::jsonAround(buildRequest(prompt, mime_type, response_schema), image_placeholder, base64_image, std::move(base64_owner));
+    return request;
+}
 
-    if (res != CURLE_OK)
-    {
-        cleanup();
-        res_json = {{"function_error", "if (res != CURLE_OK)"}};
-        LOG_ERROR(res_json.dump());
-        return false;
-    }
+HttpClient::Request gemini::jsonTextImgRequest(const std::string& model_type, const std::string &prompt, const std::string &mime_type, std::shared_ptr<const std::string> base64_image, const nlohmann::json &response_schema)
+{
+    const std::string_view base64_view = *base64_image;
+    return buildHttpRequest(model_type, prompt, mime_type, base64_view, std::move(base64_image), response_schema);
+}
 
-    if (!nlohmann::json::accept(response_string))
+bool gemini::parseJsonTextImg(const std::string &body, nlohmann::json &res_json)
+{
+    nlohmann::json full_response{};
+    if (!parseJson(body, full_response))
     {
-        cleanup();
-        res_json = {{"function_error", "if (!nlohmann::json::accept(response_string))"}};
+        res_json = {{"function_error", "if (!parseJson(response.body, full_response))"}};
         LOG_ERROR(res_json.dump());
         return false;
     }
-
-    nlohmann::json full_response = nlohmann::json::parse(response_string);
     if (full_response.contains("candidates") && !full_response["candidates"].empty())
     {
         if (full_response["candidates"][0].contains("content") &&
@@ -85,13 +57,12 @@ bool gemini::jsonTextImg(const std::string& model_type, const std::string &promp
             full_response["candidates"][0]["content"]["parts"][0]["text"].is_string())
         {
             auto& correct_resp = full_response["candidates"][0]["content"]["parts"][0]["text"];
-            if(!nlohmann::json::accept(correct_resp.get<std::string>()))
+            if(!parseJson(correct_resp.get_ref<const std::string &>(), res_json))
             {
-                res_json = {{"function_error", "if(!nlohmann::json::accept(correct_resp.get<std::string>()))"}};
+                res_json = {{"function_error", "if(!parseJson(correct_resp.get_ref<const std::string &>(), res_json))"}};
                 LOG_ERROR(res_json.dump());
+                return false;
             }
-            res_json = nlohmann::json::parse(correct_resp.get<std::string>());
-            cleanup();
             return true;
         }
         else
@@ -102,13 +73,119 @@ bool gemini::jsonTextImg(const std::string& model_type, const std::string &promp
     }
     else
     {
-        cleanup();
         res_json = {{"function_error", "No candidates in response"}};
         LOG_ERROR(res_json.dump());
         LOG_ERROR(full_response.dump());
         return false;
     }
 
-    cleanup();
     return false;
+}
+
+bool gemini::jsonTextImg(const std::string& model_type, const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, nlohmann::json &res_json)
+{
+    auto llm_call = Metrics::getInstance().call("llm_request", {{"provider", "gemini"}, {"model", model_type}, {"mode", "buffered"}});
+    // The caller's string outlives the blocking call, the body only points at it.
+    const HttpClient::Request request = buildHttpRequest(model_type, prompt, mime_type, base64_image, nullptr, response_schema);
+
+    HttpClient::Response response{};
+    std::string error{};
+    if (!HttpClient::getInstance().post(request.url, request.headers, request.body, response, error))
+    {
+        res_json = {{"function_error", error}};
+        LOG_ERROR(res_json.dump());
+        return false;
+    }
+
+    if (!parseJsonTextImg(response.body, res_json))
+    {
+        return false;
+    }
+    llm_call.succeed();
+    return true;
+}
+
+bool gemini::jsonTextImgStream(const std::string& model_type, const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, const ProductsStreamExtractor::ProductCallback &on_product, nlohmann::json &res_json)
+{
+    auto llm_call = Metrics::getInstance().call("llm_request", {{"provider", "gemini"}, {"model", model_type}, {"mode", "stream"}});
+    const std::string api_key = Cfg::getInstance().getCfgValue("gemini_api_key");
+
+    static const std::string base_url = Cfg::getInstance().getCfgValueOr("gemini_base_url", "https://generativelanguage.googleapis.com");
+    const std::string url = base_url + "/v1beta/models/" + model_type + ":streamGenerateContent?alt=sse&key=" + api_key;
+
+    const HttpClient::Body body = HttpClient::Body::jsonAround(buildRequest(prompt, mime_type, response_schema), image_placeholder, base64_image, nullptr);
+
+    const std::vector<std::string> headers{
+        "Content-Type: application/json",
+    };
+
+    // Each event is a partial GenerateContentResponse, the text parts of candidates[0] are fed to the extractor.
+    auto &first_product = Metrics::getInstance().histogram("llm_first_product_seconds", {{"provider", "gemini"}, {"model", model_type}});
+    const auto start_point = std::chrono::steady_clock::now();
+    bool is_first_product{true};
+    ProductsStreamExtractor extractor{[&](const nlohmann::json &product)
+                                      {
+                                          if (is_first_product)
+                                          {
+                                              is_first_product = false;
+                                              first_product.observe(std::chrono::steady_clock::now() - start_point);
+                                          }
+                                          on_product(product);
+                                      }};
+    std::string stream_error{};
+    SseParser sse{[&](std::string_view data) -> bool
+                  {
+                      nlohmann::json chunk{};
+                      if (!parseJson(data, chunk))
+                      {
+                          stream_error = "Stream chunk is not valid JSON";
+                          return false;
+                      }
+
+                      if (!chunk.contains("candidates") || !chunk["candidates"].is_array() || chunk["candidates"].empty())
+                      {
+                          return true;
+                      }
+
+                      const auto &candidate = chunk["candidates"][0];
+                      if (!candidate.contains("content") || !candidate["content"].contains("parts") || !candidate["content"]["parts"].is_array())
+                      {
+                          return true;
+                      }
+
+                      for (const auto &part : candidate["content"]["parts"])
+                      {
+                          if (!part.contains("text") || !part["text"].is_string())
+                          {
+                              continue;
+                          }
+
+                          if (!extractor.feed(part["text"].get_ref<const std::string &>()))
+                          {
+                              stream_error = "Response text is not valid JSON";
+                              return false;
+                          }
+                      }
+                      return true;
+                  }};
+
+    long status_code{0};
+    std::string error{};
+    const bool ok = HttpClient::getInstance().postStream(url, headers, body, [&](std::string_view bytes)
+                                                         { return sse.feed(bytes); }, status_code, error);
+    if (!ok || !sse.finish())
+    {
+        res_json = {{"function_error", stream_error.size() ? stream_error : error}};
+        LOG_ERROR(res_json.dump());
+        return false;
+    }
+
+    if (!extractor.finish(res_json))
+    {
+        res_json = {{"function_error", "Could not parse structured JSON from Gemini stream"}};
+        LOG_ERROR(res_json.dump());
+        return false;
+    }
+    llm_call.succeed();
+    return true;
 }
\ No newline at end of file
@@ -1,7 +1,17 @@
 #pragma once
 #include "functions.hpp"
+#include "http_client.hpp"
+#include "llm_stream.hpp"
 
 namespace gemini
 {
+    // The buffered call split in two, for callers that run the transfer themselves (hedged requests).
+    // The request body shares base64_image instead of copying it, hedges and fallbacks send the same string.
+    HttpClient::Request jsonTextImgRequest(const std::string& model_type, const std::string& promt, const std::string& mime_type, std::shared_ptr<const std::string> base64_image, const nlohmann::json& response_schema);
+    bool parseJsonTextImg(const std::string& body, nlohmann::json& res_json);
+
     bool jsonTextImg(const std::string& model_type, const std::string& promt, const std::string& mime_type, const std::string& base64_image, const nlohmann::json& response_schema, nlohmann::json& res_json);
+
+    // Same result through streamGenerateContent, every product is handed to on_product as soon as it is complete.
+    bool jsonTextImgStream(const std::string& model_type, const std::string& promt, const std::string& mime_type, const std::string& base64_image, const nlohmann::json& response_schema, const ProductsStreamExtractor::ProductCallback& on_product, nlohmann::json& res_json);
 }
\ No newline at end of file
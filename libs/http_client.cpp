@@ -0,0 +1,404 @@
+#include "http_client.hpp"
+
+static size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::string *userp)
+{
+    size_t total_size = size * nmemb;
+    userp->append((char *)contents, total_size);
+    return total_size;
+}
+
+struct StreamContext
+{
+    CURL *curl{nullptr};
+    const std::function<bool(std::string_view)> *on_data{nullptr};
+    std::string error_body{};
+    bool aborted{false};
+};
+
+static size_t StreamWriteCallback(void *contents, size_t size, size_t nmemb, StreamContext *ctx)
+{
+    const size_t total_size = size * nmemb;
+
+    long status_code{0};
+    curl_easy_getinfo(ctx->curl, CURLINFO_RESPONSE_CODE, &status_code);
+    if (status_code >= 300)
+    {
+        static constexpr size_t max_error_body = 64 * 1024;
+        ctx->error_body.append((char *)contents, std::min(total_size, max_error_body - std::min(max_error_body, ctx->error_body.size())));
+        return total_size;
+    }
+
+    if (!(*ctx->on_data)(std::string_view{(char *)contents, total_size}))
+    {
+        ctx->aborted = true;
+        return 0;
+    }
+    return total_size;
+}
+
+// A body sent through the read callback gets "Expect: 100-continue" above 1 MB, which costs a round trip
+// or a one second wait on servers that ignore it.
+static const char *const no_expect_header = "Expect:";
+
+static size_t ReadBodyCallback(char *buffer, size_t size, size_t nitems, HttpClient::BodyReader *reader)
+{
+    return reader->body->read(reader->piece, reader->offset, buffer, size * nitems);
+}
+
+// curl rewinds the body when it has to send it again, e.g. on a retried HTTP/2 stream.
+static int SeekBodyCallback(HttpClient::BodyReader *reader, curl_off_t offset, int origin)
+{
+    if (origin != SEEK_SET || offset < 0 || static_cast<size_t>(offset) > reader->body->size())
+    {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+
+    reader->piece = 0;
+    reader->offset = 0;
+    size_t skip = static_cast<size_t>(offset);
+    static thread_local char scratch[16 * 1024];
+    while (skip)
+    {
+        skip -= reader->body->read(reader->piece, reader->offset, scratch, std::min(skip, sizeof(scratch)));
+    }
+    return CURL_SEEKFUNC_OK;
+}
+
+void HttpClient::Body::append(std::string piece)
+{
+    append(std::make_shared<const std::string>(std::move(piece)));
+}
+
+void HttpClient::Body::append(std::shared_ptr<const std::string> piece)
+{
+    appendView(*piece);
+    _owners.push_back(std::move(piece));
+}
+
+void HttpClient::Body::appendView(std::string_view piece)
+{
+    if (piece.empty())
+    {
+        return;
+    }
+    _pieces.push_back(piece);
+    _size += piece.size();
+}
+
+HttpClient::Body HttpClient::Body::jsonAround(const nlohmann::json &json, std::string_view placeholder, std::string_view piece, std::shared_ptr<const std::string> owner)
+{
+    std::string dumped = json.dump();
+    const size_t placeholder_pos = dumped.find(placeholder);
+    if (placeholder_pos == std::string::npos)
+    {
+        LOG_ERROR("if(placeholder_pos == std::string::npos)");
+        Body body{};
+        body.append(std::move(dumped));
+        return body;
+    }
+
+    Body body{};
+    body.append(dumped.substr(0, placeholder_pos));
+    body.appendView(piece);
+    if (owner)
+    {
+        body._owners.push_back(std::move(owner));
+    }
+    body.append(dumped.substr(placeholder_pos + placeholder.size()));
+    return body;
+}
+
+std::string HttpClient::Body::str() const
+{
+    std::string res{};
+    res.reserve(_size);
+    for (const auto piece : _pieces)
+    {
+        res.append(piece);
+    }
+    return res;
+}
+
+size_t HttpClient::Body::read(size_t &piece, size_t &offset, char *out, size_t len) const
+{
+    size_t written{0};
+    while (written < len && piece < _pieces.size())
+    {
+        const auto current = _pieces[piece];
+        const size_t n = std::min(len - written, current.size() - offset);
+        std::memcpy(out + written, current.data() + offset, n);
+        written += n;
+        offset += n;
+        if (offset == current.size())
+        {
+            ++piece;
+            offset = 0;
+        }
+    }
+    return written;
+}
+
+void HttpClient::setPostBody(CURL *curl, BodyReader &reader)
+{
+    reader.piece = 0;
+    reader.offset = 0;
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(reader.body->size()));
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadBodyCallback);
+    curl_easy_setopt(curl, CURLOPT_READDATA, &reader);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, SeekBodyCallback);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, &reader);
+}
+
+HttpClient &HttpClient::getInstance()
+{
+    static HttpClient s{};
+    return s;
+}
+
+HttpClient::HttpClient()
+{
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    _max_idle_per_host = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("http_max_idle_per_host", 8));
+    _ca_info = Cfg::getInstance().getCfgValue("http_ca_info");
+    _connect_timeout_ms = static_cast<long>(Cfg::getInstance().getCfgSizeT("http_connect_timeout_ms", 10000));
+    _timeout_ms = static_cast<long>(Cfg::getInstance().getCfgSizeT("http_timeout_ms", 120000));
+    _low_speed_bytes = static_cast<long>(Cfg::getInstance().getCfgSizeT("http_low_speed_bytes", 1));
+    _low_speed_sec = static_cast<long>(Cfg::getInstance().getCfgSizeT("http_low_speed_sec", 60));
+
+    _share = curl_share_init();
+    if (!_share)
+    {
+        LOG_ERROR("if(!_share)");
+        return;
+    }
+
+    curl_share_setopt(_share, CURLSHOPT_LOCKFUNC, lockShare);
+    curl_share_setopt(_share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+    curl_share_setopt(_share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    // Connections are not shared: libcurl does not support one connection cache used from several threads at once,
+    // and the blocking callers and the AsyncHttpClient loop run on different threads. Each pooled handle keeps its own.
+    curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+HttpClient::~HttpClient()
+{
+    {
+        std::lock_guard lock{_pool_mut};
+        for (auto &[host, handles] : _idle_handles)
+        {
+            for (auto *curl : handles)
+            {
+                curl_easy_cleanup(curl);
+            }
+        }
+        _idle_handles.clear();
+    }
+
+    if (_share)
+    {
+        curl_share_cleanup(_share);
+    }
+}
+
+void HttpClient::lockShare(CURL *, curl_lock_data data, curl_lock_access, void *userptr)
+{
+    auto *self = static_cast<HttpClient *>(userptr);
+    self->_share_muts[data].lock();
+}
+
+void HttpClient::unlockShare(CURL *, curl_lock_data data, void *userptr)
+{
+    auto *self = static_cast<HttpClient *>(userptr);
+    self->_share_muts[data].unlock();
+}
+
+std::string HttpClient::hostKeyOf(const std::string &url)
+{
+    const size_t scheme_end = url.find("://");
+    const size_t host_begin = scheme_end == std::string::npos ? 0 : scheme_end + 3;
+    const size_t host_end = url.find_first_of("/?#", host_begin);
+    return url.substr(0, host_end == std::string::npos ? url.size() : host_end);
+}
+
+CURL *HttpClient::acquire(const std::string &url)
+{
+    const std::string host_key = hostKeyOf(url);
+    CURL *curl{nullptr};
+
+    {
+        std::lock_guard lock{_pool_mut};
+        auto &handles = _idle_handles[host_key];
+        if (!handles.empty())
+        {
+            curl = handles.back();
+            handles.pop_back();
+        }
+    }
+
+    if (curl)
+    {
+        // Keeps the live connection, only drops the options of the previous request.
+        curl_easy_reset(curl);
+    }
+    else
+    {
+        curl = curl_easy_init();
+        if (!curl)
+        {
+            LOG_ERROR("if(!curl)");
+            return nullptr;
+        }
+    }
+
+    if (_share)
+    {
+        curl_easy_setopt(curl, CURLOPT_SHARE, _share);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, _connect_timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, _timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, _low_speed_bytes);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, _low_speed_sec);
+    if (_ca_info.size())
+    {
+        curl_easy_setopt(curl, CURLOPT_CAINFO, _ca_info.c_str());
+    }
+
+    return curl;
+}
+
+void HttpClient::release(const std::string &url, CURL *curl)
+{
+    if (!curl)
+    {
+        return;
+    }
+
+    const std::string host_key = hostKeyOf(url);
+    {
+        std::lock_guard lock{_pool_mut};
+        auto &handles = _idle_handles[host_key];
+        if (handles.size() < _max_idle_per_host)
+        {
+            handles.push_back(curl);
+            return;
+        }
+    }
+
+    curl_easy_cleanup(curl);
+}
+
+bool HttpClient::post(const std::string &url, const std::vector<std::string> &headers, const std::string &body, Response &response, std::string &error)
+{
+    Body body_view{};
+    body_view.appendView(body);
+    return post(url, headers, body_view, response, error);
+}
+
+bool HttpClient::post(const std::string &url, const std::vector<std::string> &headers, const Body &body, Response &response, std::string &error)
+{
+    CURL *curl = acquire(url);
+    if (!curl)
+    {
+        error = "if(!curl)";
+        return false;
+    }
+
+    struct curl_slist *header_list{nullptr};
+    for (const auto &header : headers)
+    {
+        header_list = curl_slist_append(header_list, header.c_str());
+    }
+    header_list = curl_slist_append(header_list, no_expect_header);
+
+    response = Response{};
+    BodyReader reader{&body};
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    setPostBody(curl, reader);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_list);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response.body);
+
+    const CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status_code);
+
+    // The handle must not keep pointing at the freed header list while it sits in the pool.
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(header_list);
+
+    if (res != CURLE_OK)
+    {
+        error = "curl_easy_perform failed: " + std::string(curl_easy_strerror(res));
+        // A failed transfer may leave the connection in a bad state, do not return it to the pool.
+        curl_easy_cleanup(curl);
+        return false;
+    }
+
+    release(url, curl);
+    return true;
+}
+
+bool HttpClient::postStream(const std::string &url, const std::vector<std::string> &headers, const Body &body, const std::function<bool(std::string_view)> &on_data, long &status_code, std::string &error)
+{
+    CURL *curl = acquire(url);
+    if (!curl)
+    {
+        error = "if(!curl)";
+        return false;
+    }
+
+    struct curl_slist *header_list{nullptr};
+    for (const auto &header : headers)
+    {
+        header_list = curl_slist_append(header_list, header.c_str());
+    }
+    header_list = curl_slist_append(header_list, no_expect_header);
+    header_list = curl_slist_append(header_list, "Accept: text/event-stream");
+
+    StreamContext ctx{};
+    ctx.curl = curl;
+    ctx.on_data = &on_data;
+    status_code = 0;
+    BodyReader reader{&body};
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    setPostBody(curl, reader);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_list);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, StreamWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ctx);
+
+    const CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status_code);
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(header_list);
+
+    if (ctx.aborted)
+    {
+        error = "stream aborted by consumer";
+        curl_easy_cleanup(curl);
+        return false;
+    }
+
+    if (res != CURLE_OK)
+    {
+        error = "curl_easy_perform failed: " + std::string(curl_easy_strerror(res));
+        curl_easy_cleanup(curl);
+        return false;
+    }
+
+    release(url, curl);
+
+    if (status_code >= 300)
+    {
+        error = "HTTP " + std::to_string(status_code) + ": " + ctx.error_body;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include "functions.hpp"
+#include <curl/curl.h>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Process wide HTTP client for the LLM calls.
+// Easy handles are kept in a per host pool so their keep-alive connections survive between calls,
+// DNS results and TLS sessions are shared between all handles through one curl share handle, connections are not.
+// HTTP/2 is negotiated over TLS when the server supports it. Safe to use from several threads.
+// Every transfer is bounded by http_connect_timeout_ms (10 s), http_timeout_ms (120 s) and aborted when it moves
+// less than http_low_speed_bytes (1) per second for http_low_speed_sec (60), so a stuck peer can not hold a worker.
+class HttpClient
+{
+public:
+    struct Response
+    {
+        long status_code{0};
+        std::string body{};
+    };
+
+    // Request body sent piece by piece through CURLOPT_READFUNCTION, so the multi megabyte base64 image is
+    // referenced where it already is instead of being copied into one JSON string. Owned pieces are kept alive
+    // by every copy of the body, a view must outlive the transfers that send it.
+    class Body
+    {
+    public:
+        void append(std::string piece);
+        void append(std::shared_ptr<const std::string> piece);
+        void appendView(std::string_view piece);
+
+        // The dumped json with the string value placeholder replaced by piece. The text around it is owned,
+        // piece is referenced and kept alive by owner when one is given.
+        static Body jsonAround(const nlohmann::json &json, std::string_view placeholder, std::string_view piece, std::shared_ptr<const std::string> owner);
+
+        inline size_t size() const
+        {
+            return _size;
+        }
+
+        // Joined copy, for logs and tools that need the whole text.
+        std::string str() const;
+
+        // Copies up to len bytes from piece/offset on and advances them, returns the bytes copied.
+        size_t read(size_t &piece, size_t &offset, char *out, size_t len) const;
+
+    private:
+        std::vector<std::string_view> _pieces{};
+        std::vector<std::shared_ptr<const std::string>> _owners{};
+        size_t _size{0};
+    };
+
+    // Read position of a Body inside one transfer, must live as long as the transfer.
+    struct BodyReader
+    {
+        const Body *body{nullptr};
+        size_t piece{0};
+        size_t offset{0};
+    };
+
+    struct Request
+    {
+        std::string url{};
+        std::vector<std::string> headers{};
+        Body body{};
+    };
+
+    // One finished transfer of AsyncHttpClient, error is empty when the transfer itself completed.
+    struct Attempt
+    {
+        size_t index{0};
+        std::string error{};
+        Response response{};
+        std::chrono::steady_clock::duration elapsed{};
+    };
+
+    HttpClient(const HttpClient &l) = delete;
+    HttpClient(HttpClient &&l) = delete;
+    HttpClient &operator=(const HttpClient &l) = delete;
+    HttpClient &operator=(HttpClient &&l) = delete;
+
+    static HttpClient &getInstance();
+
+    bool post(const std::string &url, const std::vector<std::string> &headers, const Body &body, Response &response, std::string &error);
+    bool post(const std::string &url, const std::vector<std::string> &headers, const std::string &body, Response &response, std::string &error);
+
+    // Hands the response body to on_data piece by piece as it arrives instead of buffering it.
+    // Returning false from on_data aborts the transfer. A non 2xx body is collected into error instead.
+    bool postStream(const std::string &url, const std::vector<std::string> &headers, const Body &body, const std::function<bool(std::string_view)> &on_data, long &status_code, std::string &error);
+
+    // POST of reader.body with the size known up front, curl pulls the pieces as the socket takes them.
+    static void setPostBody(CURL *curl, BodyReader &reader);
+
+    // Pooled handle with the shared caches attached, must be returned through release().
+    CURL *acquire(const std::string &url);
+    void release(const std::string &url, CURL *curl);
+
+private:
+    HttpClient();
+    ~HttpClient();
+
+    static std::string hostKeyOf(const std::string &url);
+    static void lockShare(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+    static void unlockShare(CURL *handle, curl_lock_data data, void *userptr);
+
+    CURLSH *_share{nullptr};
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> _share_muts{};
+
+    std::mutex _pool_mut{};
+    std::unordered_map<std::string, std::vector<CURL *>> _idle_handles{};
+    size_t _max_idle_per_host{8};
+    std::string _ca_info{};
+    long _connect_timeout_ms{10000};
+    long _timeout_ms{120000};
+    long _low_speed_bytes{1};
+    long _low_speed_sec{60};
+};
@@ -0,0 +1,449 @@
+#include "functions.hpp"
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+#include <png.h>
+
+// Decoded image, 3 bytes per pixel.
+struct RgbPixels
+{
+    size_t width{0};
+    size_t height{0};
+    std::vector<unsigned char> rgb{};
+    // Set when the decoder already shrank the image.
+    bool scaled{false};
+};
+
+// An image of this many pixels takes 200 MB decoded, larger ones are not worth shrinking in a request path.
+// A JPEG is checked before it is scaled in the DCT, libjpeg still buffers a progressive one at full size.
+static constexpr size_t max_decoded_pixels = 64 * 1024 * 1024;
+
+std::string mime_type_of_image(const unsigned char *data, size_t size)
+{
+    static constexpr unsigned char jpeg_magic[] = {0xFF, 0xD8, 0xFF};
+    static constexpr unsigned char png_magic[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+    if (size >= sizeof(jpeg_magic) && std::equal(std::begin(jpeg_magic), std::end(jpeg_magic), data))
+    {
+        return "image/jpeg";
+    }
+    if (size >= sizeof(png_magic) && std::equal(std::begin(png_magic), std::end(png_magic), data))
+    {
+        return "image/png";
+    }
+    return {};
+}
+
+struct JpegError
+{
+    jpeg_error_mgr mgr{};
+    jmp_buf jump{};
+    char message[JMSG_LENGTH_MAX]{};
+};
+
+static void jpegErrorExit(j_common_ptr cinfo)
+{
+    auto *err = reinterpret_cast<JpegError *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+    longjmp(err->jump, 1);
+}
+
+static void jpegOutputMessage(j_common_ptr)
+{
+    // Warnings about corrupt but decodable data are not worth a log line per image.
+}
+
+// EXIF orientation 1..8 from an APP1 marker, 1 when there is none.
+static int exifOrientation(const jpeg_saved_marker_ptr markers)
+{
+    for (auto marker = markers; marker; marker = marker->next)
+    {
+        const unsigned char *data = marker->data;
+        const size_t size = marker->data_length;
+        if (marker->marker != JPEG_APP0 + 1 || size < 14 || std::memcmp(data, "Exif\0\0", 6) != 0)
+        {
+            continue;
+        }
+
+        const unsigned char *tiff = data + 6;
+        const size_t tiff_size = size - 6;
+        const bool little_endian = tiff[0] == 'I' && tiff[1] == 'I';
+        if (!little_endian && !(tiff[0] == 'M' && tiff[1] == 'M'))
+        {
+            continue;
+        }
+        const auto read16 = [&](size_t offset) -> uint32_t
+        {
+            return little_endian ? tiff[offset] | (tiff[offset + 1] << 8) : (tiff[offset] << 8) | tiff[offset + 1];
+        };
+        const auto read32 = [&](size_t offset) -> uint32_t
+        {
+            return little_endian ? read16(offset) | (read16(offset + 2) << 16) : (read16(offset) << 16) | read16(offset + 2);
+        };
+
+        const size_t ifd_offset = read32(4);
+        if (ifd_offset + 2 > tiff_size)
+        {
+            continue;
+        }
+        const size_t entries = read16(ifd_offset);
+        for (size_t i = 0; i < entries; ++i)
+        {
+            const size_t entry = ifd_offset + 2 + i * 12;
+            if (entry + 12 > tiff_size)
+            {
+                break;
+            }
+            if (read16(entry) == 0x0112)
+            {
+                const uint32_t orientation = read16(entry + 8);
+                return orientation >= 1 && orientation <= 8 ? static_cast<int>(orientation) : 1;
+            }
+        }
+    }
+    return 1;
+}
+
+// Lets libjpeg do most of the shrinking in the DCT, the output is the smallest n/8 scale that still
+// has max_dimension on its longer side.
+static bool decodeJpeg(const unsigned char *data, size_t size, size_t max_dimension, RgbPixels &pixels, int &orientation, std::string &error)
+{
+    jpeg_decompress_struct cinfo{};
+    JpegError err{};
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpegErrorExit;
+    err.mgr.output_message = jpegOutputMessage;
+    if (setjmp(err.jump))
+    {
+        error = std::string{"jpeg decode failed: "} + err.message;
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, static_cast<unsigned long>(size));
+    jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xFFFF);
+    jpeg_read_header(&cinfo, TRUE);
+    if (static_cast<size_t>(cinfo.image_width) * cinfo.image_height > max_decoded_pixels)
+    {
+        error = "jpeg too large: " + std::to_string(cinfo.image_width) + "x" + std::to_string(cinfo.image_height);
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    orientation = exifOrientation(cinfo.marker_list);
+
+    const size_t longer_side = std::max(cinfo.image_width, cinfo.image_height);
+    cinfo.scale_num = 8;
+    cinfo.scale_denom = 8;
+    if (max_dimension && longer_side > max_dimension)
+    {
+        cinfo.scale_num = static_cast<unsigned int>(std::clamp<size_t>((8 * max_dimension + longer_side - 1) / longer_side, 1, 8));
+    }
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+
+    pixels.width = cinfo.output_width;
+    pixels.height = cinfo.output_height;
+    pixels.scaled = cinfo.output_width != cinfo.image_width;
+    pixels.rgb.resize(pixels.width * pixels.height * 3);
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW row = pixels.rgb.data() + static_cast<size_t>(cinfo.output_scanline) * pixels.width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+// Transparent areas end up on white, the way the photo looks in a browser.
+static bool decodePng(const unsigned char *data, size_t size, RgbPixels &pixels, std::string &error)
+{
+    png_image image{};
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&image, data, size))
+    {
+        error = std::string{"png decode failed: "} + image.message;
+        return false;
+    }
+    if (static_cast<size_t>(image.width) * image.height > max_decoded_pixels)
+    {
+        error = "png too large: " + std::to_string(image.width) + "x" + std::to_string(image.height);
+        png_image_free(&image);
+        return false;
+    }
+
+    image.format = PNG_FORMAT_RGB;
+    pixels.width = image.width;
+    pixels.height = image.height;
+    pixels.rgb.resize(PNG_IMAGE_SIZE(image));
+    const png_color background{255, 255, 255};
+    if (!png_image_finish_read(&image, &background, pixels.rgb.data(), 0, nullptr))
+    {
+        error = std::string{"png decode failed: "} + image.message;
+        png_image_free(&image);
+        return false;
+    }
+    return true;
+}
+
+// Area average, every source pixel lands in exactly one destination pixel.
+static void boxResize(const RgbPixels &src, RgbPixels &dst)
+{
+    std::vector<size_t> x_begin(dst.width + 1);
+    for (size_t dx = 0; dx <= dst.width; ++dx)
+    {
+        x_begin[dx] = dx * src.width / dst.width;
+    }
+
+    dst.rgb.resize(dst.width * dst.height * 3);
+    std::vector<uint32_t> sums(dst.width * 3);
+    for (size_t dy = 0; dy < dst.height; ++dy)
+    {
+        const size_t y0 = dy * src.height / dst.height;
+        const size_t y1 = std::max(y0 + 1, (dy + 1) * src.height / dst.height);
+        std::fill(sums.begin(), sums.end(), 0);
+        for (size_t y = y0; y < y1; ++y)
+        {
+            const unsigned char *row = src.rgb.data() + y * src.width * 3;
+            for (size_t dx = 0; dx < dst.width; ++dx)
+            {
+                const size_t x1 = std::max(x_begin[dx] + 1, x_begin[dx + 1]);
+                for (size_t x = x_begin[dx]; x < x1; ++x)
+                {
+                    sums[dx * 3] += row[x * 3];
+                    sums[dx * 3 + 1] += row[x * 3 + 1];
+                    sums[dx * 3 + 2] += row[x * 3 + 2];
+                }
+            }
+        }
+
+        unsigned char *out = dst.rgb.data() + dy * dst.width * 3;
+        for (size_t dx = 0; dx < dst.width; ++dx)
+        {
+            const uint32_t count = static_cast<uint32_t>((y1 - y0) * (std::max(x_begin[dx] + 1, x_begin[dx + 1]) - x_begin[dx]));
+            for (size_t c = 0; c < 3; ++c)
+            {
+                out[dx * 3 + c] = static_cast<unsigned char>((sums[dx * 3 + c] + count / 2) / count);
+            }
+        }
+    }
+}
+
+// Turns the pixels upright, the re-encoded JPEG carries no EXIF to do it.
+static void applyOrientation(RgbPixels &pixels, int orientation)
+{
+    if (orientation <= 1)
+    {
+        return;
+    }
+
+    const size_t w = pixels.width;
+    const size_t h = pixels.height;
+    const bool transposed = orientation >= 5;
+    RgbPixels res{};
+    res.width = transposed ? h : w;
+    res.height = transposed ? w : h;
+    res.rgb.resize(pixels.rgb.size());
+    for (size_t dy = 0; dy < res.height; ++dy)
+    {
+        for (size_t dx = 0; dx < res.width; ++dx)
+        {
+            size_t sx{dx};
+            size_t sy{dy};
+            switch (orientation)
+            {
+            case 2: sx = w - 1 - dx; sy = dy; break;
+            case 3: sx = w - 1 - dx; sy = h - 1 - dy; break;
+            case 4: sx = dx; sy = h - 1 - dy; break;
+            case 5: sx = dy; sy = dx; break;
+            case 6: sx = dy; sy = h - 1 - dx; break;
+            case 7: sx = w - 1 - dy; sy = h - 1 - dx; break;
+            case 8: sx = w - 1 - dy; sy = dx; break;
+            }
+            std::memcpy(res.rgb.data() + (dy * res.width + dx) * 3, pixels.rgb.data() + (sy * w + sx) * 3, 3);
+        }
+    }
+    pixels = std::move(res);
+}
+
+// libjpeg grows the buffer through the pointers, so it belongs to the caller: a local changed after setjmp
+// is indeterminate once longjmp comes back.
+static bool encodeJpegToBuffer(const RgbPixels &pixels, int quality, unsigned char **buffer, unsigned long *buffer_size, std::string &error)
+{
+    jpeg_compress_struct cinfo{};
+    JpegError err{};
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpegErrorExit;
+    err.mgr.output_message = jpegOutputMessage;
+    if (setjmp(err.jump))
+    {
+        error = std::string{"jpeg encode failed: "} + err.message;
+        jpeg_destroy_compress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, buffer, buffer_size);
+    cinfo.image_width = static_cast<JDIMENSION>(pixels.width);
+    cinfo.image_height = static_cast<JDIMENSION>(pixels.height);
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, std::clamp(quality, 1, 100), TRUE);
+    cinfo.optimize_coding = TRUE;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        JSAMPROW row = const_cast<unsigned char *>(pixels.rgb.data()) + static_cast<size_t>(cinfo.next_scanline) * pixels.width * 3;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return true;
+}
+
+static bool encodeJpeg(const RgbPixels &pixels, int quality, std::vector<unsigned char> &out, std::string &error)
+{
+    unsigned char *buffer{nullptr};
+    unsigned long buffer_size{0};
+    const bool ok = encodeJpegToBuffer(pixels, quality, &buffer, &buffer_size, error);
+    if (ok)
+    {
+        out.assign(buffer, buffer + buffer_size);
+    }
+    free(buffer);
+    return ok;
+}
+
+bool downscale_image(const unsigned char *data, size_t size, size_t max_dimension, int jpeg_quality, DownscaledImage &out, std::string &error)
+{
+    out = DownscaledImage{};
+    const std::string mime_type = mime_type_of_image(data, size);
+
+    RgbPixels pixels{};
+    int orientation{1};
+    if (mime_type == "image/jpeg")
+    {
+        if (!decodeJpeg(data, size, max_dimension, pixels, orientation, error))
+        {
+            return false;
+        }
+    }
+    else if (mime_type == "image/png")
+    {
+        if (!decodePng(data, size, pixels, error))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        error = "not a jpeg or png image";
+        return false;
+    }
+
+    out.resized = pixels.scaled || orientation > 1;
+    const size_t longer_side = std::max(pixels.width, pixels.height);
+    if (max_dimension && longer_side > max_dimension)
+    {
+        RgbPixels resized{};
+        resized.width = std::max<size_t>(1, (pixels.width * max_dimension + longer_side / 2) / longer_side);
+        resized.height = std::max<size_t>(1, (pixels.height * max_dimension + longer_side / 2) / longer_side);
+        boxResize(pixels, resized);
+        pixels = std::move(resized);
+        out.resized = true;
+    }
+    applyOrientation(pixels, orientation);
+
+    out.width = pixels.width;
+    out.height = pixels.height;
+    return encodeJpeg(pixels, jpeg_quality, out.jpeg, error);
+}
+
+static bool read_file_bytes(const std::string &path, std::vector<unsigned char> &bytes)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    file.seekg(0, std::ios::end);
+    const std::streamsize file_size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    bytes.resize(static_cast<size_t>(std::max<std::streamsize>(0, file_size)));
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(bytes.data()), file_size));
+}
+
+MimeTypeAndBase64 image_to_llm_base64_data_uri(const std::string &image_path, size_t max_dimension, int jpeg_quality)
+{
+    if (!max_dimension)
+    {
+        return image_to_base64_data_uri(image_path);
+    }
+
+    // Derived from the file name and the settings only, a changed setting gets a file of its own.
+    const std::string cache_path = image_path + ".llm" + std::to_string(max_dimension) + "q" + std::to_string(jpeg_quality);
+    std::vector<unsigned char> bytes{};
+    if (read_file_bytes(cache_path, bytes))
+    {
+        const std::string mime_type = mime_type_of_image(bytes.data(), bytes.size());
+        if (mime_type.size())
+        {
+            return MimeTypeAndBase64{mime_type, base64_encode(bytes)};
+        }
+    }
+
+    if (!read_file_bytes(image_path, bytes))
+    {
+        LOG_ERROR("if (!read_file_bytes(image_path, bytes))");
+        return {};
+    }
+
+    DownscaledImage downscaled{};
+    std::string error{};
+    if (!downscale_image(bytes.data(), bytes.size(), max_dimension, jpeg_quality, downscaled, error))
+    {
+        // Sends the original as before, the provider may still make sense of it.
+        LOG_ERROR(image_path + " " + error);
+        return image_to_base64_data_uri(image_path);
+    }
+
+    // An upright image that needed no shrinking goes as it is unless the re-encoded one is smaller.
+    if (downscaled.resized || downscaled.jpeg.size() < bytes.size())
+    {
+        bytes = std::move(downscaled.jpeg);
+    }
+    const std::string mime_type = mime_type_of_image(bytes.data(), bytes.size());
+
+    // Written under a temporary name and renamed, a concurrent reader sees the whole file or none.
+    // The suffix is a fresh UUID, thread ids repeat across requester processes.
+    const std::string tmp_path = cache_path + ".tmp" + newUuidV4();
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (!file)
+        {
+            LOG_ERROR("if (!file) " + tmp_path);
+        }
+    }
+    std::error_code ec{};
+    std::filesystem::rename(tmp_path, cache_path, ec);
+    if (ec)
+    {
+        LOG_ERROR("rename failed: " + tmp_path + " " + ec.message());
+        std::filesystem::remove(tmp_path, ec);
+    }
+
+    return MimeTypeAndBase64{mime_type, base64_encode(bytes)};
+}
+
+MimeTypeAndBase64 image_to_llm_base64_data_uri(const std::string &image_path)
+{
+    static const size_t max_dimension = Cfg::getInstance().getCfgSizeT("llm_image_max_dimension", 1024);
+    static const int jpeg_quality = static_cast<int>(Cfg::getInstance().getCfgSizeT("llm_image_jpeg_quality", 85));
+    return image_to_llm_base64_data_uri(image_path, max_dimension, jpeg_quality);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "gemini.hpp"
+#include "openai.hpp"
+
+// The LLM backends behind one interface. openai:: and gemini:: share their signatures,
+// so a provider is just its name and its entry points.
+struct LlmProvider
+{
+    using JsonTextImg = bool (*)(const std::string &model_type, const std::string &promt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, nlohmann::json &res_json);
+    using JsonTextImgRequest = HttpClient::Request (*)(const std::string &model_type, const std::string &promt, const std::string &mime_type, std::shared_ptr<const std::string> base64_image, const nlohmann::json &response_schema);
+    using ParseJsonTextImg = bool (*)(const std::string &body, nlohmann::json &res_json);
+    using JsonTextImgStream = bool (*)(const std::string &model_type, const std::string &promt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, const ProductsStreamExtractor::ProductCallback &on_product, nlohmann::json &res_json);
+
+    std::string name{};
+    JsonTextImg json_text_img{nullptr};
+    JsonTextImgStream json_text_img_stream{nullptr};
+    JsonTextImgRequest json_text_img_request{nullptr};
+    ParseJsonTextImg parse_json_text_img{nullptr};
+};
+
+// nullptr for an unknown name.
+inline const LlmProvider *llmProviderOf(const std::string &name)
+{
+    static const std::array<LlmProvider, 2> providers{{
+        {"openai", &openai::jsonTextImg, &openai::jsonTextImgStream, &openai::jsonTextImgRequest, &openai::parseJsonTextImg},
+        {"gemini", &gemini::jsonTextImg, &gemini::jsonTextImgStream, &gemini::jsonTextImgRequest, &gemini::parseJsonTextImg},
+    }};
+
+    for (const auto &provider : providers)
+    {
+        if (provider.name == name)
+        {
+            return &provider;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,464 @@
+#include "llm_router.hpp"
+#include "async_http_client.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+
+// AvgTime and Accuracy measured by model_tests_1, see services/model_tests_1/model_stats/results.csv.
+// Costs are not known here, cost_capped needs llm_models with costs filled in.
+static const nlohmann::json default_models = nlohmann::json::parse(R"([
+    {"provider": "openai", "model": "gpt-4o",                         "expected_ms": 4453.29,  "accuracy": 69.67},
+    {"provider": "openai", "model": "gpt-4o-mini",                    "expected_ms": 3947.19,  "accuracy": 62.46},
+    {"provider": "openai", "model": "gpt-4.1",                        "expected_ms": 4727.42,  "accuracy": 78.69},
+    {"provider": "openai", "model": "gpt-4.1-mini",                   "expected_ms": 3442.66,  "accuracy": 74.49},
+    {"provider": "openai", "model": "o4-mini",                        "expected_ms": 8894.72,  "accuracy": 74.48},
+    {"provider": "gemini", "model": "gemini-2.0-flash",               "expected_ms": 2214.49,  "accuracy": 68.48},
+    {"provider": "gemini", "model": "gemini-2.0-flash-lite",          "expected_ms": 2273.93,  "accuracy": 71.86},
+    {"provider": "gemini", "model": "gemini-1.5-flash",               "expected_ms": 2088.21,  "accuracy": 64.43},
+    {"provider": "gemini", "model": "gemini-2.0-flash-exp",           "expected_ms": 2107.87,  "accuracy": 73.40},
+    {"provider": "gemini", "model": "gemini-2.5-flash-preview-05-20", "expected_ms": 6072.93,  "accuracy": 71.61},
+    {"provider": "gemini", "model": "gemini-2.5-pro-preview-05-06",   "expected_ms": 31571.79, "accuracy": 89.08}
+])");
+
+LlmRouter &LlmRouter::getInstance()
+{
+    static LlmRouter s{};
+    return s;
+}
+
+LlmRouter::Policy LlmRouter::policyOf(const std::string &name)
+{
+    if (name == "fastest")
+    {
+        return Policy::Fastest;
+    }
+    if (name == "most_accurate")
+    {
+        return Policy::MostAccurate;
+    }
+    if (name == "cost_capped")
+    {
+        return Policy::CostCapped;
+    }
+    if (name != "fixed")
+    {
+        LOG_ERROR("unknown llm_policy, using fixed: " + name);
+    }
+    return Policy::Fixed;
+}
+
+LlmRouter::LlmRouter()
+{
+    const auto &cfg = Cfg::getInstance();
+    _policy = policyOf(cfg.getCfgValueOr("llm_policy", "fixed"));
+    _fixed_model = cfg.getCfgValueOr("llm_fixed_model", "gemini-2.0-flash-exp");
+    _cost_cap = cfg.getCfgDouble("llm_cost_cap", 0.0);
+    _latency_budget_ms = cfg.getCfgDouble("llm_latency_budget_ms", 0.0);
+    _max_attempts = std::max<size_t>(1, cfg.getCfgSizeT("llm_max_attempts", 2));
+    _ewma_alpha = std::clamp(cfg.getCfgDouble("llm_ewma_alpha", 0.2), 0.01, 1.0);
+    _circuit_failures = std::max<size_t>(1, cfg.getCfgSizeT("llm_circuit_failures", 3));
+    _circuit_open = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(cfg.getCfgDouble("llm_circuit_open_sec", 30.0)));
+    _slow_factor = std::max(1.0, cfg.getCfgDouble("llm_slow_factor", 3.0));
+    _hedge_percentile = std::clamp(cfg.getCfgDouble("llm_hedge_percentile", 95.0), 0.0, 100.0);
+    _hedge_min_samples = cfg.getCfgSizeT("llm_hedge_min_samples", 20);
+
+    nlohmann::json models = cfg.getCfgJson("llm_models");
+    if (!models.is_array() || models.empty())
+    {
+        models = default_models;
+    }
+
+    for (const auto &obj : models)
+    {
+        if (!obj.is_object() || !obj.contains("provider") || !obj["provider"].is_string() || !obj.contains("model") || !obj["model"].is_string())
+        {
+            LOG_ERROR("llm_models entry needs provider and model: " + obj.dump());
+            continue;
+        }
+
+        ModelState state{};
+        state.info.provider = llmProviderOf(obj["provider"].get<std::string>());
+        if (!state.info.provider)
+        {
+            LOG_ERROR("unknown provider in llm_models: " + obj.dump());
+            continue;
+        }
+        state.info.model = obj["model"].get<std::string>();
+        state.info.accuracy = obj.value("accuracy", 0.0);
+        state.info.expected_ms = obj.value("expected_ms", 0.0);
+        state.info.cost = obj.value("cost", 0.0);
+        state.latency = &Metrics::getInstance().histogram("llm_model_latency_seconds", {{"model", state.info.model}}, "Successful LLM calls per model");
+
+        if (_policy == Policy::CostCapped && state.info.cost > _cost_cap)
+        {
+            continue;
+        }
+        _models.push_back(std::move(state));
+    }
+
+    if (_models.empty())
+    {
+        LOG_ERROR("no model left for llm_policy, every request will fail");
+    }
+}
+
+double LlmRouter::estimatedMs(const ModelState &state) const
+{
+    const double latency_ms = state.samples ? state.ewma_ms : state.info.expected_ms;
+    return latency_ms / std::max(0.05, 1.0 - state.error_rate);
+}
+
+bool LlmRouter::isHealthy(const ModelState &state, std::chrono::steady_clock::time_point now) const
+{
+    // Half-open after open_until: plan() dispatches the model first to a single request as a probe and keeps it
+    // out until that probe reported or probe_until passed. A failed probe reopens the circuit, a good one closes it.
+    if (state.consecutive_failures >= _circuit_failures && (now < state.open_until || now < state.probe_until))
+    {
+        return false;
+    }
+    if (state.samples >= 3 && state.info.expected_ms > 0.0 && state.ewma_ms > state.info.expected_ms * _slow_factor)
+    {
+        return false;
+    }
+    if (_latency_budget_ms > 0.0 && estimatedMs(state) > _latency_budget_ms)
+    {
+        return false;
+    }
+    return true;
+}
+
+bool LlmRouter::isHalfOpen(const ModelState &state, std::chrono::steady_clock::time_point now) const
+{
+    return state.consecutive_failures >= _circuit_failures && isHealthy(state, now);
+}
+
+std::vector<size_t> LlmRouter::rankedLocked(std::chrono::steady_clock::time_point now) const
+{
+    struct Ranked
+    {
+        bool degraded{false};
+        bool fixed{false};
+        double accuracy{0.0};
+        double estimated_ms{0.0};
+        size_t index{0};
+    };
+
+    std::vector<Ranked> ranked{};
+    ranked.reserve(_models.size());
+    for (size_t i = 0; i < _models.size(); ++i)
+    {
+        const auto &state = _models[i];
+        ranked.push_back(Ranked{!isHealthy(state, now), _policy == Policy::Fixed && state.info.model == _fixed_model, state.info.accuracy, estimatedMs(state), i});
+    }
+
+    const bool by_accuracy = _policy == Policy::MostAccurate || _policy == Policy::CostCapped;
+    std::sort(ranked.begin(), ranked.end(), [&](const Ranked &a, const Ranked &b)
+              {
+                  if (a.degraded != b.degraded)
+                  {
+                      return !a.degraded;
+                  }
+                  if (a.fixed != b.fixed)
+                  {
+                      return a.fixed;
+                  }
+                  if (by_accuracy && a.accuracy != b.accuracy)
+                  {
+                      return a.accuracy > b.accuracy;
+                  }
+                  return a.estimated_ms < b.estimated_ms; });
+
+    std::vector<size_t> res{};
+    res.reserve(ranked.size());
+    for (const auto &entry : ranked)
+    {
+        res.push_back(entry.index);
+    }
+    return res;
+}
+
+std::vector<LlmRouter::ModelInfo> LlmRouter::ranking() const
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    std::vector<ModelInfo> res{};
+    std::lock_guard lock{_mut};
+    for (const size_t index : rankedLocked(now))
+    {
+        if (res.size() >= _max_attempts)
+        {
+            break;
+        }
+        res.push_back(_models[index].info);
+    }
+    return res;
+}
+
+std::vector<LlmRouter::ModelInfo> LlmRouter::plan()
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    std::vector<ModelInfo> res{};
+    std::lock_guard lock{_mut};
+
+    auto ranked = rankedLocked(now);
+    if (ranked.empty())
+    {
+        return res;
+    }
+
+    // Only the model dispatched first can be the probe. A half-open model further down would be tried by every
+    // request whose first model fails, so it waits behind the healthy ones with the degraded models.
+    auto &first = _models[ranked.front()];
+    if (isHalfOpen(first, now))
+    {
+        first.probe_until = now + _circuit_open;
+    }
+    std::stable_partition(ranked.begin() + 1, ranked.end(), [&](size_t index)
+                          { return isHealthy(_models[index], now) && !isHalfOpen(_models[index], now); });
+
+    for (size_t i = 0; i < ranked.size() && res.size() < _max_attempts; ++i)
+    {
+        res.push_back(_models[ranked[i]].info);
+    }
+    return res;
+}
+
+void LlmRouter::report(const std::string &model, bool ok, std::chrono::steady_clock::duration elapsed)
+{
+    const double elapsed_ms = std::chrono::duration<double, std::milli>(elapsed).count();
+
+    std::lock_guard lock{_mut};
+    for (auto &state : _models)
+    {
+        if (state.info.model != model)
+        {
+            continue;
+        }
+
+        state.error_rate = _ewma_alpha * (ok ? 0.0 : 1.0) + (1.0 - _ewma_alpha) * state.error_rate;
+        if (ok)
+        {
+            // Failures often return early, only successful calls feed the latency estimate.
+            state.ewma_ms = state.samples ? _ewma_alpha * elapsed_ms + (1.0 - _ewma_alpha) * state.ewma_ms : elapsed_ms;
+            state.latency->observe(elapsed);
+            ++state.samples;
+            state.consecutive_failures = 0;
+            state.probe_until = {};
+        }
+        else if (++state.consecutive_failures >= _circuit_failures)
+        {
+            state.open_until = std::chrono::steady_clock::now() + _circuit_open;
+            state.probe_until = {};
+        }
+
+        Metrics::getInstance().gauge("llm_router_latency_ewma_ms", {{"model", model}}).set(static_cast<int64_t>(state.ewma_ms));
+        return;
+    }
+}
+
+Metrics::Histogram &LlmRouter::timeToResult(bool hedged)
+{
+    return Metrics::getInstance().histogram("llm_time_to_result_seconds", {{"hedged", hedged ? "true" : "false"}}, "Buffered LLM requests from the first transfer to a valid result");
+}
+
+std::chrono::steady_clock::duration LlmRouter::hedgeAfter(const std::string &model) const
+{
+    std::lock_guard lock{_mut};
+    for (const auto &state : _models)
+    {
+        if (state.info.model != model)
+        {
+            continue;
+        }
+        if (state.samples >= _hedge_min_samples && state.latency->count())
+        {
+            return std::chrono::microseconds{state.latency->quantileMicroseconds(_hedge_percentile / 100.0)};
+        }
+        if (state.info.expected_ms > 0.0)
+        {
+            return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(state.info.expected_ms * 2.0));
+        }
+        break;
+    }
+    // Nothing known about the model, only a failure starts the next one.
+    return std::chrono::hours{1};
+}
+
+bool LlmRouter::run(const std::vector<ModelInfo> &models, const std::function<bool(const ModelInfo &)> &call, nlohmann::json &res_json, std::string &used_model)
+{
+    static auto &fallbacks = Metrics::getInstance().counter("llm_router_fallbacks_total", {}, "LLM requests retried on another model");
+
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        const auto &info = models[i];
+        if (i)
+        {
+            fallbacks.add();
+            LOG_ERROR("falling back to " + info.model + " after " + models[i - 1].model);
+        }
+
+        res_json = nlohmann::json{};
+        const auto start = std::chrono::steady_clock::now();
+        const bool ok = call(info);
+        report(info.model, ok, std::chrono::steady_clock::now() - start);
+        if (ok)
+        {
+            used_model = info.model;
+            return true;
+        }
+    }
+    return false;
+}
+
+void LlmRouter::runAsync(std::vector<ModelInfo> models, std::chrono::steady_clock::duration hedge_after, const std::string &prompt, const std::string &mime_type, std::shared_ptr<const std::string> base64_image, const nlohmann::json &response_schema, AsyncCallback on_done)
+{
+    static auto &fallbacks = Metrics::getInstance().counter("llm_router_fallbacks_total", {}, "LLM requests retried on another model");
+    static auto &hedges_total = Metrics::getInstance().counter("llm_hedges_total", {}, "LLM requests hedged to a second model");
+    static auto &hedge_wins = Metrics::getInstance().counter("llm_hedge_wins_total", {}, "Hedged LLM requests answered first by the hedge");
+
+    std::vector<HttpClient::Request> requests{};
+    requests.reserve(models.size());
+    for (const auto &info : models)
+    {
+        requests.push_back(info.provider->json_text_img_request(info.model, prompt, mime_type, base64_image, response_schema));
+    }
+
+    struct State
+    {
+        std::vector<ModelInfo> models{};
+        AsyncCallback on_done{};
+        nlohmann::json res_json{};
+        size_t winner{0};
+        std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+    };
+    auto state = std::make_shared<State>();
+    state->models = std::move(models);
+    state->on_done = std::move(on_done);
+
+    AsyncHttpClient::getInstance().postHedged(std::move(requests), hedge_after, [this, state](HttpClient::Attempt &attempt)
+                                              {
+                                                  const auto &info = state->models[attempt.index];
+                                                  const Metrics::Labels labels{{"provider", info.provider->name}, {"model", info.model}, {"mode", "async"}};
+                                                  Metrics::getInstance().histogram("llm_request_duration_seconds", labels).observe(attempt.elapsed);
+
+                                                  // Cancelled transfers never get here, their model is neither credited nor blamed.
+                                                  bool attempt_ok{false};
+                                                  if (attempt.error.size())
+                                                  {
+                                                      state->res_json = {{"function_error", attempt.error}};
+                                                      LOG_ERROR(state->res_json.dump());
+                                                  }
+                                                  else if (attempt.response.status_code >= 300)
+                                                  {
+                                                      state->res_json = {{"function_error", "HTTP " + std::to_string(attempt.response.status_code) + ": " + attempt.response.body}};
+                                                      LOG_ERROR(state->res_json.dump());
+                                                  }
+                                                  else
+                                                  {
+                                                      attempt_ok = info.provider->parse_json_text_img(attempt.response.body, state->res_json);
+                                                  }
+
+                                                  if (!attempt_ok)
+                                                  {
+                                                      Metrics::getInstance().counter("llm_request_errors_total", labels).add();
+                                                  }
+                                                  report(info.model, attempt_ok, attempt.elapsed);
+                                                  if (attempt_ok)
+                                                  {
+                                                      state->winner = attempt.index;
+                                                  }
+                                                  return attempt_ok; },
+                                              [state](bool accepted, size_t hedges)
+                                              {
+                                                  const bool hedged = hedges > 0;
+                                                  if (hedged)
+                                                  {
+                                                      hedges_total.add();
+                                                  }
+                                                  std::string used_model{};
+                                                  if (accepted)
+                                                  {
+                                                      timeToResult(hedged).observe(std::chrono::steady_clock::now() - state->start);
+                                                      if (state->winner > 0)
+                                                      {
+                                                          (hedged ? hedge_wins : fallbacks).add();
+                                                      }
+                                                      used_model = state->models[state->winner].model;
+                                                  }
+                                                  state->on_done(accepted, std::move(state->res_json), std::move(used_model)); });
+}
+
+void LlmRouter::jsonTextImgAsync(const std::string &prompt, const std::string &mime_type, std::shared_ptr<const std::string> base64_image, const nlohmann::json &response_schema, AsyncCallback on_done)
+{
+    auto models = plan();
+    if (models.empty())
+    {
+        on_done(false, nlohmann::json{{"function_error", "no model to route to"}}, std::string{});
+        return;
+    }
+
+    // Without hedging the next model is only started when the previous one fails.
+    const auto hedge_after = _hedge_percentile > 0.0 && models.size() > 1 ? hedgeAfter(models.front().model) : std::chrono::steady_clock::duration{std::chrono::hours{24}};
+    runAsync(std::move(models), hedge_after, prompt, mime_type, std::move(base64_image), response_schema, std::move(on_done));
+}
+
+bool LlmRouter::jsonTextImg(const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, nlohmann::json &res_json, std::string &used_model)
+{
+    const auto start = std::chrono::steady_clock::now();
+    auto models = plan();
+
+    if (_hedge_percentile <= 0.0 || models.size() < 2)
+    {
+        const bool ok = run(models, [&](const ModelInfo &info)
+                            { return info.provider->json_text_img(info.model, prompt, mime_type, base64_image, response_schema, res_json); },
+                            res_json, used_model);
+        if (ok)
+        {
+            timeToResult(false).observe(std::chrono::steady_clock::now() - start);
+        }
+        return ok;
+    }
+
+    // The hedged transfers run on the AsyncHttpClient loop, this thread waits for the winner.
+    std::promise<bool> done{};
+    auto future = done.get_future();
+    const auto hedge_after = hedgeAfter(models.front().model);
+    // Does not own the caller's string, the transfers are gone before on_done and this call returns after it.
+    const std::shared_ptr<const std::string> base64_view{std::shared_ptr<const std::string>{}, &base64_image};
+    runAsync(std::move(models), hedge_after, prompt, mime_type, base64_view, response_schema, [&](bool ok, nlohmann::json &&json, std::string &&model)
+             {
+                 res_json = std::move(json);
+                 used_model = std::move(model);
+                 done.set_value(ok); });
+    return future.get();
+}
+
+bool LlmRouter::jsonTextImgStream(const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, const ProductsStreamExtractor::ProductCallback &on_product, nlohmann::json &res_json, std::string &used_model)
+{
+    // Products of two racing streams would interleave in on_product, streams are only retried on failure.
+    return run(plan(), [&](const ModelInfo &info)
+               { return info.provider->json_text_img_stream(info.model, prompt, mime_type, base64_image, response_schema, on_product, res_json); },
+               res_json, used_model);
+}
+
+nlohmann::json LlmRouter::stats() const
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    nlohmann::json res = nlohmann::json::array();
+    std::lock_guard lock{_mut};
+    for (const auto &state : _models)
+    {
+        res.push_back({
+            {"model", state.info.model},
+            {"provider", state.info.provider->name},
+            {"healthy", isHealthy(state, now)},
+            {"estimated_ms", estimatedMs(state)},
+            {"ewma_ms", state.ewma_ms},
+            {"error_rate", state.error_rate},
+            {"samples", state.samples},
+            {"p99_ms", static_cast<double>(state.latency->quantileMicroseconds(0.99)) / 1000.0},
+        });
+    }
+    return res;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include "llm_provider.hpp"
+#include "metrics.hpp"
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Picks the model for every recognition and falls back to the next one when a call fails.
+//
+// Cfg keys:
+//   llm_policy            - fixed (default), fastest, most_accurate or cost_capped
+//   llm_fixed_model       - model tried first by the fixed policy, gemini-2.0-flash-exp by default
+//   llm_models            - [{"provider", "model", "accuracy", "expected_ms", "cost"}], defaults to the
+//                           model_tests_1 results table
+//   llm_cost_cap          - cost_capped only considers models with cost <= cap
+//   llm_latency_budget_ms - models expected to be slower are only used as fallbacks, 0 disables
+//   llm_max_attempts      - models tried per request, 2 by default
+//   llm_ewma_alpha        - weight of the newest sample in the latency and error EWMAs, 0.2 by default
+//   llm_circuit_failures  - consecutive failures that take a model out of rotation, 3 by default
+//   llm_circuit_open_sec  - how long it stays out before a single probe request is let through, 30 by default
+//   llm_slow_factor       - a model whose latency EWMA exceeds expected_ms by this factor counts as
+//                           degraded, 3 by default
+//   llm_hedge_percentile  - buffered requests still running after this percentile of the model's own latency
+//                           are hedged to the next model, 95 by default, 0 disables hedging
+//   llm_hedge_min_samples - results a model needs before its percentile is trusted, 2 x expected_ms is the
+//                           hedge deadline until then, 20 by default
+//
+// Healthy models are ordered by the policy, degraded ones (circuit open, slow, over the latency budget)
+// follow in the same order as a last resort. Latency is estimated as EWMA / (1 - error rate EWMA),
+// expected_ms stands in until the first sample.
+// With hedging the first valid answer wins and the other transfer is cancelled, time to result is
+// recorded in llm_time_to_result_seconds{hedged} so both tails can be compared.
+class LlmRouter
+{
+public:
+    enum class Policy
+    {
+        Fixed,
+        Fastest,
+        MostAccurate,
+        CostCapped,
+    };
+
+    struct ModelInfo
+    {
+        const LlmProvider *provider{nullptr};
+        std::string model{};
+        double accuracy{0.0};
+        double expected_ms{0.0};
+        double cost{0.0};
+    };
+
+    LlmRouter(const LlmRouter &l) = delete;
+    LlmRouter(LlmRouter &&l) = delete;
+    LlmRouter &operator=(const LlmRouter &l) = delete;
+    LlmRouter &operator=(LlmRouter &&l) = delete;
+
+    static LlmRouter &getInstance();
+
+    // Models to try for the next request, best first. Read-only, for lookups that send nothing, e.g. ResultCache.
+    std::vector<ModelInfo> ranking() const;
+    // Same order, called only when transfers start right away: a half-open model that comes first is reserved
+    // as this request's probe.
+    std::vector<ModelInfo> plan();
+    void report(const std::string &model, bool ok, std::chrono::steady_clock::duration elapsed);
+
+    // Same contract as the provider functions, used_model names the model that produced res_json.
+    // Hedged when llm_hedge_percentile is set and the plan has a second model.
+    bool jsonTextImg(const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, nlohmann::json &res_json, std::string &used_model);
+
+    // Runs on the AsyncHttpClient loop and returns at once, on_done is called from the loop thread with the
+    // result and must not block. Hedging and fallback as in jsonTextImg, every request shares base64_image.
+    using AsyncCallback = std::function<void(bool ok, nlohmann::json &&res_json, std::string &&used_model)>;
+    void jsonTextImgAsync(const std::string &prompt, const std::string &mime_type, std::shared_ptr<const std::string> base64_image, const nlohmann::json &response_schema, AsyncCallback on_done);
+
+    // A failed attempt may already have handed some products to on_product before the fallback starts over.
+    bool jsonTextImgStream(const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, const ProductsStreamExtractor::ProductCallback &on_product, nlohmann::json &res_json, std::string &used_model);
+
+    // Live state of every model for logs.
+    nlohmann::json stats() const;
+
+    static Policy policyOf(const std::string &name);
+
+    // Time to result of buffered requests, hedged ones are those that started a second transfer.
+    static Metrics::Histogram &timeToResult(bool hedged);
+
+private:
+    struct ModelState
+    {
+        ModelInfo info{};
+        double ewma_ms{0.0};
+        double error_rate{0.0};
+        size_t samples{0};
+        size_t consecutive_failures{0};
+        std::chrono::steady_clock::time_point open_until{};
+        // Set while a half-open model has its one probe in flight.
+        std::chrono::steady_clock::time_point probe_until{};
+        // Successful calls only, the hedge deadline is a percentile of it.
+        Metrics::Histogram *latency{nullptr};
+    };
+
+    LlmRouter();
+
+    bool run(const std::vector<ModelInfo> &models, const std::function<bool(const ModelInfo &)> &call, nlohmann::json &res_json, std::string &used_model);
+    // Races models on the AsyncHttpClient loop: the next one starts after hedge_after or when the previous fails.
+    void runAsync(std::vector<ModelInfo> models, std::chrono::steady_clock::duration hedge_after, const std::string &prompt, const std::string &mime_type, std::shared_ptr<const std::string> base64_image, const nlohmann::json &response_schema, AsyncCallback on_done);
+    std::chrono::steady_clock::duration hedgeAfter(const std::string &model) const;
+    double estimatedMs(const ModelState &state) const;
+    bool isHealthy(const ModelState &state, std::chrono::steady_clock::time_point now) const;
+    // Circuit tripped, open_until passed and no probe in flight.
+    bool isHalfOpen(const ModelState &state, std::chrono::steady_clock::time_point now) const;
+    // Indexes into _models, healthy first, then by policy. Needs _mut.
+    std::vector<size_t> rankedLocked(std::chrono::steady_clock::time_point now) const;
+
+    Policy _policy{Policy::Fixed};
+    std::string _fixed_model{};
+    double _cost_cap{0.0};
+    double _latency_budget_ms{0.0};
+    size_t _max_attempts{2};
+    double _ewma_alpha{0.2};
+    size_t _circuit_failures{3};
+    std::chrono::steady_clock::duration _circuit_open{};
+    double _slow_factor{3.0};
+    double _hedge_percentile{95.0};
+    size_t _hedge_min_samples{20};
+
+    mutable std::mutex _mut{};
+    std::vector<ModelState> _models{};
+};
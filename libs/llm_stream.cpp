@@ -0,0 +1,486 @@
+#include "llm_stream.hpp"
+
+SseParser::SseParser(EventCallback on_event) : _on_event(std::move(on_event))
+{
+}
+
+bool SseParser::feed(std::string_view bytes)
+{
+    size_t pos{0};
+    while (pos < bytes.size())
+    {
+        const size_t line_end = bytes.find('\n', pos);
+        if (line_end == std::string_view::npos)
+        {
+            _line.append(bytes.substr(pos));
+            break;
+        }
+
+        const std::string_view line = bytes.substr(pos, line_end - pos);
+        pos = line_end + 1;
+
+        if (_line.empty())
+        {
+            if (!processLine(line))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        _line.append(line);
+        const bool ok = processLine(_line);
+        _line.clear();
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SseParser::finish()
+{
+    if (_line.size())
+    {
+        const bool ok = processLine(_line);
+        _line.clear();
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return dispatch();
+}
+
+bool SseParser::processLine(std::string_view line)
+{
+    if (line.size() && line.back() == '\r')
+    {
+        line.remove_suffix(1);
+    }
+
+    if (line.empty())
+    {
+        return dispatch();
+    }
+
+    if (line.front() == ':')
+    {
+        return true;
+    }
+
+    const size_t colon = line.find(':');
+    const std::string_view field = line.substr(0, colon);
+    if (field != "data")
+    {
+        return true;
+    }
+
+    std::string_view value = colon == std::string_view::npos ? std::string_view{} : line.substr(colon + 1);
+    if (value.size() && value.front() == ' ')
+    {
+        value.remove_prefix(1);
+    }
+
+    if (_has_data)
+    {
+        _data.push_back('\n');
+    }
+    _data.append(value);
+    _has_data = true;
+    return true;
+}
+
+bool SseParser::dispatch()
+{
+    if (!_has_data)
+    {
+        return true;
+    }
+
+    const bool ok = _on_event(_data);
+    _data.clear();
+    _has_data = false;
+    return ok;
+}
+
+ProductsStreamExtractor::ProductsStreamExtractor(ProductCallback on_product) : _on_product(std::move(on_product))
+{
+}
+
+bool ProductsStreamExtractor::feed(std::string_view text)
+{
+    if (_error)
+    {
+        return false;
+    }
+
+    size_t pos = _base + _text.size();
+    _text.append(text);
+
+    for (const char c : text)
+    {
+        if (!onChar(c, pos))
+        {
+            _error = true;
+            return false;
+        }
+        ++pos;
+    }
+
+    compact();
+    return true;
+}
+
+bool ProductsStreamExtractor::finish(nlohmann::json &res_json)
+{
+    if (_error || !_done)
+    {
+        return false;
+    }
+
+    if (_has_products)
+    {
+        _result["products"] = std::move(_products);
+        _products = nlohmann::json::array();
+        _has_products = false;
+    }
+    res_json = std::move(_result);
+    _result = nlohmann::json::object();
+    return true;
+}
+
+bool ProductsStreamExtractor::onChar(char c, size_t pos)
+{
+    if (_done)
+    {
+        return true;
+    }
+
+    if (_in_string)
+    {
+        if (_escape)
+        {
+            _escape = false;
+            return true;
+        }
+        if (c == '\\')
+        {
+            _escape = true;
+            return true;
+        }
+        if (c != '"')
+        {
+            return true;
+        }
+
+        _in_string = false;
+        if (_depth == 1 && _phase == Phase::Key)
+        {
+            nlohmann::json key{};
+            if (!parseSlice(_key_start, pos + 1, key) || !key.is_string())
+            {
+                return false;
+            }
+            _key = key.get<std::string>();
+            _key_start = std::string::npos;
+            _phase = Phase::Colon;
+            return true;
+        }
+        if (_depth == 1 && _phase == Phase::Value && _value_kind == Kind::String)
+        {
+            return completeValue(pos + 1);
+        }
+        if (_depth == 2 && _in_products && _elem_kind == Kind::String)
+        {
+            return completeElem(pos + 1);
+        }
+        return true;
+    }
+
+    switch (c)
+    {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+        return true;
+
+    case '"':
+        _in_string = true;
+        if (_depth == 1)
+        {
+            if (_phase == Phase::Key)
+            {
+                _key_start = pos;
+                return true;
+            }
+            if (_phase == Phase::Value && _value_kind == Kind::None)
+            {
+                return startValue(c, pos);
+            }
+            return _phase == Phase::Value;
+        }
+        if (_depth == 2 && _in_products && _elem_kind == Kind::None)
+        {
+            return startElem(c, pos);
+        }
+        return _depth > 0;
+
+    case '{':
+    case '[':
+        if (_depth == 0)
+        {
+            if (c != '{')
+            {
+                return false;
+            }
+            _depth = 1;
+            _phase = Phase::Key;
+            return true;
+        }
+        if (_depth == 1)
+        {
+            if (_phase != Phase::Value || _value_kind != Kind::None)
+            {
+                return false;
+            }
+            startValue(c, pos);
+        }
+        else if (_depth == 2 && _in_products)
+        {
+            if (_elem_kind != Kind::None)
+            {
+                return false;
+            }
+            startElem(c, pos);
+        }
+        ++_depth;
+        return true;
+
+    case '}':
+    case ']':
+        if (_depth == 0)
+        {
+            return false;
+        }
+        --_depth;
+
+        if (_depth == 0)
+        {
+            if (c != '}')
+            {
+                return false;
+            }
+            if (_phase == Phase::Value)
+            {
+                if (_value_kind != Kind::Scalar || !completeValue(pos))
+                {
+                    return false;
+                }
+            }
+            else if (_phase == Phase::Colon)
+            {
+                return false;
+            }
+            _done = true;
+            return true;
+        }
+        if (_depth == 1)
+        {
+            if (_in_products)
+            {
+                if (c != ']')
+                {
+                    return false;
+                }
+                if (_elem_kind == Kind::Scalar && !completeElem(pos))
+                {
+                    return false;
+                }
+            }
+            return completeValue(pos + 1);
+        }
+        if (_depth == 2 && _in_products)
+        {
+            return completeElem(pos + 1);
+        }
+        return true;
+
+    case ',':
+        if (_depth == 1)
+        {
+            if (_phase == Phase::Value)
+            {
+                if (_value_kind != Kind::Scalar || !completeValue(pos))
+                {
+                    return false;
+                }
+            }
+            else if (_phase != Phase::AfterValue)
+            {
+                return false;
+            }
+            _phase = Phase::Key;
+            return true;
+        }
+        if (_depth == 2 && _in_products)
+        {
+            if (_elem_kind == Kind::Scalar)
+            {
+                return completeElem(pos);
+            }
+            return _elem_kind == Kind::None;
+        }
+        return true;
+
+    case ':':
+        if (_depth == 1)
+        {
+            if (_phase != Phase::Colon)
+            {
+                return false;
+            }
+            _phase = Phase::Value;
+            _value_kind = Kind::None;
+        }
+        return true;
+
+    default:
+        if (_depth == 1)
+        {
+            if (_phase != Phase::Value)
+            {
+                return false;
+            }
+            if (_value_kind == Kind::None)
+            {
+                return startValue(c, pos);
+            }
+            return true;
+        }
+        if (_depth == 2 && _in_products && _elem_kind == Kind::None)
+        {
+            return startElem(c, pos);
+        }
+        return _depth > 0;
+    }
+}
+
+bool ProductsStreamExtractor::startValue(char c, size_t pos)
+{
+    _value_start = pos;
+    if (c == '"')
+    {
+        _value_kind = Kind::String;
+    }
+    else if (c == '{' || c == '[')
+    {
+        _value_kind = Kind::Compound;
+        // The products array itself is never buffered, only its elements are.
+        _in_products = _key == "products" && c == '[';
+    }
+    else
+    {
+        _value_kind = Kind::Scalar;
+    }
+    return true;
+}
+
+bool ProductsStreamExtractor::startElem(char c, size_t pos)
+{
+    _elem_start = pos;
+    if (c == '"')
+    {
+        _elem_kind = Kind::String;
+    }
+    else if (c == '{' || c == '[')
+    {
+        _elem_kind = Kind::Compound;
+    }
+    else
+    {
+        _elem_kind = Kind::Scalar;
+    }
+    return true;
+}
+
+bool ProductsStreamExtractor::completeValue(size_t end)
+{
+    if (_in_products)
+    {
+        _has_products = true;
+        _in_products = false;
+    }
+    else
+    {
+        nlohmann::json value{};
+        if (!parseSlice(_value_start, end, value))
+        {
+            return false;
+        }
+        _result[_key] = std::move(value);
+    }
+
+    _value_kind = Kind::None;
+    _phase = Phase::AfterValue;
+    return true;
+}
+
+bool ProductsStreamExtractor::completeElem(size_t end)
+{
+    nlohmann::json product{};
+    if (!parseSlice(_elem_start, end, product))
+    {
+        return false;
+    }
+    _elem_kind = Kind::None;
+
+    if (product.is_object() && _on_product)
+    {
+        _on_product(product);
+    }
+    _products.push_back(std::move(product));
+    ++_products_count;
+    return true;
+}
+
+bool ProductsStreamExtractor::parseSlice(size_t begin, size_t end, nlohmann::json &out) const
+{
+    if (begin < _base || end < begin || end - _base > _text.size())
+    {
+        return false;
+    }
+
+    return parseJson(std::string_view{_text}.substr(begin - _base, end - begin), out);
+}
+
+void ProductsStreamExtractor::compact()
+{
+    size_t keep_from = _base + _text.size();
+    if (_in_string && _depth == 1 && _phase == Phase::Key)
+    {
+        keep_from = std::min(keep_from, _key_start);
+    }
+    if (_value_kind != Kind::None && !_in_products)
+    {
+        keep_from = std::min(keep_from, _value_start);
+    }
+    if (_in_products && _elem_kind != Kind::None)
+    {
+        keep_from = std::min(keep_from, _elem_start);
+    }
+
+    const size_t consumed = keep_from - _base;
+    if (consumed == _text.size())
+    {
+        _text.clear();
+        _base = keep_from;
+    }
+    else if (consumed >= 4096)
+    {
+        _text.erase(0, consumed);
+        _base = keep_from;
+    }
+}
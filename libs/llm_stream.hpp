@@ -0,0 +1,102 @@
+#pragma once
+#include "functions.hpp"
+#include <functional>
+
+// Splits a text/event-stream body into events, on_event gets the joined "data:" lines of each event.
+// Bytes can arrive in arbitrary pieces, an event is dispatched once its terminating blank line is seen.
+class SseParser
+{
+public:
+    using EventCallback = std::function<bool(std::string_view data)>;
+
+    explicit SseParser(EventCallback on_event);
+
+    // false when on_event asked to stop.
+    bool feed(std::string_view bytes);
+    // Dispatches a last event that was not followed by a blank line.
+    bool finish();
+
+private:
+    bool processLine(std::string_view line);
+    bool dispatch();
+
+    EventCallback _on_event{};
+    std::string _line{};
+    std::string _data{};
+    bool _has_data{false};
+};
+
+// Incremental scanner for the model output {"products": [{...}, ...], ...} that arrives as text deltas.
+// Each element of "products" is parsed on its own as soon as its closing brace arrives and handed to on_product,
+// the other top level members are parsed once they complete. The whole document is never parsed again,
+// finish() assembles the result from the already parsed pieces.
+class ProductsStreamExtractor
+{
+public:
+    using ProductCallback = std::function<void(const nlohmann::json &product)>;
+
+    explicit ProductsStreamExtractor(ProductCallback on_product);
+
+    // false on malformed input, the extractor is unusable afterwards.
+    bool feed(std::string_view text);
+    // false if the top level object is not complete.
+    bool finish(nlohmann::json &res_json);
+
+    inline size_t productsCount() const
+    {
+        return _products_count;
+    }
+
+private:
+    enum class Phase
+    {
+        Key,
+        Colon,
+        Value,
+        AfterValue,
+    };
+
+    enum class Kind
+    {
+        None,
+        String,
+        Compound,
+        Scalar,
+    };
+
+    bool onChar(char c, size_t pos);
+    bool startValue(char c, size_t pos);
+    bool startElem(char c, size_t pos);
+    bool completeValue(size_t end);
+    bool completeElem(size_t end);
+    bool parseSlice(size_t begin, size_t end, nlohmann::json &out) const;
+    void compact();
+
+    ProductCallback _on_product{};
+
+    // _text holds the input from absolute offset _base on, everything before it is already consumed.
+    std::string _text{};
+    size_t _base{0};
+
+    int _depth{0};
+    bool _in_string{false};
+    bool _escape{false};
+    bool _done{false};
+    bool _error{false};
+
+    Phase _phase{Phase::Key};
+    size_t _key_start{std::string::npos};
+    std::string _key{};
+
+    Kind _value_kind{Kind::None};
+    size_t _value_start{0};
+    bool _in_products{false};
+    bool _has_products{false};
+
+    Kind _elem_kind{Kind::None};
+    size_t _elem_start{0};
+
+    nlohmann::json _products = nlohmann::json::array();
+    size_t _products_count{0};
+    nlohmann::json _result = nlohmann::json::object();
+};
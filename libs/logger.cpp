@@ -0,0 +1,324 @@
+#include "logger.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+Logger::Line::Line(Level level, const char *file, int line, const char *function) : _level(level)
+{
+    // Same prefix as before: "<file>:<line> <function> ".
+    const int written = std::snprintf(_buf, slot_text_size, "%s:%d %s ", file, line, function);
+    if (written < 0)
+    {
+        return;
+    }
+    if (static_cast<size_t>(written) < slot_text_size)
+    {
+        _size = static_cast<size_t>(written);
+        return;
+    }
+
+    _overflowed = true;
+    _overflow = std::string{file} + ":" + std::to_string(line) + " " + function + " ";
+}
+
+Logger::Line &Logger::Line::operator+(std::string_view str)
+{
+    append(str.data(), str.size());
+    return *this;
+}
+
+Logger::Line &Logger::Line::format(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+
+    if (!_overflowed)
+    {
+        va_list args_copy;
+        va_copy(args_copy, args);
+        const int written = std::vsnprintf(_buf + _size, slot_text_size - _size, fmt, args_copy);
+        va_end(args_copy);
+
+        if (written >= 0 && _size + static_cast<size_t>(written) < slot_text_size)
+        {
+            _size += static_cast<size_t>(written);
+            va_end(args);
+            return *this;
+        }
+
+        _overflow.assign(_buf, _size);
+        _overflowed = true;
+    }
+
+    va_list args_copy;
+    va_copy(args_copy, args);
+    const int needed = std::vsnprintf(nullptr, 0, fmt, args_copy);
+    va_end(args_copy);
+
+    if (needed > 0)
+    {
+        const size_t old_size = _overflow.size();
+        _overflow.resize(old_size + static_cast<size_t>(needed) + 1);
+        std::vsnprintf(_overflow.data() + old_size, static_cast<size_t>(needed) + 1, fmt, args);
+        _overflow.resize(old_size + static_cast<size_t>(needed));
+    }
+
+    va_end(args);
+    return *this;
+}
+
+void Logger::Line::append(const char *data, size_t size)
+{
+    if (!_overflowed && _size + size <= slot_text_size)
+    {
+        std::memcpy(_buf + _size, data, size);
+        _size += size;
+        return;
+    }
+
+    if (!_overflowed)
+    {
+        _overflow.reserve(_size + size);
+        _overflow.assign(_buf, _size);
+        _overflowed = true;
+    }
+    _overflow.append(data, size);
+}
+
+void Logger::Line::commit()
+{
+    Logger::getInstance().push(_level, _overflowed ? std::string_view{_overflow} : std::string_view{_buf, _size});
+}
+
+Logger &Logger::getInstance()
+{
+    static Logger s{};
+    return s;
+}
+
+// ex_log_ring_slots=<n> sizes the ring, read once when the logger is first used.
+static size_t slotsCountFromEnv()
+{
+    const char *value = getenv("ex_log_ring_slots");
+    if (!value)
+    {
+        return Logger::default_slots_count;
+    }
+    const unsigned long long slots = std::strtoull(value, nullptr, 10);
+    return slots ? static_cast<size_t>(slots) : Logger::default_slots_count;
+}
+
+Logger::Logger() : _slots_count(slotsCountFromEnv()), _slots(new Slot[_slots_count])
+{
+    for (size_t i = 0; i < _slots_count; ++i)
+    {
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    _flusher = std::thread([this]()
+                           { flusherLoop(); });
+}
+
+Logger::~Logger()
+{
+    _stop = true;
+    wakeFlusher();
+    if (_flusher.joinable())
+    {
+        _flusher.join();
+    }
+}
+
+void Logger::bindInfo(std::ostream *stream)
+{
+    std::lock_guard lock{_stream_mut};
+    _info_stream = stream;
+}
+
+void Logger::bindError(std::ostream *stream)
+{
+    std::lock_guard lock{_stream_mut};
+    _error_stream = stream;
+}
+
+void Logger::info(std::string_view str)
+{
+    push(Level::Info, str);
+}
+
+void Logger::error(std::string_view str)
+{
+    push(Level::Error, str);
+}
+
+void Logger::push(Level level, std::string_view str)
+{
+    if (str.size() <= slot_text_size && tryEnqueue(level, str))
+    {
+        // A futex wake per line would cost more than the line itself, info lines wait for the flusher's
+        // timer unless the ring is half full.
+        if (level == Level::Error || _enqueue_pos.load(std::memory_order_relaxed) - _dequeue_pos.load(std::memory_order_relaxed) >= _slots_count / 2)
+        {
+            wakeFlusher();
+        }
+        return;
+    }
+
+    if (level == Level::Error || str.size() > slot_text_size)
+    {
+        writeDirect(level, str);
+        return;
+    }
+
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    _dropped_total.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Bounded MPMC queue by D. Vyukov, used here with a single consumer.
+// A slot is free for position pos when its sequence equals pos and readable when it equals pos + 1.
+bool Logger::tryEnqueue(Level level, std::string_view str)
+{
+    size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+    Slot *slot{nullptr};
+    while (true)
+    {
+        slot = &_slots[pos % _slots_count];
+        const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (diff == 0)
+        {
+            if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    slot->size = static_cast<uint32_t>(str.size());
+    std::memcpy(slot->text, str.data(), str.size());
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+void Logger::writeDirect(Level level, std::string_view str)
+{
+    std::lock_guard lock{_stream_mut};
+    std::ostream *stream = level == Level::Error ? _error_stream : _info_stream;
+    stream->write(str.data(), static_cast<std::streamsize>(str.size()));
+    stream->put('\n');
+    stream->flush();
+}
+
+void Logger::wakeFlusher()
+{
+    // Pairs with the fence in flusherLoop: either this sees the flag or the flusher sees the published slot.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_flusher_sleeping.load(std::memory_order_relaxed))
+    {
+        std::lock_guard lock{_wake_mut};
+        _wake_cv.notify_one();
+    }
+}
+
+size_t Logger::drain(std::string &info_batch, std::string &error_batch)
+{
+    size_t count{0};
+    size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Slot &slot = _slots[pos % _slots_count];
+        if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+        {
+            break;
+        }
+
+        std::string &batch = slot.level == Level::Error ? error_batch : info_batch;
+        batch.append(slot.text, slot.size);
+        batch.push_back('\n');
+
+        slot.sequence.store(pos + _slots_count, std::memory_order_release);
+        ++pos;
+        ++count;
+    }
+    _dequeue_pos.store(pos, std::memory_order_release);
+    return count;
+}
+
+void Logger::flusherLoop()
+{
+    std::string info_batch{};
+    std::string error_batch{};
+
+    while (true)
+    {
+        const size_t count = drain(info_batch, error_batch);
+
+        const size_t dropped = _dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped)
+        {
+            info_batch += "logger: dropped " + std::to_string(dropped) + " info lines, ring buffer full\n";
+        }
+
+        if (info_batch.size() || error_batch.size())
+        {
+            std::lock_guard lock{_stream_mut};
+            if (info_batch.size())
+            {
+                _info_stream->write(info_batch.data(), static_cast<std::streamsize>(info_batch.size()));
+                _info_stream->flush();
+            }
+            if (error_batch.size())
+            {
+                _error_stream->write(error_batch.data(), static_cast<std::streamsize>(error_batch.size()));
+                _error_stream->flush();
+            }
+            info_batch.clear();
+            error_batch.clear();
+        }
+        _written_pos.store(_dequeue_pos.load(std::memory_order_relaxed), std::memory_order_release);
+
+        if (count)
+        {
+            continue;
+        }
+
+        if (_stop.load())
+        {
+            break;
+        }
+
+        // Producers only notify while this flag is set.
+        std::unique_lock lock{_wake_mut};
+        _flusher_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+        if (_slots[pos % _slots_count].sequence.load(std::memory_order_acquire) != pos + 1 && !_stop.load())
+        {
+            _wake_cv.wait_for(lock, flush_interval);
+        }
+        _flusher_sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+void Logger::flush()
+{
+    const size_t target = _enqueue_pos.load(std::memory_order_acquire);
+    while (_written_pos.load(std::memory_order_acquire) < target)
+    {
+        {
+            std::lock_guard lock{_wake_mut};
+            _wake_cv.notify_one();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+    }
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Levels below EX_LOG_MIN_LEVEL are compiled out, e.g. -DEX_LOG_MIN_LEVEL=2 keeps only errors.
+#define EX_LOG_LEVEL_INFO 1
+#define EX_LOG_LEVEL_ERROR 2
+
+#ifndef EX_LOG_MIN_LEVEL
+#define EX_LOG_MIN_LEVEL EX_LOG_LEVEL_INFO
+#endif
+
+// Asynchronous logger. Callers format a line on their own stack and push it into a bounded lock-free ring,
+// one flusher thread writes the lines to the bound streams and flushes once per batch.
+// A full ring drops info lines but writes error lines synchronously, as does a line too long for a ring slot.
+// Dropped lines are reported in the log and as logger_dropped_lines_total on /metrics.
+// The ring has ex_log_ring_slots slots (env, 8192 by default, about 8 MB).
+class Logger
+{
+public:
+    enum class Level : uint8_t
+    {
+        Info = EX_LOG_LEVEL_INFO,
+        Error = EX_LOG_LEVEL_ERROR,
+    };
+
+    static constexpr size_t slot_text_size = 1000;
+    static constexpr size_t default_slots_count = 8192;
+    // Longest an info line waits in the ring, error lines wake the flusher at once.
+    static constexpr std::chrono::milliseconds flush_interval{10};
+
+    // One log line under construction, LOG_* expands to Line{...} + x so every operand of x is appended
+    // into the line buffer directly instead of going through temporary std::strings.
+    class Line
+    {
+    public:
+        Line(Level level, const char *file, int line, const char *function);
+
+        Line(const Line &l) = delete;
+        Line(Line &&l) = delete;
+        Line &operator=(const Line &l) = delete;
+        Line &operator=(Line &&l) = delete;
+
+        Line &operator+(std::string_view str);
+        Line &format(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+        void commit();
+
+    private:
+        void append(const char *data, size_t size);
+
+        Level _level;
+        size_t _size{0};
+        bool _overflowed{false};
+        std::string _overflow{};
+        char _buf[slot_text_size];
+    };
+
+    Logger(const Logger &l) = delete;
+    Logger(Logger &&l) = delete;
+    Logger &operator=(const Logger &l) = delete;
+    Logger &operator=(Logger &&l) = delete;
+
+    static Logger &getInstance();
+
+    void bindInfo(std::ostream *stream);
+    void bindError(std::ostream *stream);
+
+    void info(std::string_view str);
+    void error(std::string_view str);
+    void push(Level level, std::string_view str);
+
+    // Blocks until everything pushed before the call is written out.
+    void flush();
+
+    inline size_t dropped() const
+    {
+        return _dropped_total.load(std::memory_order_relaxed);
+    }
+
+    inline size_t slotsCount() const
+    {
+        return _slots_count;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence{0};
+        Level level{Level::Info};
+        uint32_t size{0};
+        char text[slot_text_size];
+    };
+
+    Logger();
+    ~Logger();
+
+    bool tryEnqueue(Level level, std::string_view str);
+    void writeDirect(Level level, std::string_view str);
+    void flusherLoop();
+    size_t drain(std::string &info_batch, std::string &error_batch);
+    void wakeFlusher();
+
+    const size_t _slots_count;
+    std::unique_ptr<Slot[]> _slots{};
+    alignas(64) std::atomic<size_t> _enqueue_pos{0};
+    alignas(64) std::atomic<size_t> _dequeue_pos{0};
+    std::atomic<size_t> _written_pos{0};
+
+    std::atomic<size_t> _dropped{0};
+    std::atomic<size_t> _dropped_total{0};
+
+    std::mutex _stream_mut{};
+    std::ostream *_info_stream{&std::cout};
+    std::ostream *_error_stream{&std::cerr};
+
+    std::mutex _wake_mut{};
+    std::condition_variable _wake_cv{};
+    std::atomic<bool> _flusher_sleeping{false};
+    std::atomic<bool> _stop{false};
+    std::thread _flusher{};
+};
+
+#define EX_LOG_LINE(level_value, level, x)                                                       \
+    do                                                                                           \
+    {                                                                                            \
+        if constexpr (level_value >= EX_LOG_MIN_LEVEL)                                           \
+        {                                                                                        \
+            (Logger::Line{Logger::Level::level, __FILE__, __LINE__, __FUNCTION__} + x).commit(); \
+        }                                                                                        \
+    } while (0)
+
+#define EX_LOG_LINEF(level_value, level, fmt, ...)                                                                             \
+    do                                                                                                                         \
+    {                                                                                                                          \
+        if constexpr (level_value >= EX_LOG_MIN_LEVEL)                                                                         \
+        {                                                                                                                      \
+            Logger::Line{Logger::Level::level, __FILE__, __LINE__, __FUNCTION__}.format(fmt __VA_OPT__(, ) __VA_ARGS__).commit(); \
+        }                                                                                                                      \
+    } while (0)
+
+#undef LOG_ERROR
+#define LOG_ERROR(x) EX_LOG_LINE(EX_LOG_LEVEL_ERROR, Error, x)
+
+#undef LOG_INFO
+#define LOG_INFO(x) EX_LOG_LINE(EX_LOG_LEVEL_INFO, Info, x)
+
+// printf style, the line is formatted straight into the log buffer.
+#undef LOG_ERRORF
+#define LOG_ERRORF(fmt, ...) EX_LOG_LINEF(EX_LOG_LEVEL_ERROR, Error, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+#undef LOG_INFOF
+#define LOG_INFOF(fmt, ...) EX_LOG_LINEF(EX_LOG_LEVEL_INFO, Info, fmt __VA_OPT__(, ) __VA_ARGS__)
@@ -0,0 +1,312 @@
+#include "metrics.hpp"
+#include "functions.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+
+uint64_t Metrics::Histogram::quantileMicroseconds(double q) const
+{
+    const uint64_t total = count();
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(total) + 0.5));
+    uint64_t seen{0};
+    for (size_t i = 0; i < buckets_count; ++i)
+    {
+        seen += _buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            return valueOf(i);
+        }
+    }
+    // Observations that raced with this scan, the count got ahead of the buckets.
+    return valueOf(buckets_count - 1);
+}
+
+Metrics &Metrics::getInstance()
+{
+    static Metrics s{};
+    return s;
+}
+
+static std::string escapeLabelValue(const std::string &value)
+{
+    std::string res{};
+    res.reserve(value.size());
+    for (const char c : value)
+    {
+        if (c == '\\' || c == '"')
+        {
+            res.push_back('\\');
+            res.push_back(c);
+        }
+        else if (c == '\n')
+        {
+            res += "\\n";
+        }
+        else
+        {
+            res.push_back(c);
+        }
+    }
+    return res;
+}
+
+std::string Metrics::labelsKeyOf(const Labels &labels)
+{
+    std::string key{};
+    for (const auto &[name, value] : labels)
+    {
+        if (key.size())
+        {
+            key.push_back(',');
+        }
+        key += name + "=\"" + escapeLabelValue(value) + "\"";
+    }
+    return key;
+}
+
+Metrics::Family &Metrics::familyOf(const std::string &name, Type type, const std::string &help)
+{
+    auto &family = _families[name];
+    if (family.counters.empty() && family.gauges.empty() && family.histograms.empty())
+    {
+        family.type = type;
+    }
+    if (family.help.empty())
+    {
+        family.help = help;
+    }
+    return family;
+}
+
+Metrics::Counter &Metrics::counter(const std::string &name, const Labels &labels, const std::string &help)
+{
+    std::lock_guard lock{_mut};
+    auto &metric = familyOf(name, Type::Counter, help).counters[labelsKeyOf(labels)];
+    if (!metric)
+    {
+        metric = std::make_unique<Counter>();
+    }
+    return *metric;
+}
+
+Metrics::Gauge &Metrics::gauge(const std::string &name, const Labels &labels, const std::string &help)
+{
+    std::lock_guard lock{_mut};
+    auto &metric = familyOf(name, Type::Gauge, help).gauges[labelsKeyOf(labels)];
+    if (!metric)
+    {
+        metric = std::make_unique<Gauge>();
+    }
+    return *metric;
+}
+
+Metrics::Histogram &Metrics::histogram(const std::string &name, const Labels &labels, const std::string &help)
+{
+    std::lock_guard lock{_mut};
+    auto &metric = familyOf(name, Type::Histogram, help).histograms[labelsKeyOf(labels)];
+    if (!metric)
+    {
+        metric = std::make_unique<Histogram>();
+    }
+    return *metric;
+}
+
+static std::string seriesOf(const std::string &name, const std::string &labels_key, const std::string &extra_label = {})
+{
+    if (labels_key.empty() && extra_label.empty())
+    {
+        return name;
+    }
+    if (labels_key.empty())
+    {
+        return name + "{" + extra_label + "}";
+    }
+    if (extra_label.empty())
+    {
+        return name + "{" + labels_key + "}";
+    }
+    return name + "{" + labels_key + "," + extra_label + "}";
+}
+
+static std::string secondsOf(uint64_t us)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%llu.%06llu", static_cast<unsigned long long>(us / 1000000), static_cast<unsigned long long>(us % 1000000));
+    return buf;
+}
+
+std::string Metrics::render() const
+{
+    static constexpr std::array<std::pair<double, const char *>, 4> quantiles{{{0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}, {0.999, "0.999"}}};
+
+    std::string res{};
+    std::lock_guard lock{_mut};
+    for (const auto &[name, family] : _families)
+    {
+        if (family.help.size())
+        {
+            res += "# HELP " + name + " " + family.help + "\n";
+        }
+
+        switch (family.type)
+        {
+        case Type::Counter:
+            res += "# TYPE " + name + " counter\n";
+            for (const auto &[labels_key, metric] : family.counters)
+            {
+                res += seriesOf(name, labels_key) + " " + std::to_string(metric->value()) + "\n";
+            }
+            break;
+        case Type::Gauge:
+            res += "# TYPE " + name + " gauge\n";
+            for (const auto &[labels_key, metric] : family.gauges)
+            {
+                res += seriesOf(name, labels_key) + " " + std::to_string(metric->value()) + "\n";
+            }
+            break;
+        case Type::Histogram:
+            res += "# TYPE " + name + " summary\n";
+            for (const auto &[labels_key, metric] : family.histograms)
+            {
+                for (const auto &[q, q_str] : quantiles)
+                {
+                    res += seriesOf(name, labels_key, std::string{"quantile=\""} + q_str + "\"") + " " + secondsOf(metric->quantileMicroseconds(q)) + "\n";
+                }
+                res += seriesOf(name + "_sum", labels_key) + " " + secondsOf(metric->sumMicroseconds()) + "\n";
+                res += seriesOf(name + "_count", labels_key) + " " + std::to_string(metric->count()) + "\n";
+            }
+            break;
+        }
+    }
+
+    // The logger sits below the registry and keeps its own drop count, it is read at scrape time.
+    res += "# HELP logger_dropped_lines_total Info lines dropped because the log ring was full\n";
+    res += "# TYPE logger_dropped_lines_total counter\n";
+    res += "logger_dropped_lines_total " + std::to_string(Logger::getInstance().dropped()) + "\n";
+    return res;
+}
+
+MetricsHttpServer::~MetricsHttpServer()
+{
+    stop();
+}
+
+bool MetricsHttpServer::start(uint16_t port)
+{
+    _listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (_listen_fd < 0)
+    {
+        LOG_ERROR("if(_listen_fd < 0)");
+        return false;
+    }
+
+    const int reuse{1};
+    ::setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (::bind(_listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(_listen_fd, 16) != 0)
+    {
+        LOG_ERROR("metrics port bind/listen failed: " + std::to_string(port) + " " + std::strerror(errno));
+        ::close(_listen_fd);
+        _listen_fd = -1;
+        return false;
+    }
+
+    _thread = std::thread([this]()
+                          { serveLoop(); });
+    return true;
+}
+
+void MetricsHttpServer::stop()
+{
+    _stop = true;
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+    if (_listen_fd >= 0)
+    {
+        ::close(_listen_fd);
+        _listen_fd = -1;
+    }
+}
+
+void MetricsHttpServer::serveLoop()
+{
+    while (!_stop)
+    {
+        // The timeout lets stop() take effect without closing the socket under the thread.
+        pollfd pfd{_listen_fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 500) <= 0)
+        {
+            continue;
+        }
+
+        const int fd = ::accept(_listen_fd, nullptr, nullptr);
+        if (fd < 0)
+        {
+            continue;
+        }
+        serveConnection(fd);
+        ::close(fd);
+    }
+}
+
+void MetricsHttpServer::serveConnection(int fd)
+{
+    timeval timeout{1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Only the request line matters, the rest of the request is read and ignored.
+    std::string request{};
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+    {
+        const ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+        {
+            return;
+        }
+        request.append(buf, static_cast<size_t>(n));
+    }
+
+    std::string body{};
+    std::string status_line{};
+    std::string content_type{};
+    if (request.starts_with("GET /metrics ") || request.starts_with("GET /metrics?"))
+    {
+        status_line = "HTTP/1.1 200 OK";
+        content_type = "text/plain; version=0.0.4";
+        body = Metrics::getInstance().render();
+    }
+    else
+    {
+        status_line = "HTTP/1.1 404 Not Found";
+        content_type = "text/plain";
+    }
+
+    const std::string response = status_line + "\r\nContent-Type: " + content_type + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    size_t sent{0};
+    while (sent < response.size())
+    {
+        const ssize_t n = ::send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return;
+        }
+        sent += static_cast<size_t>(n);
+    }
+}
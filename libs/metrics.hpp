@@ -0,0 +1,233 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Process wide registry of counters, gauges and histograms, rendered in the Prometheus text format.
+// Updating a metric is a relaxed atomic operation. Looking one up by name and labels takes a mutex,
+// so hot paths with fixed labels keep the returned reference, metrics are never removed.
+class Metrics
+{
+public:
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    class Counter
+    {
+    public:
+        inline void add(uint64_t value = 1)
+        {
+            _value.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        inline uint64_t value() const
+        {
+            return _value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> _value{0};
+    };
+
+    class Gauge
+    {
+    public:
+        inline void set(int64_t value)
+        {
+            _value.store(value, std::memory_order_relaxed);
+        }
+
+        inline void add(int64_t value = 1)
+        {
+            _value.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        inline void sub(int64_t value = 1)
+        {
+            _value.fetch_sub(value, std::memory_order_relaxed);
+        }
+
+        inline int64_t value() const
+        {
+            return _value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<int64_t> _value{0};
+    };
+
+    // HDR style histogram of durations in microseconds: 16 linear buckets per power of two,
+    // so a reported quantile is within 1/32 of the true value over the whole 64 bit range.
+    class Histogram
+    {
+    public:
+        static constexpr size_t sub_bucket_bits = 4;
+        static constexpr size_t sub_buckets = size_t{1} << sub_bucket_bits;
+        static constexpr size_t buckets_count = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+        inline void observeMicroseconds(uint64_t us)
+        {
+            _buckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+            _count.fetch_add(1, std::memory_order_relaxed);
+            _sum_us.fetch_add(us, std::memory_order_relaxed);
+        }
+
+        inline void observe(std::chrono::steady_clock::duration duration)
+        {
+            const auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+            observeMicroseconds(us > 0 ? static_cast<uint64_t>(us) : 0);
+        }
+
+        inline uint64_t count() const
+        {
+            return _count.load(std::memory_order_relaxed);
+        }
+
+        inline uint64_t sumMicroseconds() const
+        {
+            return _sum_us.load(std::memory_order_relaxed);
+        }
+
+        // q in [0, 1], 0 when nothing was observed.
+        uint64_t quantileMicroseconds(double q) const;
+
+        static inline size_t bucketOf(uint64_t us)
+        {
+            if (us < sub_buckets)
+            {
+                return static_cast<size_t>(us);
+            }
+            const size_t shift = static_cast<size_t>(63 - __builtin_clzll(us)) - sub_bucket_bits;
+            return (shift + 1) * sub_buckets + static_cast<size_t>((us >> shift) & (sub_buckets - 1));
+        }
+
+        // Middle of the bucket's value range.
+        static inline uint64_t valueOf(size_t bucket)
+        {
+            if (bucket < sub_buckets)
+            {
+                return bucket;
+            }
+            const size_t shift = bucket / sub_buckets - 1;
+            const uint64_t lower = (sub_buckets + bucket % sub_buckets) << shift;
+            return lower + ((uint64_t{1} << shift) >> 1);
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, buckets_count> _buckets{};
+        std::atomic<uint64_t> _count{0};
+        std::atomic<uint64_t> _sum_us{0};
+    };
+
+    // Times a scope into <name>_duration_seconds and counts it into <name>_errors_total
+    // unless succeed() was called before it ends.
+    class ScopedCall
+    {
+    public:
+        ScopedCall(Histogram &duration, Counter &errors) : _duration(duration), _errors(errors) {}
+
+        ScopedCall(const ScopedCall &l) = delete;
+        ScopedCall(ScopedCall &&l) = delete;
+        ScopedCall &operator=(const ScopedCall &l) = delete;
+        ScopedCall &operator=(ScopedCall &&l) = delete;
+
+        inline ~ScopedCall()
+        {
+            _duration.observe(std::chrono::steady_clock::now() - _start);
+            if (!_succeeded)
+            {
+                _errors.add();
+            }
+        }
+
+        inline void succeed()
+        {
+            _succeeded = true;
+        }
+
+    private:
+        Histogram &_duration;
+        Counter &_errors;
+        std::chrono::steady_clock::time_point _start{std::chrono::steady_clock::now()};
+        bool _succeeded{false};
+    };
+
+    Metrics(const Metrics &l) = delete;
+    Metrics(Metrics &&l) = delete;
+    Metrics &operator=(const Metrics &l) = delete;
+    Metrics &operator=(Metrics &&l) = delete;
+
+    static Metrics &getInstance();
+
+    Counter &counter(const std::string &name, const Labels &labels = {}, const std::string &help = {});
+    Gauge &gauge(const std::string &name, const Labels &labels = {}, const std::string &help = {});
+    Histogram &histogram(const std::string &name, const Labels &labels = {}, const std::string &help = {});
+
+    inline ScopedCall call(const std::string &name, const Labels &labels = {})
+    {
+        return ScopedCall{histogram(name + "_duration_seconds", labels), counter(name + "_errors_total", labels)};
+    }
+
+    // Prometheus text exposition format 0.0.4. Histograms are written as summaries
+    // with the 0.5, 0.9, 0.99 and 0.999 quantiles.
+    std::string render() const;
+
+private:
+    enum class Type
+    {
+        Counter,
+        Gauge,
+        Histogram,
+    };
+
+    struct Family
+    {
+        Type type{Type::Counter};
+        std::string help{};
+        std::map<std::string, std::unique_ptr<Counter>> counters{};
+        std::map<std::string, std::unique_ptr<Gauge>> gauges{};
+        std::map<std::string, std::unique_ptr<Histogram>> histograms{};
+    };
+
+    Metrics() = default;
+
+    Family &familyOf(const std::string &name, Type type, const std::string &help);
+    static std::string labelsKeyOf(const Labels &labels);
+
+    mutable std::mutex _mut{};
+    std::map<std::string, Family> _families{};
+};
+
+// Answers GET /metrics with Metrics::render() on a port of its own, for services without an HTTP server.
+// One thread, one connection at a time, which is plenty for a scraper.
+class MetricsHttpServer
+{
+public:
+    MetricsHttpServer() = default;
+
+    MetricsHttpServer(const MetricsHttpServer &l) = delete;
+    MetricsHttpServer(MetricsHttpServer &&l) = delete;
+    MetricsHttpServer &operator=(const MetricsHttpServer &l) = delete;
+    MetricsHttpServer &operator=(MetricsHttpServer &&l) = delete;
+
+    ~MetricsHttpServer();
+
+    bool start(uint16_t port);
+    void stop();
+
+private:
+    void serveLoop();
+    void serveConnection(int fd);
+
+    int _listen_fd{-1};
+    std::atomic<bool> _stop{false};
+    std::thread _thread{};
+};
@@ -1,42 +1,12 @@
 #include "openai.hpp"
-#include <curl/curl.h>
+#include "http_client.hpp"
+#include "metrics.hpp"
 
-static size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::string *userp)
-{
-    size_t total_size = size * nmemb;
-    userp->append((char *)contents, total_size);
-    return total_size;
-}
+// Stands in for the image in the request JSON, the body is sent around it so the base64 text is never copied.
+static const std::string image_placeholder = "@@image_base64@@";
 
-bool openai::jsonTextImg(const std::string& model_type, const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, nlohmann::json &res_json)
+static nlohmann::json buildRequest(const std::string& model_type, const std::string &prompt, const std::string &mime_type, const nlohmann::json &response_schema)
 {
-    const std::string api_key = Cfg::getInstance().getCfgValue("openai_api_key");
-
-    struct curl_slist *headers = NULL;
-    CURL *curl = NULL;
-    CURLcode res;
-    std::string response_string;
-    bool success = false;
-
-    const auto cleanup = [&]()
-    {
-        if (headers)
-            curl_slist_free_all(headers);
-        if (curl)
-            curl_easy_cleanup(curl);
-    };
-
-    curl = curl_easy_init();
-    if (!curl)
-    {
-        cleanup();
-        res_json = {{"function_error", "if(!curl)"}};
-        LOG_ERROR(res_json.dump());
-        return false;
-    }
-
-    std::string url = "https://api.openai.com/v1/chat/completions";
-    
     std::string system_message = "You are a helpful assistant that returns JSON responses only. ";
     system_message += "Your response must follow this JSON schema: " + response_schema.dump();
     
@@ -59,7 +29,7 @@ bool openai::jsonTextImg(const std::string& model_type, const std::string &promp
     user_message["content"].push_back({
         {"type", "image_url"},
         {"image_url", {
-            {"url", "data:" + mime_type + ";base64," + base64_image}
+            {"url", "data:" + mime_type + ";base64," + image_placeholder}
         }}
     });
     
@@ -71,39 +41,40 @@ bool openai::jsonTextImg(const std::string& model_type, const std::string &promp
         {"response_format", {{"type", "json_object"}}}
     };
 
-    std::string json_str = request_json.dump();
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_str.c_str());
+    return request_json;
+}
 
-    std::string auth_header = "Authorization: Bearer " + api_key;
-    headers = curl_slist_append(headers, auth_header.c_str());
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+static HttpClient::Request buildHttpRequest(const std::string& model_type, const std::string &prompt, const std::string &mime_type, std::string_view base64_image, std::shared_ptr<const std::string> base64_owner, const nlohmann::json &response_schema)
+{
+    const std::string api_key = Cfg::getInstance().getCfgValue("openai_api_key");
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_string);
+    static const std::string base_url = Cfg::getInstance().getCfgValueOr("openai_base_url", "https://api.openai.com");
 
-    res = curl_easy_perform(curl);
+    HttpClient::Request request{};
+    request.url = base_url + "/v1/chat/completions";
+    request.headers = {
+        "Authorization: Bearer " + api_key,
+        "Content-Type: application/json",
+    };
+    request.body = HttpClient::Body::jsonAround(buildRequest(model_type, prompt, mime_type, response_schema), image_placeholder, base64_image, std::move(base64_owner));
+    return request;
+}
 
-    if (res != CURLE_OK)
-    {
-        cleanup();
-        res_json = {{"function_error", "curl_easy_perform failed: " + std::string(curl_easy_strerror(res))}};
-        LOG_ERROR(res_json.dump());
-        return false;
-    }
+HttpClient::Request openai::jsonTextImgRequest(const std::string& model_type, const std::string &prompt, const std::string &mime_type, std::shared_ptr<const std::string> base64_image, const nlohmann::json &response_schema)
+{
+    const std::string_view base64_view = *base64_image;
+    return buildHttpRequest(model_type, prompt, mime_type, base64_view, std::move(base64_image), response_schema);
+}
 
-    if (!nlohmann::json::accept(response_string))
+bool openai::parseJsonTextImg(const std::string &body, nlohmann::json &res_json)
+{
+    nlohmann::json full_response{};
+    if (!parseJson(body, full_response))
     {
-        cleanup();
         res_json = {{"function_error", "Response is not valid JSON"}};
         LOG_ERROR(res_json.dump());
         return false;
     }
-
-    nlohmann::json full_response = nlohmann::json::parse(response_string);
     
     if (full_response.contains("choices") && !full_response["choices"].empty())
     {
@@ -113,25 +84,128 @@ bool openai::jsonTextImg(const std::string& model_type, const std::string &promp
             auto& content = full_response["choices"][0]["message"]["content"];
             if (content.is_string())
             {
-                std::string content_str = content.get<std::string>();
-                if (!nlohmann::json::accept(content_str))
+                if (!parseJson(content.get_ref<const std::string &>(), res_json))
                 {
-                    cleanup();
                     res_json = {{"function_error", "Response content is not valid JSON"}};
                     LOG_ERROR(res_json.dump());
                     return false;
                 }
-                
-                res_json = nlohmann::json::parse(content_str);
-                cleanup();
                 return true;
             }
         }
     }
     
-    cleanup();
     res_json = {{"function_error", "Could not parse structured JSON from OpenAI response"}};
     LOG_ERROR(res_json.dump());
     LOG_ERROR(full_response.dump());
     return false;
+}
+
+bool openai::jsonTextImg(const std::string& model_type, const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, nlohmann::json &res_json)
+{
+    auto llm_call = Metrics::getInstance().call("llm_request", {{"provider", "openai"}, {"model", model_type}, {"mode", "buffered"}});
+    // The caller's string outlives the blocking call, the body only points at it.
+    const HttpClient::Request request = buildHttpRequest(model_type, prompt, mime_type, base64_image, nullptr, response_schema);
+
+    HttpClient::Response response{};
+    std::string error{};
+    if (!HttpClient::getInstance().post(request.url, request.headers, request.body, response, error))
+    {
+        res_json = {{"function_error", error}};
+        LOG_ERROR(res_json.dump());
+        return false;
+    }
+
+    if (!parseJsonTextImg(response.body, res_json))
+    {
+        return false;
+    }
+    llm_call.succeed();
+    return true;
+}
+
+bool openai::jsonTextImgStream(const std::string& model_type, const std::string &prompt, const std::string &mime_type, const std::string &base64_image, const nlohmann::json &response_schema, const ProductsStreamExtractor::ProductCallback &on_product, nlohmann::json &res_json)
+{
+    auto llm_call = Metrics::getInstance().call("llm_request", {{"provider", "openai"}, {"model", model_type}, {"mode", "stream"}});
+    const std::string api_key = Cfg::getInstance().getCfgValue("openai_api_key");
+
+    static const std::string base_url = Cfg::getInstance().getCfgValueOr("openai_base_url", "https://api.openai.com");
+    const std::string url = base_url + "/v1/chat/completions";
+
+    nlohmann::json request_json = buildRequest(model_type, prompt, mime_type, response_schema);
+    request_json["stream"] = true;
+
+    const HttpClient::Body body = HttpClient::Body::jsonAround(request_json, image_placeholder, base64_image, nullptr);
+
+    const std::vector<std::string> headers{
+        "Authorization: Bearer " + api_key,
+        "Content-Type: application/json",
+    };
+
+    // Each event is a small chunk object, only choices[0].delta.content is fed to the extractor.
+    auto &first_product = Metrics::getInstance().histogram("llm_first_product_seconds", {{"provider", "openai"}, {"model", model_type}});
+    const auto start_point = std::chrono::steady_clock::now();
+    bool is_first_product{true};
+    ProductsStreamExtractor extractor{[&](const nlohmann::json &product)
+                                      {
+                                          if (is_first_product)
+                                          {
+                                              is_first_product = false;
+                                              first_product.observe(std::chrono::steady_clock::now() - start_point);
+                                          }
+                                          on_product(product);
+                                      }};
+    std::string stream_error{};
+    SseParser sse{[&](std::string_view data) -> bool
+                  {
+                      if (data == "[DONE]")
+                      {
+                          return true;
+                      }
+
+                      nlohmann::json chunk{};
+                      if (!parseJson(data, chunk))
+                      {
+                          stream_error = "Stream chunk is not valid JSON";
+                          return false;
+                      }
+
+                      if (!chunk.contains("choices") || !chunk["choices"].is_array() || chunk["choices"].empty())
+                      {
+                          return true;
+                      }
+
+                      const auto &choice = chunk["choices"][0];
+                      if (!choice.contains("delta") || !choice["delta"].contains("content") || !choice["delta"]["content"].is_string())
+                      {
+                          return true;
+                      }
+
+                      if (!extractor.feed(choice["delta"]["content"].get_ref<const std::string &>()))
+                      {
+                          stream_error = "Response content is not valid JSON";
+                          return false;
+                      }
+                      return true;
+                  }};
+
+    long status_code{0};
+    std::string error{};
+    const bool ok = HttpClient::getInstance().postStream(url, headers, body, [&](std::string_view bytes)
+                                                         { return sse.feed(bytes); }, status_code, error);
+    if (!ok || !sse.finish())
+    {
+        res_json = {{"function_error", stream_error.size() ? stream_error : error}};
+        LOG_ERROR(res_json.dump());
+        return false;
+    }
+
+    if (!extractor.finish(res_json))
+    {
+        res_json = {{"function_error", "Could not parse structured JSON from OpenAI stream"}};
+        LOG_ERROR(res_json.dump());
+        return false;
+    }
+    llm_call.succeed();
+    return true;
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "trace.hpp"
+#include "functions.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <random>
+
+TraceWriter &TraceWriter::getInstance()
+{
+    static TraceWriter s{};
+    return s;
+}
+
+TraceWriter::TraceWriter()
+{
+    const std::string path = Cfg::getInstance().getCfgValueOr("trace_file_path", "");
+    if (path.empty())
+    {
+        return;
+    }
+
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd < 0)
+    {
+        LOG_ERROR("can not open trace_file_path: " + path + " " + std::strerror(errno));
+    }
+}
+
+TraceWriter::~TraceWriter()
+{
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+    }
+}
+
+std::string TraceWriter::newTraceId()
+{
+    thread_local std::mt19937_64 generator{std::random_device{}()};
+
+    static constexpr char hex[] = "0123456789abcdef";
+    std::string id(32, '0');
+    for (size_t half = 0; half < 2; ++half)
+    {
+        uint64_t bits = generator();
+        for (size_t i = 0; i < 16; ++i)
+        {
+            id[half * 16 + i] = hex[bits & 0xf];
+            bits >>= 4;
+        }
+    }
+    return id;
+}
+
+void TraceWriter::setService(std::string service)
+{
+    std::lock_guard lock{_mut};
+    _service = std::move(service);
+}
+
+void TraceWriter::write(std::string_view trace_id, std::string_view stage, int64_t start_us, int64_t duration_us, bool ok)
+{
+    if (_fd < 0)
+    {
+        return;
+    }
+
+    nlohmann::json span{};
+    span["trace_id"] = trace_id;
+    span["stage"] = stage;
+    span["start_us"] = start_us;
+    span["duration_us"] = duration_us;
+    span["ok"] = ok;
+    {
+        std::lock_guard lock{_mut};
+        span["service"] = _service;
+    }
+
+    // One write per line, O_APPEND keeps lines of concurrent writers from interleaving.
+    const std::string line = span.dump() + "\n";
+    if (::write(_fd, line.data(), line.size()) != static_cast<ssize_t>(line.size()))
+    {
+        LOG_ERROR("if(::write(_fd, line.data(), line.size()) != static_cast<ssize_t>(line.size()))");
+    }
+}
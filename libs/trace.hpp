@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Per stage timing of one recognition across web_server and ai_requester_service.
+// The web server creates the trace id and sends it with the AMQP message, every stage on either side
+// appends one JSON line {"trace_id", "stage", "service", "start_us", "duration_us", "ok"} to the file
+// named by the "trace_file_path" cfg key. Both services may share one file, each line is a single
+// O_APPEND write. An empty path disables tracing. trace_stats aggregates the file per stage.
+class TraceWriter
+{
+public:
+    TraceWriter(const TraceWriter &l) = delete;
+    TraceWriter(TraceWriter &&l) = delete;
+    TraceWriter &operator=(const TraceWriter &l) = delete;
+    TraceWriter &operator=(TraceWriter &&l) = delete;
+
+    static TraceWriter &getInstance();
+
+    // Random 128 bit id as 32 hex characters.
+    static std::string newTraceId();
+
+    // Wall clock microseconds, comparable between processes on one host.
+    static inline int64_t nowUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    inline bool enabled() const
+    {
+        return _fd >= 0;
+    }
+
+    // service names the process, set once at startup.
+    void setService(std::string service);
+
+    void write(std::string_view trace_id, std::string_view stage, int64_t start_us, int64_t duration_us, bool ok);
+
+private:
+    TraceWriter();
+    ~TraceWriter();
+
+    int _fd{-1};
+    std::string _service{};
+    std::mutex _mut{};
+};
+
+// Records one stage from construction to destruction, ok only if succeed() was called.
+// trace_id and stage are not copied and must outlive the span.
+class TraceSpan
+{
+public:
+    TraceSpan(std::string_view trace_id, std::string_view stage) : _trace_id(trace_id), _stage(stage) {}
+
+    TraceSpan(const TraceSpan &l) = delete;
+    TraceSpan(TraceSpan &&l) = delete;
+    TraceSpan &operator=(const TraceSpan &l) = delete;
+    TraceSpan &operator=(TraceSpan &&l) = delete;
+
+    inline ~TraceSpan()
+    {
+        if (_trace_id.empty() || !TraceWriter::getInstance().enabled())
+        {
+            return;
+        }
+        const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+        TraceWriter::getInstance().write(_trace_id, _stage, _start_us, duration, _succeeded);
+    }
+
+    inline void succeed()
+    {
+        _succeeded = true;
+    }
+
+private:
+    std::string_view _trace_id{};
+    std::string_view _stage{};
+    int64_t _start_us{TraceWriter::nowUs()};
+    std::chrono::steady_clock::time_point _start{std::chrono::steady_clock::now()};
+    bool _succeeded{false};
+};
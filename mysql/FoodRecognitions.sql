@@ -7,5 +7,8 @@ CREATE TABLE FoodRecognitions
     ImagePath VARCHAR(256) DEFAULT '',
     ErrorMessage VARCHAR(256) DEFAULT '',
     CreateTS TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
-    FOREIGN KEY (UserID) REFERENCES Users(ID)
+    LeaseExpiresTS TIMESTAMP NULL DEFAULT NULL,
+    WorkerID VARCHAR(128) DEFAULT '',
+    FOREIGN KEY (UserID) REFERENCES Users(ID),
+    INDEX StatusLeaseIdx (Status, LeaseExpiresTS)
 );
\ No newline at end of file
@@ -0,0 +1,10 @@
+-- The outbox relay claims rows with SELECT ... FOR UPDATE SKIP LOCKED, which needs MySQL 8.0 or newer.
+CREATE TABLE RecognitionOutbox
+(
+    ID BIGINT UNSIGNED AUTO_INCREMENT PRIMARY KEY,
+    FoodRecognitionID BIGINT UNSIGNED NOT NULL,
+    TraceID VARCHAR(32) DEFAULT '',
+    EnqueuedUs BIGINT DEFAULT 0,
+    ClaimedUntilTS TIMESTAMP NULL DEFAULT NULL,
+    CreateTS TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+);
@@ -0,0 +1,10 @@
+CREATE TABLE ResultCache
+(
+    ImageHash CHAR(64) NOT NULL,
+    PromptVersion CHAR(16) NOT NULL,
+    Model VARCHAR(64) NOT NULL,
+    ResultJson JSON,
+    LlmMs BIGINT UNSIGNED DEFAULT 0,
+    CreateTS TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    PRIMARY KEY (ImageHash, PromptVersion, Model)
+);
\ No newline at end of file
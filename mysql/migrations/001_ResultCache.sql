@@ -0,0 +1,13 @@
+-- Databases created before the result cache. Run it before starting the new ai_requester_service.
+USE dd;
+
+CREATE TABLE IF NOT EXISTS ResultCache
+(
+    ImageHash CHAR(64) NOT NULL,
+    PromptVersion CHAR(16) NOT NULL,
+    Model VARCHAR(64) NOT NULL,
+    ResultJson JSON,
+    LlmMs BIGINT UNSIGNED DEFAULT 0,
+    CreateTS TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    PRIMARY KEY (ImageHash, PromptVersion, Model)
+);
@@ -0,0 +1,8 @@
+-- Lease columns the requester claims rows with. Run it before starting the new ai_requester_service:
+-- the claim, the sweeper and the batched result update all name these columns.
+USE dd;
+
+ALTER TABLE FoodRecognitions
+    ADD COLUMN LeaseExpiresTS TIMESTAMP NULL DEFAULT NULL,
+    ADD COLUMN WorkerID VARCHAR(64) DEFAULT '',
+    ADD INDEX StatusLeaseIdx (Status, LeaseExpiresTS);
@@ -0,0 +1,14 @@
+-- Databases created before the outbox. Run it before starting the new web_server and ai_requester_service:
+-- recognize_food inserts into this table and the requester relays from it.
+-- The relay claims rows with SELECT ... FOR UPDATE SKIP LOCKED, which needs MySQL 8.0 or newer.
+USE dd;
+
+CREATE TABLE IF NOT EXISTS RecognitionOutbox
+(
+    ID BIGINT UNSIGNED AUTO_INCREMENT PRIMARY KEY,
+    FoodRecognitionID BIGINT UNSIGNED NOT NULL,
+    TraceID VARCHAR(32) DEFAULT '',
+    EnqueuedUs BIGINT DEFAULT 0,
+    ClaimedUntilTS TIMESTAMP NULL DEFAULT NULL,
+    CreateTS TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+);
@@ -0,0 +1,6 @@
+-- WorkerID holds the claim of one delivery, <worker id>:<uuid>, which does not fit the old 64 characters.
+-- Run it before starting the new ai_requester_service.
+USE dd;
+
+ALTER TABLE FoodRecognitions
+    MODIFY COLUMN WorkerID VARCHAR(128) DEFAULT '';
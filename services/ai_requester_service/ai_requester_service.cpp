@@ -1,9 +1,22 @@
 #include <SimpleAmqpClient/SimpleAmqpClient.h>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unistd.h>
+#include "blocking_queue.hpp"
+#include "confirmed_publisher.hpp"
 #include "functions.hpp"
-#include "gemini.hpp"
-#include "openai.hpp"
+#include "lease_sweeper.hpp"
+#include "llm_router.hpp"
+#include "metrics.hpp"
+#include "mysql_pool.hpp"
+#include "outbox_relay.hpp"
+#include "result_cache.hpp"
+#include "trace.hpp"
 
 #include <mysql_driver.h>
 #include <mysql_connection.h>
@@ -13,6 +26,787 @@
 #include <cppconn/prepared_statement.h>
 #include <iostream>
 
+enum class MessageOutcome
+{
+    Ack,
+    // Published again to the retry queue of its attempt, the broker brings it back after the delay.
+    Retry,
+    // Published to dead_letter_queue, its row is marked Error.
+    DeadLetter,
+    // Acked without a result: the row is finished or another requester holds its lease.
+    Drop,
+};
+
+// One recognition between its stages: a worker loads it, the LLM call runs on the AsyncHttpClient loop
+// and a worker stores the answer.
+struct Recognition
+{
+    std::string request_id{};
+    // FoodRecognitions.WorkerID of this delivery's claim, see claimOf.
+    std::string claim{};
+    std::string trace_id{};
+    MimeTypeAndBase64 image{};
+    std::string image_hash{};
+    int64_t llm_start_us{0};
+    bool llm_ok{false};
+    // The answer came from ResultCache, there is nothing to store there.
+    bool cache_hit{false};
+    std::string used_model{};
+    nlohmann::json res_json{};
+    // Set when a stage fails. A permanent error, e.g. a missing row, is not retried.
+    std::string error{};
+    bool permanent_error{false};
+    // The row could not be claimed, the message is dropped.
+    bool not_claimed{false};
+};
+
+struct WorkItem
+{
+    AmqpClient::Envelope::ptr_t envelope{};
+    std::chrono::steady_clock::time_point consumed_ts{};
+    // Set when the LLM has answered, the worker then only stores the result.
+    std::shared_ptr<Recognition> recognition{};
+};
+
+struct CompletedItem
+{
+    AmqpClient::Envelope::ptr_t envelope{};
+    MessageOutcome outcome{MessageOutcome::Retry};
+    std::string request_id{};
+    std::string claim{};
+    std::string trace_id{};
+    std::chrono::steady_clock::time_point consumed_ts{};
+    int64_t finished_us{0};
+    std::string error{};
+};
+
+// A recognised message on its way to the database, the writer stores it with the rest of its batch.
+struct PendingWrite
+{
+    CompletedItem completed{};
+    std::string res_json{};
+    int64_t ready_us{0};
+};
+
+// Fanout exchange the web servers listen on to wake /wait_result.
+static const std::string results_exchange = "recognition_results";
+
+static const std::string recognize_queue = "recognize_food";
+// Messages that failed for good, kept with their attempts and last error for inspection or a manual replay.
+static const std::string dead_letter_queue = "recognize_food.dead";
+// Failed attempts so far, set on every message published to a retry queue.
+static const std::string attempts_header = "x-attempts";
+static const std::string error_header = "x-error";
+
+// A failed message waits in the queue of its attempt, requester_retry_delays_ms (1 s, 4 s, 16 s, 64 s by default),
+// the last delay repeats. Every queue has one TTL and dead-letters back to recognize_food, so a message never
+// waits behind one with a longer delay. After requester_max_attempts (delays + 1) the message is dead-lettered.
+struct RetryPolicy
+{
+    std::vector<size_t> delays_ms{};
+    size_t max_attempts{1};
+
+    static inline const RetryPolicy &getInstance()
+    {
+        static const RetryPolicy policy = []()
+        {
+            RetryPolicy res{};
+            const nlohmann::json delays_json = Cfg::getInstance().getCfgJson("requester_retry_delays_ms");
+            if (delays_json.is_array())
+            {
+                for (const auto &delay : delays_json)
+                {
+                    if (delay.is_number_unsigned() && delay.get<size_t>())
+                    {
+                        res.delays_ms.push_back(delay.get<size_t>());
+                    }
+                }
+            }
+            if (res.delays_ms.empty())
+            {
+                res.delays_ms = {1000, 4000, 16000, 64000};
+            }
+            res.max_attempts = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("requester_max_attempts", res.delays_ms.size() + 1));
+            return res;
+        }();
+        return policy;
+    }
+
+    static inline std::string queueOf(size_t delay_ms)
+    {
+        return recognize_queue + ".retry." + std::to_string(delay_ms) + "ms";
+    }
+
+    // Retry queue after the given number of failed attempts.
+    inline std::string queueAfter(size_t attempts) const
+    {
+        return queueOf(delays_ms[std::min(std::max<size_t>(1, attempts), delays_ms.size()) - 1]);
+    }
+};
+
+// Identifies this requester, it prefixes every claim in FoodRecognitions.WorkerID: requester_worker_id, by default <hostname>:<pid>.
+static const std::string &workerId()
+{
+    static const std::string worker_id = []()
+    {
+        std::string id = Cfg::getInstance().getCfgValueOr("requester_worker_id", "");
+        if (id.empty())
+        {
+            char hostname[256]{};
+            gethostname(hostname, sizeof(hostname) - 1);
+            id = std::string{hostname} + ":" + std::to_string(getpid());
+        }
+        // Leaves room in WorkerID for the uuid of claimOf.
+        return id.substr(0, 64);
+    }();
+    return worker_id;
+}
+
+// A claim is owned by one delivery, not by the requester: a duplicate delivery of the same message in this
+// process gets its own token, reads back someone else's and is dropped. WorkerID is VARCHAR(128).
+static std::string claimOf()
+{
+    return workerId() + ":" + newUuidV4();
+}
+
+// Failed attempts of the message before this delivery.
+static size_t attemptsOf(const AmqpClient::Envelope::ptr_t &envelope)
+{
+    const auto &message = envelope->Message();
+    if (!message->HeaderTableIsSet())
+    {
+        return 0;
+    }
+    const auto &headers = message->HeaderTable();
+    const auto it = headers.find(attempts_header);
+    if (it == headers.end() || (it->second.GetType() != AmqpClient::VT_int32 && it->second.GetType() != AmqpClient::VT_int64))
+    {
+        return 0;
+    }
+    return static_cast<size_t>(std::max<int64_t>(0, it->second.GetInteger()));
+}
+
+// Retry queues dead-letter through the default exchange straight back to recognize_food.
+static void declareRetryQueues(AmqpClient::Channel &channel)
+{
+    for (const size_t delay_ms : RetryPolicy::getInstance().delays_ms)
+    {
+        AmqpClient::Table arguments{};
+        arguments["x-message-ttl"] = AmqpClient::TableValue{static_cast<int32_t>(delay_ms)};
+        arguments["x-dead-letter-exchange"] = AmqpClient::TableValue{std::string{}};
+        arguments["x-dead-letter-routing-key"] = AmqpClient::TableValue{recognize_queue};
+        channel.DeclareQueue(RetryPolicy::queueOf(delay_ms), false, true, false, false, arguments);
+    }
+    channel.DeclareQueue(dead_letter_queue, false, true, false, false);
+}
+
+// The message as it goes to a retry queue or dead_letter_queue, with its attempts and last error in the headers.
+// The x-death history the broker added on the way through a retry queue is not carried over.
+static ConfirmedPublisher::Message failedCopyOf(const CompletedItem &completed)
+{
+    const size_t attempts = attemptsOf(completed.envelope) + 1;
+    ConfirmedPublisher::Message message{};
+    message.routing_key = completed.outcome == MessageOutcome::Retry ? RetryPolicy::getInstance().queueAfter(attempts) : dead_letter_queue;
+    message.body = completed.envelope->Message()->Body();
+    message.headers[attempts_header] = static_cast<int64_t>(attempts);
+    message.headers[error_header] = completed.error;
+    return message;
+}
+
+// Marks the row failed unless it was stored in the meantime or another delivery holds its lease.
+static void markFailed(MysqlPool &pool, const std::string &request_id, const std::string &claim, const std::string &error)
+{
+    static const std::string update_query = "update FoodRecognitions set Status = ?, ErrorMessage = ?, LeaseExpiresTS = null where id = ? and Status <> ? and (Status <> ? or WorkerID = ?)";
+    try
+    {
+        auto update_call = Metrics::getInstance().call("db_query", {{"query", update_query}});
+        pool.run([&](MysqlPool::Lease &lease)
+                 {
+                     auto &pstmt = lease.prepare(update_query);
+                     pstmt.setString(1, FoodRecognitions::Status::Error);
+                     // ErrorMessage is VARCHAR(256).
+                     pstmt.setString(2, error.substr(0, 256));
+                     pstmt.setString(3, request_id);
+                     pstmt.setString(4, FoodRecognitions::Status::Done);
+                     pstmt.setString(5, FoodRecognitions::Status::Processing);
+                     pstmt.setString(6, claim);
+                     pstmt.executeUpdate(); });
+        update_call.succeed();
+    }
+    catch (sql::SQLException &e)
+    {
+        LOG_ERROR("SQLException: " + e.what());
+        LOG_ERROR("SQLState: " + e.getSQLStateCStr());
+    }
+}
+
+// Gives the row back while the message waits in a retry queue, whichever requester gets it next can claim it.
+static void releaseLease(MysqlPool &pool, const std::string &request_id, const std::string &claim)
+{
+    static const std::string update_query = "update FoodRecognitions set Status = ?, LeaseExpiresTS = null where id = ? and Status = ? and WorkerID = ?";
+    try
+    {
+        auto update_call = Metrics::getInstance().call("db_query", {{"query", update_query}});
+        pool.run([&](MysqlPool::Lease &lease)
+                 {
+                     auto &pstmt = lease.prepare(update_query);
+                     pstmt.setString(1, FoodRecognitions::Status::Waiting);
+                     pstmt.setString(2, request_id);
+                     pstmt.setString(3, FoodRecognitions::Status::Processing);
+                     pstmt.setString(4, claim);
+                     pstmt.executeUpdate(); });
+        update_call.succeed();
+    }
+    catch (sql::SQLException &e)
+    {
+        // The lease then runs out and the row is claimable again, or the sweeper requeues it.
+        LOG_ERROR("SQLException: " + e.what());
+        LOG_ERROR("SQLState: " + e.getSQLStateCStr());
+    }
+}
+
+// Retry while attempts are left, otherwise dead-letter and mark the row failed. claim is empty when the
+// delivery never tried to claim the row.
+static MessageOutcome failureOutcome(MysqlPool &pool, const AmqpClient::Envelope::ptr_t &envelope, const std::string &request_id, const std::string &claim,
+                                     const std::string &error, bool permanent)
+{
+    const size_t attempts = attemptsOf(envelope) + 1;
+    if (!permanent && attempts < RetryPolicy::getInstance().max_attempts)
+    {
+        LOG_ERROR("retrying " + request_id + " attempt " + std::to_string(attempts) + ": " + error);
+        if (request_id.size())
+        {
+            releaseLease(pool, request_id, claim);
+        }
+        return MessageOutcome::Retry;
+    }
+
+    LOG_ERROR("dead-lettering " + request_id + " after attempts " + std::to_string(attempts) + ": " + error);
+    if (request_id.size())
+    {
+        markFailed(pool, request_id, claim, error);
+    }
+    return MessageOutcome::DeadLetter;
+}
+
+// Runs on a worker thread like the other stages, none of them may touch the AMQP channel.
+// False when the message can not be processed, recognition.error tells why.
+static bool prepareRecognition(MysqlPool &pool, ResultCache &result_cache, const std::string &body, Recognition &recognition)
+{
+    nlohmann::json obj{};
+    if (!parseJson(body, obj))
+    {
+        LOG_ERROR("if(!parseJson(body, obj))");
+        recognition.error = "message body is not json";
+        recognition.permanent_error = true;
+        return false;
+    }
+
+    if (!obj.count("FoodRecognitionID") || !obj["FoodRecognitionID"].is_string())
+    {
+        LOG_ERROR("if(!obj.count(\"FoodRecognitionID\") || !obj[\"FoodRecognitionID\"].is_string())");
+        recognition.error = "message has no FoodRecognitionID";
+        recognition.permanent_error = true;
+        return false;
+    }
+    const std::string req_id = obj["FoodRecognitionID"].get<std::string>();
+    recognition.request_id = req_id;
+
+    // Messages published without a trace are processed the same, they just record no spans.
+    const auto &trace_id = recognition.trace_id;
+    if (obj.count("TraceID") && obj["TraceID"].is_string())
+    {
+        recognition.trace_id = obj["TraceID"].get<std::string>();
+    }
+    if (trace_id.size() && obj.count("EnqueuedUs") && obj["EnqueuedUs"].is_number_integer() && TraceWriter::getInstance().enabled())
+    {
+        const int64_t enqueued_us = obj["EnqueuedUs"].get<int64_t>();
+        TraceWriter::getInstance().write(trace_id, "queue_wait", enqueued_us, TraceWriter::nowUs() - enqueued_us, true);
+    }
+
+    try
+    {
+        std::string image_path{};
+        std::string status{};
+        std::string worker_id{};
+        size_t rows_count{};
+
+        // The row is ours when it is Waiting or its lease ran out, the select then tells whether the claim took.
+        // Ownership is read back instead of taken from the affected rows, so a claim retried on a new connection
+        // after the first one went through still counts. The token is set before the update, a claim that went
+        // through before an error is still released by failureOutcome.
+        static const size_t lease_sec = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("requester_lease_sec", 600));
+        static const std::string claim_query = "update FoodRecognitions set Status = ?, WorkerID = ?, LeaseExpiresTS = now() + interval ? second "
+                                               "where id = ? and (Status = ? or (Status = ? and LeaseExpiresTS < now()))";
+        static const std::string select_query = "select ImagePath, Status, WorkerID from FoodRecognitions where id = ?";
+        recognition.claim = claimOf();
+        {
+            TraceSpan span{trace_id, "db_claim"};
+            auto claim_call = Metrics::getInstance().call("db_query", {{"query", claim_query}});
+            pool.run([&](MysqlPool::Lease &lease)
+                     {
+                         auto &claim_pstmt = lease.prepare(claim_query);
+                         claim_pstmt.setString(1, FoodRecognitions::Status::Processing);
+                         claim_pstmt.setString(2, recognition.claim);
+                         claim_pstmt.setUInt64(3, lease_sec);
+                         claim_pstmt.setString(4, req_id);
+                         claim_pstmt.setString(5, FoodRecognitions::Status::Waiting);
+                         claim_pstmt.setString(6, FoodRecognitions::Status::Processing);
+                         claim_pstmt.executeUpdate();
+
+                         auto &pstmt = lease.prepare(select_query);
+                         pstmt.setString(1, req_id);
+                         std::unique_ptr<sql::ResultSet> res{pstmt.executeQuery()};
+
+                         rows_count = 0;
+                         while (res->next())
+                         {
+                             ++rows_count;
+                             image_path = res->getString("ImagePath");
+                             status = res->getString("Status");
+                             worker_id = res->getString("WorkerID");
+                         } });
+            claim_call.succeed();
+            span.succeed();
+        }
+
+        if (rows_count == 0)
+        {
+            LOG_ERROR("if(image_path == 0)");
+            recognition.error = "no such recognition";
+            recognition.permanent_error = true;
+            return false;
+        }
+
+        if (status != FoodRecognitions::Status::Processing || worker_id != recognition.claim)
+        {
+            LOG_INFO("not claimed " + req_id + " status " + status + " worker " + worker_id);
+            recognition.not_claimed = true;
+            return true;
+        }
+
+        if (image_path.empty())
+        {
+            LOG_ERROR("if(image_path.empty())");
+            recognition.error = "recognition has no image";
+            recognition.permanent_error = true;
+            return false;
+        }
+
+        {
+            TraceSpan span{trace_id, "image_load"};
+            recognition.image = image_to_llm_base64_data_uri(image_path);
+            if (recognition.image.base64_string.empty() || recognition.image.mime_type.empty())
+            {
+                LOG_ERROR("if(mime_and_base64.base64_string.empty() || mime_and_base64.mime_type.empty())");
+                recognition.error = "image can not be read";
+                return false;
+            }
+            span.succeed();
+        }
+
+        if (result_cache.enabled())
+        {
+            TraceSpan span{trace_id, "cache_lookup"};
+            recognition.image_hash = ResultCache::imageHashOf(recognition.image.base64_string);
+            if (auto entry = result_cache.find(recognition.image_hash))
+            {
+                LOG_INFO("cache hit for " + recognition.request_id + " from " + entry->model);
+                recognition.cache_hit = true;
+                recognition.llm_ok = true;
+                recognition.used_model = std::move(entry->model);
+                recognition.res_json = std::move(entry->res_json);
+                span.succeed();
+            }
+        }
+        return true;
+    }
+    catch (sql::SQLException &e)
+    {
+        LOG_ERROR("SQLException: " + e.what());
+        LOG_ERROR("SQLState: " + e.getSQLStateCStr());
+        recognition.error = std::string{"database error: "} + e.what();
+        return false;
+    }
+}
+
+// Prepares the answer for storing, the row itself is written by writerLoop.
+static MessageOutcome finishRecognition(ResultCache &result_cache, Recognition &recognition)
+{
+    if (!recognition.llm_ok)
+    {
+        LOG_ERROR("if (!llm_ok)");
+        recognition.error = "LLM request failed";
+        return MessageOutcome::Retry;
+    }
+
+    // Stores the answer as the model gave it, the ratios below are derived again on every use.
+    if (!recognition.cache_hit && recognition.image_hash.size() && recognition.used_model.size())
+    {
+        TraceSpan span{recognition.trace_id, "cache_store"};
+        const uint64_t llm_ms = static_cast<uint64_t>(std::max<int64_t>(0, TraceWriter::nowUs() - recognition.llm_start_us) / 1000);
+        result_cache.store(recognition.image_hash, recognition.used_model, recognition.res_json, llm_ms);
+        span.succeed();
+    }
+
+    const auto get_float_smart = [](const nlohmann::json& obj, const std::string& key) -> std::optional<float>
+    {
+        float res{0.0f};
+        if(obj.count(key) && obj[key].is_number_float())
+        {
+            res = obj[key].get<float>();
+        }
+        else if(obj.count(key) && obj[key].is_string())
+        {
+            res = stringToFloat(obj[key].get<std::string>());
+        }
+        else if(obj.count(key) && obj[key].is_number())
+        {
+            res = obj[key].get<int>();
+        }
+        else
+        {
+            return std::nullopt;
+        }
+        return res;
+    };
+
+    auto &res_json = recognition.res_json;
+    if(res_json.count("products") && res_json["products"].is_array())
+    {
+        for(auto& product : res_json["products"])
+        {
+            auto carbs_opt = get_float_smart(product, "carbs");
+            auto grams_opt = get_float_smart(product, "grams");
+
+            if(!grams_opt || !carbs_opt || grams_opt.value() <= 0.0001f || carbs_opt.value() <= 0.0001f)
+            {
+                product["ratio"] = float{0};
+            }
+            else
+            {
+                product["ratio"] = float{carbs_opt.value() / grams_opt.value() * 100.0f};
+            }
+        }
+    }
+    return MessageOutcome::Ack;
+}
+
+// update FoodRecognitions set Status = ?, ... ResultJson = case WorkerID when ? then ? ... end where id in (?, ...) and <lease is ours>
+// A claim token is written only to the row it claimed, so WorkerID alone picks the result of each row.
+// One statement is one implicit transaction, the whole batch commits or none of it does. rows is a
+// MysqlPool::paddedCount, the tail of a smaller batch repeats its last row so few statements stay prepared.
+static const std::string &batchUpdateQuery(size_t rows)
+{
+    static std::mutex mut{};
+    static std::map<size_t, std::string> queries{};
+
+    std::lock_guard lock{mut};
+    auto &query = queries[rows];
+    if (query.empty())
+    {
+        query = "update FoodRecognitions set Status = ?, LeaseExpiresTS = null, ResultJson = case WorkerID";
+        for (size_t i = 0; i < rows; ++i)
+        {
+            query += " when ? then ?";
+        }
+        query += " end where id in (" + MysqlPool::placeholders(rows) + ") and Status = ? and WorkerID in (" + MysqlPool::placeholders(rows) + ")";
+    }
+    return query;
+}
+
+// After a batch updated fewer rows than it has, finds the rows whose claim did not store them and drops their messages.
+static void dropFenced(MysqlPool &pool, std::vector<PendingWrite> &batch)
+{
+    const size_t padded = MysqlPool::paddedCount(batch.size());
+    const std::string select_query = "select WorkerID from FoodRecognitions where Status = ? and id in (" + MysqlPool::placeholders(padded) + ")";
+
+    std::set<std::string> stored{};
+    auto select_call = Metrics::getInstance().call("db_query", {{"query", "select stored FoodRecognitions batch"}});
+    pool.run([&](MysqlPool::Lease &lease)
+             {
+                 auto &pstmt = lease.prepare(select_query);
+                 int index{1};
+                 pstmt.setString(index++, FoodRecognitions::Status::Done);
+                 for (size_t i = 0; i < padded; ++i)
+                 {
+                     pstmt.setString(index++, batch[std::min(i, batch.size() - 1)].completed.request_id);
+                 }
+                 std::unique_ptr<sql::ResultSet> rows{pstmt.executeQuery()};
+
+                 stored.clear();
+                 while (rows->next())
+                 {
+                     stored.insert(rows->getString("WorkerID"));
+                 } });
+    select_call.succeed();
+
+    for (auto &write : batch)
+    {
+        if (!stored.count(write.completed.claim))
+        {
+            LOG_ERROR("lease lost before the result was stored: " + write.completed.request_id);
+            write.completed.outcome = MessageOutcome::Drop;
+        }
+    }
+}
+
+// Only rows whose claim the batch still holds are written. A row whose lease ran out and was claimed by another
+// delivery keeps that delivery's result, its message here is dropped. connection_lost tells a failure
+// that would fail any statement from one that may be down to a row of the batch.
+static bool storeResults(MysqlPool &pool, std::vector<PendingWrite> &batch, std::string &error, bool &connection_lost)
+{
+    const size_t padded = MysqlPool::paddedCount(batch.size());
+    const std::string &update_query = batchUpdateQuery(padded);
+    try
+    {
+        int updated{0};
+        // One label for every batch size, the query text would make a series per size.
+        auto update_call = Metrics::getInstance().call("db_query", {{"query", "update FoodRecognitions batch"}});
+        pool.run([&](MysqlPool::Lease &lease)
+                 {
+                     auto &pstmt = lease.prepare(update_query);
+                     int index{1};
+                     pstmt.setString(index++, FoodRecognitions::Status::Done);
+                     for (size_t i = 0; i < padded; ++i)
+                     {
+                         const auto &write = batch[std::min(i, batch.size() - 1)];
+                         pstmt.setString(index++, write.completed.claim);
+                         pstmt.setString(index++, write.res_json);
+                     }
+                     for (size_t i = 0; i < padded; ++i)
+                     {
+                         pstmt.setString(index++, batch[std::min(i, batch.size() - 1)].completed.request_id);
+                     }
+                     pstmt.setString(index++, FoodRecognitions::Status::Processing);
+                     for (size_t i = 0; i < padded; ++i)
+                     {
+                         pstmt.setString(index++, batch[std::min(i, batch.size() - 1)].completed.claim);
+                     }
+                     updated = pstmt.executeUpdate(); });
+        update_call.succeed();
+        if (static_cast<size_t>(updated) < batch.size())
+        {
+            dropFenced(pool, batch);
+        }
+        return true;
+    }
+    catch (sql::SQLException &e)
+    {
+        LOG_ERROR("SQLException: " + e.what());
+        LOG_ERROR("SQLState: " + e.getSQLStateCStr());
+        error = std::string{"database error: "} + e.what();
+        connection_lost = MysqlPool::isConnectionError(e);
+        return false;
+    }
+}
+
+// Collects finished recognitions for up to requester_db_flush_ms or requester_db_batch_size rows and stores them
+// with one statement. Workers keep filling the next batch while this one commits. Every row of a batch
+// goes to completed_queue once the commit is done, the channel thread acks them after that. When a batch fails
+// for anything but a lost connection its rows are stored one by one, so a single bad row fails only its own message.
+static void writerLoop(sql::mysql::MySQL_Driver *driver, MysqlPool &pool, BlockingQueue<PendingWrite> &write_queue, BlockingQueue<CompletedItem> &completed_queue)
+{
+    driver->threadInit();
+    const auto scope_exit = makeScopeExit([&]()
+                                          { driver->threadEnd(); });
+
+    static const size_t batch_size = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("requester_db_batch_size", 64));
+    static const auto flush_interval = std::chrono::milliseconds{Cfg::getInstance().getCfgSizeT("requester_db_flush_ms", 5)};
+    auto &commits = Metrics::getInstance().counter("requester_db_commits_total", {}, "Result batches written to FoodRecognitions");
+    auto &rows = Metrics::getInstance().counter("requester_db_committed_rows_total", {}, "Results written to FoodRecognitions");
+
+    while (auto first = write_queue.pop())
+    {
+        std::vector<PendingWrite> batch{};
+        batch.push_back(std::move(*first));
+        const auto deadline = std::chrono::steady_clock::now() + flush_interval;
+        while (batch.size() < batch_size)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                break;
+            }
+            auto next = write_queue.popFor(deadline - now);
+            if (!next)
+            {
+                break;
+            }
+            batch.push_back(std::move(*next));
+        }
+
+        std::string error{};
+        bool connection_lost{false};
+        const bool ok = storeResults(pool, batch, error, connection_lost);
+        if (ok)
+        {
+            commits.add();
+            rows.add(batch.size());
+        }
+        else if (batch.size() > 1 && !connection_lost)
+        {
+            LOG_ERROR("storing the batch row by row after: " + error);
+        }
+
+        for (auto &write : batch)
+        {
+            bool row_ok{ok};
+            std::string row_error{error};
+            if (!ok && batch.size() > 1 && !connection_lost)
+            {
+                std::vector<PendingWrite> single{};
+                single.push_back(std::move(write));
+                row_error.clear();
+                bool row_connection_lost{false};
+                row_ok = storeResults(pool, single, row_error, row_connection_lost);
+                write = std::move(single.front());
+                if (row_ok)
+                {
+                    commits.add();
+                    rows.add();
+                }
+            }
+
+            const int64_t finished_us = TraceWriter::nowUs();
+            // Covers the wait for the batch to fill as well, that is part of what the message waits for.
+            if (write.completed.trace_id.size() && TraceWriter::getInstance().enabled())
+            {
+                TraceWriter::getInstance().write(write.completed.trace_id, "db_update", write.ready_us, finished_us - write.ready_us, row_ok);
+            }
+            if (!row_ok)
+            {
+                write.completed.outcome = failureOutcome(pool, write.completed.envelope, write.completed.request_id, write.completed.claim, row_error, false);
+                write.completed.error = row_error;
+            }
+            write.completed.finished_us = finished_us;
+            completed_queue.push(std::move(write.completed));
+        }
+    }
+}
+
+// The streamed LLM call blocks the worker, products of a stream are handed over as they complete
+// and the first one is logged to track time to first product.
+static void recognizeStreaming(Recognition &recognition)
+{
+    const auto llm_start_point = std::chrono::steady_clock::now();
+    bool is_first_product{true};
+    const auto on_product = [&](const nlohmann::json &)
+    {
+        if (is_first_product)
+        {
+            is_first_product = false;
+            LOG_INFO("first product of " + recognition.request_id + " after ms: " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - llm_start_point).count()));
+        }
+    };
+
+    TraceSpan span{recognition.trace_id, "llm"};
+    recognition.llm_ok = LlmRouter::getInstance().jsonTextImgStream(Prompts::prompt, recognition.image.mime_type, recognition.image.base64_string, Prompts::nutrition_schema, on_product, recognition.res_json, recognition.used_model);
+    if (recognition.llm_ok)
+    {
+        LOG_INFO("recognized " + recognition.request_id + " with " + recognition.used_model);
+        span.succeed();
+    }
+}
+
+static void workerLoop(sql::mysql::MySQL_Driver *driver, MysqlPool &pool, ResultCache &result_cache, std::shared_ptr<BlockingQueue<WorkItem>> work_queue, BlockingQueue<PendingWrite> &write_queue,
+                       BlockingQueue<CompletedItem> &completed_queue)
+{
+    driver->threadInit();
+    const auto scope_exit = makeScopeExit([&]()
+                                          { driver->threadEnd(); });
+
+    static const bool llm_streaming = Cfg::getInstance().getCfgBool("llm_streaming", false);
+    auto &busy_workers = Metrics::getInstance().gauge("requester_busy_workers", {}, "Workers processing a message");
+    auto &llm_in_flight = Metrics::getInstance().gauge("requester_llm_in_flight", {}, "Recognitions waiting for the LLM");
+
+    while (auto item = work_queue->pop())
+    {
+        LOG_INFO("PROCESSING");
+        busy_workers.add();
+
+        std::optional<MessageOutcome> outcome{};
+        auto recognition = item->recognition ? std::move(item->recognition) : std::make_shared<Recognition>();
+        try
+        {
+            if (recognition->llm_start_us)
+            {
+                outcome = finishRecognition(result_cache, *recognition);
+            }
+            else if (!prepareRecognition(pool, result_cache, item->envelope->Message()->Body(), *recognition))
+            {
+                outcome = MessageOutcome::Retry;
+            }
+            else if (recognition->not_claimed)
+            {
+                outcome = MessageOutcome::Drop;
+            }
+            else if (recognition->cache_hit)
+            {
+                outcome = finishRecognition(result_cache, *recognition);
+            }
+            else if (llm_streaming)
+            {
+                recognition->llm_start_us = TraceWriter::nowUs();
+                recognizeStreaming(*recognition);
+                outcome = finishRecognition(result_cache, *recognition);
+            }
+            else
+            {
+                // The worker is free as soon as the request is queued, the router picks the model from llm_policy,
+                // hedges a slow request and falls back on failure. The answer comes back through work_queue.
+                recognition->llm_start_us = TraceWriter::nowUs();
+                llm_in_flight.add();
+                // The image moves into a shared string, every hedge and fallback request sends that one copy.
+                auto base64_image = std::make_shared<const std::string>(std::move(recognition->image.base64_string));
+                LlmRouter::getInstance().jsonTextImgAsync(Prompts::prompt, recognition->image.mime_type, std::move(base64_image), Prompts::nutrition_schema,
+                                                          [work_queue, &llm_in_flight, envelope = item->envelope, consumed_ts = item->consumed_ts, recognition](bool ok, nlohmann::json &&res_json, std::string &&used_model)
+                                                          {
+                                                              llm_in_flight.sub();
+                                                              if (recognition->trace_id.size() && TraceWriter::getInstance().enabled())
+                                                              {
+                                                                  TraceWriter::getInstance().write(recognition->trace_id, "llm", recognition->llm_start_us, TraceWriter::nowUs() - recognition->llm_start_us, ok);
+                                                              }
+                                                              if (ok)
+                                                              {
+                                                                  LOG_INFO("recognized " + recognition->request_id + " with " + used_model);
+                                                              }
+                                                              recognition->llm_ok = ok;
+                                                              recognition->res_json = std::move(res_json);
+                                                              recognition->used_model = std::move(used_model);
+                                                              // Never blocks: the queue holds prefetch_count items and there are no more unacked messages.
+                                                              // The callback shares the queue, an answer that comes after shutdown closed it is
+                                                              // refused and its message is redelivered.
+                                                              work_queue->push(WorkItem{envelope, consumed_ts, recognition});
+                                                          });
+                recognition->image = MimeTypeAndBase64{};
+            }
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR(e.what());
+            recognition->error = e.what();
+            outcome = MessageOutcome::Retry;
+        }
+
+        if (outcome == MessageOutcome::Retry)
+        {
+            outcome = failureOutcome(pool, item->envelope, recognition->request_id, recognition->claim, recognition->error, recognition->permanent_error);
+        }
+        busy_workers.sub();
+        if (outcome == MessageOutcome::Ack)
+        {
+            write_queue.push(PendingWrite{CompletedItem{std::move(item->envelope), *outcome, std::move(recognition->request_id), std::move(recognition->claim), std::move(recognition->trace_id), item->consumed_ts, 0},
+                                          recognition->res_json.dump(), TraceWriter::nowUs()});
+        }
+        else if (outcome)
+        {
+            completed_queue.push(CompletedItem{std::move(item->envelope), *outcome, std::move(recognition->request_id), std::move(recognition->claim), std::move(recognition->trace_id),
+                                               item->consumed_ts, TraceWriter::nowUs(), std::move(recognition->error)});
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
     if (!Cfg::getInstance().loadFromEnv())
@@ -27,9 +821,63 @@ int main(int argc, char *argv[])
     const auto db_pass = Cfg::getInstance().getCfgValue("db_pass");
     const auto photos_folder_path = Cfg::getInstance().getCfgValue("photos_storage_absolute_path");
 
+    // Workers only run the database and file steps, buffered LLM calls wait on the AsyncHttpClient loop,
+    // so the prefetch is what bounds the calls in flight. A streamed call keeps its worker for the whole call,
+    // then the prefetch only leaves a message ready for each worker.
+    const bool llm_streaming = Cfg::getInstance().getCfgBool("llm_streaming", false);
+    const size_t workers_count = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("requester_workers", 1));
+    // BasicConsume takes a uint16_t prefetch and 0 means unlimited. A truncated value would drop the bound
+    // the queues below are sized on, so the prefetch is clamped to [workers_count, 65535].
+    constexpr size_t max_prefetch = std::numeric_limits<uint16_t>::max();
+    const size_t requested_prefetch = Cfg::getInstance().getCfgSizeT("requester_prefetch", llm_streaming ? workers_count * 2 : 64);
+    const size_t prefetch_count = std::min(max_prefetch, std::max(workers_count, requested_prefetch));
+    if (prefetch_count != requested_prefetch)
+    {
+        LOG_INFO("requester_prefetch " + std::to_string(requested_prefetch) + " clamped to " + std::to_string(prefetch_count));
+    }
+    LOG_INFO("workers=" + std::to_string(workers_count) + " prefetch=" + std::to_string(prefetch_count));
+
+    // Prometheus scrape endpoint, the requester has no HTTP server of its own. 0 disables it.
+    const size_t metrics_port = Cfg::getInstance().getCfgSizeT("requester_metrics_port", 9101);
+    MetricsHttpServer metrics_server{};
+    if (metrics_port && !metrics_server.start(static_cast<uint16_t>(metrics_port)))
+    {
+        LOG_ERROR("if(metrics_port && !metrics_server.start(static_cast<uint16_t>(metrics_port)))");
+    }
+
+    TraceWriter::getInstance().setService("ai_requester_service");
+
     sql::mysql::MySQL_Driver *driver{nullptr};
     driver = sql::mysql::get_mysql_driver_instance();
 
+    // One connection per worker, the writer, the sweeper and the outbox relay is enough, each of them holds at most one at a time.
+    const size_t db_connections = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("requester_db_connections", workers_count + 3));
+    MysqlPool pool{driver, "127.0.0.1:3306", db_user, db_pass, "dd", db_connections};
+    ResultCache result_cache{pool};
+
+    // The broker never has more than prefetch_count unacked deliveries, so none of the queues can fill up
+    // and the channel thread never blocks on push.
+    // Shared with the LLM callbacks, the AsyncHttpClient loop may still run one after main returned.
+    auto work_queue = std::make_shared<BlockingQueue<WorkItem>>(prefetch_count);
+    BlockingQueue<PendingWrite> write_queue{prefetch_count};
+    BlockingQueue<CompletedItem> completed_queue{prefetch_count};
+
+    std::vector<std::jthread> workers{};
+    for (size_t i = 0; i < workers_count; ++i)
+    {
+        workers.emplace_back(workerLoop, driver, std::ref(pool), std::ref(result_cache), work_queue, std::ref(write_queue), std::ref(completed_queue));
+    }
+    std::jthread writer{writerLoop, driver, std::ref(pool), std::ref(write_queue), std::ref(completed_queue)};
+    // Declared after the threads so it runs first: workers and the writer drain and exit, then the jthreads join.
+    const auto close_queues = makeScopeExit([&]()
+                                            {
+                                                work_queue->close();
+                                                write_queue.close();
+                                                completed_queue.close(); });
+    LeaseSweeper lease_sweeper{driver, pool, recognize_queue};
+    OutboxRelay outbox_relay{driver, pool, recognize_queue};
+    LOG_INFO("worker id: " + workerId());
+
     try
     {
         const std::string hostname = "localhost";
@@ -39,176 +887,212 @@ int main(int argc, char *argv[])
         const std::string vhost = "/";
 
         AmqpClient::Channel::ptr_t channel = AmqpClient::Channel::Create(hostname, port, username, password, vhost);
-        std::string consumer_tag = channel->BasicConsume("recognize_food", "", true, false, false, 1);
+        channel->DeclareExchange(results_exchange, AmqpClient::Channel::EXCHANGE_TYPE_FANOUT);
+        declareRetryQueues(*channel);
+        std::string consumer_tag = channel->BasicConsume(recognize_queue, "", true, false, false, static_cast<uint16_t>(prefetch_count));
 
-        while (true)
+        // The channel is not thread safe, only this thread talks to it. The timeout bounds how long
+        // a finished message waits for its ack.
+        constexpr int consume_timeout_ms = 10;
+        constexpr auto report_interval = std::chrono::seconds{10};
+        size_t processed_count{0};
+        auto report_ts = std::chrono::steady_clock::now();
+
+        // A stored message behind one that is still being processed can not be covered by a multiple ack.
+        // It waits at most requester_ack_hold_ms, or until half of the prefetch is held, then it is acked alone.
+        const int64_t ack_hold_us = static_cast<int64_t>(Cfg::getInstance().getCfgSizeT("requester_ack_hold_ms", 100)) * 1000;
+        const size_t max_held_acks = std::max<size_t>(1, prefetch_count / 2);
+
+        auto &metrics = Metrics::getInstance();
+        auto &consumed = metrics.counter("amqp_consumed_total", {}, "Messages delivered by the broker");
+        auto &acked_to = metrics.histogram("amqp_consume_to_ack_seconds", {{"outcome", "ack"}}, "Time from delivery to ack");
+        auto &retried_to = metrics.histogram("amqp_consume_to_ack_seconds", {{"outcome", "retry"}});
+        auto &dead_lettered_to = metrics.histogram("amqp_consume_to_ack_seconds", {{"outcome", "dead_letter"}});
+        auto &dropped_to = metrics.histogram("amqp_consume_to_ack_seconds", {{"outcome", "drop"}});
+        auto &retried = metrics.counter("requester_failed_messages_total", {{"outcome", "retry"}}, "Failed messages by where they were published");
+        auto &dead_lettered = metrics.counter("requester_failed_messages_total", {{"outcome", "dead_letter"}});
+        auto &queued = metrics.gauge("requester_work_queue_depth", {}, "Delivered messages waiting for a worker");
+        auto &unacked = metrics.gauge("requester_unacked_messages", {}, "Delivered messages not acked yet");
+        auto &multiple_acks = metrics.counter("amqp_acks_total", {{"multiple", "true"}}, "Ack frames sent to the broker");
+        auto &single_acks = metrics.counter("amqp_acks_total", {{"multiple", "false"}});
+        auto &acked_messages = metrics.counter("amqp_acked_messages_total", {}, "Messages acked, a multiple ack counts every message it covers");
+        auto &commits = metrics.counter("requester_db_commits_total", {}, "Result batches written to FoodRecognitions");
+        uint64_t report_commits{commits.value()};
+        uint64_t report_ack_frames{0};
+
+        // Delivery tag -> the finished message, empty while it is still processed. Tags grow with every delivery
+        // on the channel, so the finished run at the front is acked at once by the tag of its last message.
+        // A failed message is finished once its copy to a retry queue or dead_letter_queue is confirmed.
+        std::map<uint64_t, std::optional<CompletedItem>> unacked_messages{};
+        const auto record_ack = [&](const CompletedItem &completed)
         {
-            AmqpClient::Envelope::ptr_t envelope = channel->BasicConsumeMessage(consumer_tag);
-            if (envelope)
+            const auto consume_to_ack = std::chrono::steady_clock::now() - completed.consumed_ts;
+            if (completed.outcome == MessageOutcome::Ack)
             {
-                LOG_INFO("PROCESSING");
-                [&]()
+                acked_to.observe(consume_to_ack);
+                ++processed_count;
+            }
+            else if (completed.outcome == MessageOutcome::Retry)
+            {
+                retried_to.observe(consume_to_ack);
+            }
+            else if (completed.outcome == MessageOutcome::DeadLetter)
+            {
+                dead_lettered_to.observe(consume_to_ack);
+            }
+            else
+            {
+                dropped_to.observe(consume_to_ack);
+            }
+            acked_messages.add();
+            // Time a finished message waited for its ack, the wait for the messages in front of it included.
+            if (completed.trace_id.size() && TraceWriter::getInstance().enabled())
+            {
+                TraceWriter::getInstance().write(completed.trace_id, "ack", completed.finished_us, TraceWriter::nowUs() - completed.finished_us, completed.outcome == MessageOutcome::Ack);
+            }
+        };
+        const auto flush_acks = [&]()
+        {
+            std::optional<CompletedItem> last{};
+            while (!unacked_messages.empty() && unacked_messages.begin()->second)
+            {
+                last = std::move(unacked_messages.begin()->second);
+                record_ack(*last);
+                unacked_messages.erase(unacked_messages.begin());
+            }
+            if (last)
+            {
+                channel->BasicAck(last->envelope->GetDeliveryInfo(), true);
+                multiple_acks.add();
+            }
+
+            size_t held{0};
+            int64_t oldest_us{std::numeric_limits<int64_t>::max()};
+            for (const auto &[tag, completed] : unacked_messages)
+            {
+                if (completed)
+                {
+                    ++held;
+                    oldest_us = std::min(oldest_us, completed->finished_us);
+                }
+            }
+            if (!held || (held < max_held_acks && TraceWriter::nowUs() - oldest_us < ack_hold_us))
+            {
+                return;
+            }
+            for (auto it = unacked_messages.begin(); it != unacked_messages.end();)
+            {
+                if (!it->second)
                 {
-                    AmqpClient::BasicMessage::ptr_t message = envelope->Message();
-                    std::string body = message->Body();
+                    ++it;
+                    continue;
+                }
+                channel->BasicAck(it->second->envelope);
+                single_acks.add();
+                record_ack(*it->second);
+                it = unacked_messages.erase(it);
+            }
+        };
 
-                    if (!nlohmann::json::accept(body))
-                    {
-                        LOG_ERROR("if(!nlohmann::json::accept(body))");
-                        channel->BasicReject(envelope, true);
-                        return;
-                    }
-                    nlohmann::json obj = nlohmann::json::parse(body);
+        // A failed message is acked only after the broker confirmed its copy, until then it waits here and its
+        // delivery stays unacked. A broker that is gone keeps the original, which comes back on reconnect.
+        ConfirmedPublisher failed_publisher{std::chrono::milliseconds{Cfg::getInstance().getCfgSizeT("requester_failed_confirm_timeout_ms", 5000)}};
+        constexpr auto publish_retry_interval = std::chrono::seconds{1};
+        std::vector<CompletedItem> unpublished{};
+        auto publish_retry_ts = std::chrono::steady_clock::now();
+        const auto finish = [&](CompletedItem &&completed)
+        {
+            // The row is already committed as Done or Error, so a waiter that misses this still sees it on its next read.
+            if ((completed.outcome == MessageOutcome::Ack || completed.outcome == MessageOutcome::DeadLetter) && completed.request_id.size())
+            {
+                nlohmann::json notification{};
+                notification["FoodRecognitionID"] = completed.request_id;
+                notification["Status"] = completed.outcome == MessageOutcome::Ack ? FoodRecognitions::Status::Done : FoodRecognitions::Status::Error;
+                channel->BasicPublish(results_exchange, "", AmqpClient::BasicMessage::Create(notification.dump()));
+            }
+            const uint64_t delivery_tag = completed.envelope->DeliveryTag();
+            unacked_messages[delivery_tag] = std::move(completed);
+        };
 
-                    if (!obj.count("FoodRecognitionID") || !obj["FoodRecognitionID"].is_string())
-                    {
-                        LOG_ERROR("if(!obj.count(\"FoodRecognitionID\") || !obj[\"FoodRecognitionID\"].is_string())");
-                        channel->BasicReject(envelope, true);
-                        return;
-                    }
-                    const std::string req_id = obj["FoodRecognitionID"].get<std::string>();
+        while (true)
+        {
+            AmqpClient::Envelope::ptr_t envelope{};
+            if (channel->BasicConsumeMessage(consumer_tag, envelope, consume_timeout_ms) && envelope)
+            {
+                unacked_messages.emplace(envelope->DeliveryTag(), std::nullopt);
+                work_queue->push(WorkItem{envelope, std::chrono::steady_clock::now()});
+                consumed.add();
+            }
 
-                    try
+            while (auto completed = completed_queue.tryPop())
+            {
+                if (completed->outcome == MessageOutcome::Retry || completed->outcome == MessageOutcome::DeadLetter)
+                {
+                    unpublished.push_back(std::move(*completed));
+                }
+                else
+                {
+                    finish(std::move(*completed));
+                }
+            }
+            if (unpublished.size() && std::chrono::steady_clock::now() >= publish_retry_ts)
+            {
+                std::vector<ConfirmedPublisher::Message> copies{};
+                for (const auto &completed : unpublished)
+                {
+                    copies.push_back(failedCopyOf(completed));
+                }
+                try
+                {
+                    failed_publisher.publish(copies);
+                    for (auto &completed : unpublished)
                     {
-                        std::string image_path{};
-                        size_t rows_count{};
-
-                        {
-                            sql::PreparedStatement *pstmt{nullptr};
-                            sql::ResultSet *res{nullptr};
-                            sql::Connection *con{nullptr};
-
-                            const auto scope_exit = makeScopeExit(
-                                [&]()
-                                {
-                                    if (pstmt)
-                                        delete pstmt;
-                                    if (res)
-                                        delete res;
-                                    if (con)
-                                        delete con;
-                                });
-                            
-                            con = driver->connect("127.0.0.1:3306", db_user, db_pass);
-                            con->setSchema("dd");
-
-                            pstmt = con->prepareStatement("select ImagePath from FoodRecognitions where id = ?");
-                            pstmt->setString(1, req_id);
-                            res = pstmt->executeQuery();
-
-                            while (res->next())
-                            {
-                                ++rows_count;
-                                image_path = res->getString("ImagePath");
-                            }
-                        }
-
-                        if (rows_count == 0)
-                        {
-                            LOG_ERROR("if(image_path == 0)");
-                            channel->BasicReject(envelope, true);
-                            return;
-                        }
-
-                        if (image_path.empty())
-                        {
-                            LOG_ERROR("if(image_path.empty())");
-                            channel->BasicReject(envelope, true);
-                            return;
-                        }
-
-                        const auto mime_and_base64 = image_to_base64_data_uri(image_path);
-                        if (mime_and_base64.base64_string.empty() || mime_and_base64.mime_type.empty())
-                        {
-                            LOG_ERROR("if(mime_and_base64.base64_string.empty() || mime_and_base64.mime_type.empty())");
-                            channel->BasicReject(envelope, true);
-                            return;
-                        }
-
-                        nlohmann::json res_json{};
-                        if (!gemini::jsonTextImg("gemini-2.0-flash-exp", Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, res_json))
-                        {
-                            LOG_ERROR("if (!gemini::jsonTextImg(Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, res_json))");
-                            channel->BasicReject(envelope, true);
-                            return;
-                        }
-
-                        const auto get_float_smart = [](const nlohmann::json& obj, const std::string& key) -> std::optional<float>
-                        {
-                            float res{0.0f};
-                            if(obj.count(key) && obj[key].is_number_float())
-                            {
-                                res = obj[key].get<float>();
-                            }
-                            else if(obj.count(key) && obj[key].is_string())
-                            {
-                                res = stringToFloat(obj[key].get<std::string>());
-                            }
-                            else if(obj.count(key) && obj[key].is_number())
-                            {
-                                res = obj[key].get<int>();
-                            }
-                            else
-                            {
-                                return std::nullopt;
-                            }
-                            return res;
-                        };
-
-                        if(res_json.count("products") && res_json["products"].is_array())
-                        {
-                            for(auto& product : res_json["products"])
-                            {   
-                                auto carbs_opt = get_float_smart(product, "carbs");
-                                auto grams_opt = get_float_smart(product, "grams");
-
-                                if(grams_opt.value() <= 0.0001f || carbs_opt.value() <= 0.0001f)
-                                {
-                                    product["ratio"] = float{0};
-                                }
-                                else
-                                {
-                                    product["ratio"] = float{carbs_opt.value() / grams_opt.value() * 100.0f};
-                                }
-                            }
-                        }
-
-                        {
-                            sql::PreparedStatement *pstmt{nullptr};
-                            sql::ResultSet *res{nullptr};
-                            sql::Connection *con{nullptr};
-
-                            const auto scope_exit = makeScopeExit(
-                                [&]()
-                                {
-                                    if (pstmt)
-                                        delete pstmt;
-                                    if (res)
-                                        delete res;
-                                    if (con)
-                                        delete con;
-                                });
-                            
-                            con = driver->connect("127.0.0.1:3306", db_user, db_pass);
-                            con->setSchema("dd");
-
-                            pstmt = con->prepareStatement("update FoodRecognitions set Status = ?, ResultJson = ? where id = ?");
-                            pstmt->setString(1, FoodRecognitions::Status::Done);
-                            pstmt->setString(2, res_json.dump());
-                            pstmt->setString(3, req_id);
-                            res = pstmt->executeQuery();
-                            channel->BasicAck(envelope);
-                            return;
-                        }
+                        (completed.outcome == MessageOutcome::Retry ? retried : dead_lettered).add();
+                        finish(std::move(completed));
                     }
-                    catch (sql::SQLException &e)
+                    unpublished.clear();
+                }
+                catch (const std::exception &e)
+                {
+                    // A copy confirmed before the failure goes twice, the claim drops the duplicate.
+                    LOG_ERROR(std::string{"failed messages not published, trying again: "} + e.what());
+                    publish_retry_ts = std::chrono::steady_clock::now() + publish_retry_interval;
+                }
+            }
+            flush_acks();
+            queued.set(static_cast<int64_t>(work_queue->size()));
+            unacked.set(static_cast<int64_t>(unacked_messages.size()));
+
+            const auto now = std::chrono::steady_clock::now();
+            if (now - report_ts >= report_interval)
+            {
+                const uint64_t ack_frames = multiple_acks.value() + single_acks.value();
+                if (processed_count)
+                {
+                    const double seconds = std::chrono::duration<double>(now - report_ts).count();
+                    LOG_INFO("processed=" + std::to_string(processed_count) + " rate=" + std::to_string(processed_count / seconds) + "/s queued=" + std::to_string(work_queue->size()));
+                    LOG_INFOF("db commits/s: %.1f rows per commit: %.1f ack frames/s: %.1f messages per ack: %.1f", static_cast<double>(commits.value() - report_commits) / seconds,
+                              static_cast<double>(processed_count) / static_cast<double>(std::max<uint64_t>(1, commits.value() - report_commits)),
+                              static_cast<double>(ack_frames - report_ack_frames) / seconds,
+                              static_cast<double>(processed_count) / static_cast<double>(std::max<uint64_t>(1, ack_frames - report_ack_frames)));
+                    LOG_INFO("llm models: " + LlmRouter::getInstance().stats().dump());
+                    const auto &hedged = LlmRouter::timeToResult(true);
+                    const auto &unhedged = LlmRouter::timeToResult(false);
+                    LOG_INFOF("llm time to result p99 ms: unhedged %.1f (%llu) hedged %.1f (%llu)",
+                              static_cast<double>(unhedged.quantileMicroseconds(0.99)) / 1000.0, static_cast<unsigned long long>(unhedged.count()),
+                              static_cast<double>(hedged.quantileMicroseconds(0.99)) / 1000.0, static_cast<unsigned long long>(hedged.count()));
+                    if (result_cache.enabled())
                     {
-                        LOG_ERROR("SQLException: " + e.what());
-                        LOG_ERROR("SQLState: " + e.getSQLStateCStr());
-                        channel->BasicReject(envelope, true);
-                        return;
+                        const uint64_t lookups = result_cache.hits() + result_cache.misses();
+                        LOG_INFOF("result cache hits: %llu misses: %llu hit rate: %.3f saved llm s: %.1f", static_cast<unsigned long long>(result_cache.hits()),
+                                  static_cast<unsigned long long>(result_cache.misses()), lookups ? static_cast<double>(result_cache.hits()) / static_cast<double>(lookups) : 0.0,
+                                  static_cast<double>(result_cache.savedMs()) / 1000.0);
                     }
-                }();
+                }
+                processed_count = 0;
+                report_commits = commits.value();
+                report_ack_frames = ack_frames;
+                report_ts = now;
             }
         }
     }
@@ -219,4 +1103,4 @@ int main(int argc, char *argv[])
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <rabbitmq-c/amqp.h>
+#include <rabbitmq-c/tcp_socket.h>
+#include <chrono>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+#include "functions.hpp"
+
+// Publishes to the default exchange with publisher confirms: publish() returns once the broker took every
+// message of the call, so the caller may ack or delete its own copy after that. SimpleAmqpClient has no
+// publisher confirms, this talks to rabbitmq-c directly on a connection of its own. Not thread safe, each
+// thread that publishes keeps its own. A failed call closes the connection, the next one opens a new one.
+class ConfirmedPublisher
+{
+public:
+    struct Message
+    {
+        std::string routing_key{};
+        std::string body{};
+        // Strings and integers are all the requester sets.
+        std::map<std::string, std::variant<int64_t, std::string>> headers{};
+    };
+
+    inline explicit ConfirmedPublisher(std::chrono::milliseconds confirm_timeout) : _confirm_timeout(confirm_timeout)
+    {
+    }
+
+    inline ~ConfirmedPublisher()
+    {
+        disconnect();
+    }
+
+    ConfirmedPublisher(const ConfirmedPublisher &l) = delete;
+    ConfirmedPublisher(ConfirmedPublisher &&l) = delete;
+    ConfirmedPublisher &operator=(const ConfirmedPublisher &l) = delete;
+    ConfirmedPublisher &operator=(ConfirmedPublisher &&l) = delete;
+
+    // Publishes every message persistent, then waits until the broker confirmed all of them. Throws on a nack or a timeout.
+    inline void publish(const std::vector<Message> &messages)
+    {
+        try
+        {
+            if (!_conn)
+            {
+                connect();
+            }
+            publishConfirmed(messages);
+        }
+        catch (...)
+        {
+            disconnect();
+            throw;
+        }
+    }
+
+private:
+    inline void publishConfirmed(const std::vector<Message> &messages)
+    {
+        std::set<uint64_t> unconfirmed{};
+        for (const auto &message : messages)
+        {
+            amqp_basic_properties_t props{};
+            props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
+            props.content_type = amqp_cstring_bytes("application/json");
+            props.delivery_mode = AMQP_DELIVERY_PERSISTENT;
+
+            std::vector<amqp_table_entry_t> headers{};
+            for (const auto &[name, value] : message.headers)
+            {
+                amqp_table_entry_t entry{};
+                entry.key = amqp_cstring_bytes(name.c_str());
+                if (const auto *number = std::get_if<int64_t>(&value))
+                {
+                    entry.value.kind = AMQP_FIELD_KIND_I64;
+                    entry.value.value.i64 = *number;
+                }
+                else
+                {
+                    const auto &text = std::get<std::string>(value);
+                    entry.value.kind = AMQP_FIELD_KIND_UTF8;
+                    entry.value.value.bytes = amqp_bytes_t{text.size(), const_cast<char *>(text.data())};
+                }
+                headers.push_back(entry);
+            }
+            if (headers.size())
+            {
+                props._flags |= AMQP_BASIC_HEADERS_FLAG;
+                props.headers.num_entries = static_cast<int>(headers.size());
+                props.headers.entries = headers.data();
+            }
+
+            const int status = amqp_basic_publish(_conn, channel, amqp_empty_bytes, amqp_cstring_bytes(message.routing_key.c_str()), 0, 0, &props,
+                                                  amqp_bytes_t{message.body.size(), const_cast<char *>(message.body.data())});
+            if (status < 0)
+            {
+                throw std::runtime_error(std::string{"amqp_basic_publish: "} + amqp_error_string2(status));
+            }
+            unconfirmed.insert(++_delivery_tag);
+        }
+
+        const auto deadline = std::chrono::steady_clock::now() + _confirm_timeout;
+        while (unconfirmed.size())
+        {
+            const auto left_us = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left_us <= 0)
+            {
+                throw std::runtime_error("publisher confirms timed out, unconfirmed: " + std::to_string(unconfirmed.size()));
+            }
+            const timeval timeout{static_cast<time_t>(left_us / 1000000), static_cast<suseconds_t>(left_us % 1000000)};
+            amqp_publisher_confirm_t confirm{};
+            const amqp_rpc_reply_t reply = amqp_publisher_confirm_wait(_conn, &timeout, &confirm);
+            if (reply.reply_type != AMQP_RESPONSE_NORMAL)
+            {
+                throw std::runtime_error("amqp_publisher_confirm_wait: " + replyError(reply));
+            }
+            if (confirm.method.id != AMQP_BASIC_ACK_METHOD)
+            {
+                throw std::runtime_error("publish not confirmed, method: " + std::to_string(confirm.method.id));
+            }
+
+            const auto *ack = static_cast<const amqp_basic_ack_t *>(confirm.method.decoded);
+            if (ack->multiple)
+            {
+                unconfirmed.erase(unconfirmed.begin(), unconfirmed.upper_bound(ack->delivery_tag));
+            }
+            else
+            {
+                unconfirmed.erase(ack->delivery_tag);
+            }
+        }
+        amqp_maybe_release_buffers(_conn);
+    }
+
+    inline void connect()
+    {
+        _conn = amqp_new_connection();
+        _delivery_tag = 0;
+        amqp_socket_t *socket = amqp_tcp_socket_new(_conn);
+        if (!socket)
+        {
+            throw std::runtime_error("amqp_tcp_socket_new failed");
+        }
+        const int status = amqp_socket_open(socket, "localhost", 5672);
+        if (status != 0)
+        {
+            throw std::runtime_error(std::string{"amqp_socket_open: "} + amqp_error_string2(status));
+        }
+
+        const std::string user = Cfg::getInstance().getCfgValue("rabbitmq_user");
+        const std::string pass = Cfg::getInstance().getCfgValue("rabbitmq_pass");
+        checkReply(amqp_login(_conn, "/", AMQP_DEFAULT_MAX_CHANNELS, AMQP_DEFAULT_FRAME_SIZE, 0, AMQP_SASL_METHOD_PLAIN, user.c_str(), pass.c_str()), "amqp_login");
+        amqp_channel_open(_conn, channel);
+        checkReply(amqp_get_rpc_reply(_conn), "amqp_channel_open");
+        amqp_confirm_select(_conn, channel);
+        checkReply(amqp_get_rpc_reply(_conn), "amqp_confirm_select");
+    }
+
+    inline void disconnect()
+    {
+        if (!_conn)
+        {
+            return;
+        }
+        amqp_connection_close(_conn, AMQP_REPLY_SUCCESS);
+        amqp_destroy_connection(_conn);
+        _conn = nullptr;
+    }
+
+    static inline std::string replyError(const amqp_rpc_reply_t &reply)
+    {
+        if (reply.reply_type == AMQP_RESPONSE_LIBRARY_EXCEPTION)
+        {
+            return amqp_error_string2(reply.library_error);
+        }
+        return "reply type " + std::to_string(reply.reply_type) + " method " + std::to_string(reply.reply.id);
+    }
+
+    static inline void checkReply(const amqp_rpc_reply_t &reply, const std::string &what)
+    {
+        if (reply.reply_type != AMQP_RESPONSE_NORMAL)
+        {
+            throw std::runtime_error(what + ": " + replyError(reply));
+        }
+    }
+
+    static constexpr amqp_channel_t channel{1};
+
+    const std::chrono::milliseconds _confirm_timeout{5000};
+    amqp_connection_state_t _conn{nullptr};
+    uint64_t _delivery_tag{0};
+};
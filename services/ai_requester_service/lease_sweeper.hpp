@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "confirmed_publisher.hpp"
+#include "functions.hpp"
+#include "metrics.hpp"
+#include "mysql_pool.hpp"
+
+#include <mysql_driver.h>
+#include <cppconn/resultset.h>
+
+// Hands the rows of a requester that died back to the queue.
+// A delivery claims a row by setting it to Processing with its claim token in WorkerID and LeaseExpiresTS. Every
+// requester_sweep_interval_sec (30) the sweeper publishes up to requester_sweep_batch (100) rows with an expired lease
+// to recognize_food again and, once the broker confirmed them, sets them back to Waiting. A round that fails to publish
+// leaves its rows expired for the next one. Every requester sweeps: the update only takes rows that are still
+// expired, and a message for a row someone claimed in the meantime is dropped on claim.
+// Each round also reports the age of the unfinished rows, which is how long users are waiting right now.
+class LeaseSweeper
+{
+public:
+    inline LeaseSweeper(sql::mysql::MySQL_Driver *driver, MysqlPool &pool, std::string queue) : _driver(driver), _pool(pool), _queue(std::move(queue))
+    {
+        _interval = std::chrono::seconds{std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("requester_sweep_interval_sec", 30))};
+        _batch = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("requester_sweep_batch", 100));
+        _thread = std::thread([this]()
+                              { sweepLoop(); });
+    }
+
+    inline ~LeaseSweeper()
+    {
+        {
+            std::lock_guard lock{_mut};
+            _stop = true;
+        }
+        _cv.notify_all();
+        if (_thread.joinable())
+        {
+            _thread.join();
+        }
+    }
+
+    LeaseSweeper(const LeaseSweeper &l) = delete;
+    LeaseSweeper(LeaseSweeper &&l) = delete;
+    LeaseSweeper &operator=(const LeaseSweeper &l) = delete;
+    LeaseSweeper &operator=(LeaseSweeper &&l) = delete;
+
+private:
+    inline void sweepLoop()
+    {
+        _driver->threadInit();
+        const auto scope_exit = makeScopeExit([&]()
+                                              { _driver->threadEnd(); });
+
+        std::unique_lock lock{_mut};
+        while (!_cv.wait_for(lock, _interval, [&]()
+                             { return _stop; }))
+        {
+            lock.unlock();
+            try
+            {
+                // A full batch means there may be more, the next batch goes right away.
+                while (sweep() == _batch)
+                {
+                }
+                reportAges();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR(std::string{"lease sweep failed: "} + e.what());
+            }
+            lock.lock();
+        }
+    }
+
+    // Requeues one batch of expired leases, returns how many rows were selected.
+    inline size_t sweep()
+    {
+        static const std::string select_query = "select id from FoodRecognitions where Status = ? and LeaseExpiresTS < now() order by LeaseExpiresTS limit ?";
+
+        std::vector<std::string> ids{};
+        {
+            auto select_call = Metrics::getInstance().call("db_query", {{"query", select_query}});
+            _pool.run([&](MysqlPool::Lease &lease)
+                      {
+                          auto &pstmt = lease.prepare(select_query);
+                          pstmt.setString(1, FoodRecognitions::Status::Processing);
+                          pstmt.setUInt64(2, _batch);
+                          std::unique_ptr<sql::ResultSet> rows{pstmt.executeQuery()};
+
+                          ids.clear();
+                          while (rows->next())
+                          {
+                              ids.push_back(rows->getString("id"));
+                          } });
+            select_call.succeed();
+        }
+        if (ids.empty())
+        {
+            return 0;
+        }
+
+        // Published first: the claim takes an expired row as it is, while a row set to Waiting without its
+        // message would wait for good. A row another sweeper took in between is published twice, the second
+        // message finds it claimed.
+        std::vector<ConfirmedPublisher::Message> messages{};
+        for (const auto &id : ids)
+        {
+            nlohmann::json message{};
+            message["FoodRecognitionID"] = id;
+            messages.push_back(ConfirmedPublisher::Message{_queue, message.dump()});
+        }
+        _publisher.publish(messages);
+
+        // Padded so a handful of statements cover every batch size, see MysqlPool::paddedCount.
+        const size_t padded = MysqlPool::paddedCount(ids.size());
+        const std::string update_query = "update FoodRecognitions set Status = ?, LeaseExpiresTS = null where Status = ? and LeaseExpiresTS < now() and id in (" + MysqlPool::placeholders(padded) + ")";
+        {
+            auto update_call = Metrics::getInstance().call("db_query", {{"query", "requeue expired leases"}});
+            _pool.run([&](MysqlPool::Lease &lease)
+                      {
+                          auto &pstmt = lease.prepare(update_query);
+                          int index{1};
+                          pstmt.setString(index++, FoodRecognitions::Status::Waiting);
+                          pstmt.setString(index++, FoodRecognitions::Status::Processing);
+                          for (size_t i = 0; i < padded; ++i)
+                          {
+                              pstmt.setString(index++, ids[std::min(i, ids.size() - 1)]);
+                          }
+                          pstmt.executeUpdate(); });
+            update_call.succeed();
+        }
+        _requeued.add(ids.size());
+        LOG_INFO("requeued expired leases: " + std::to_string(ids.size()));
+        return ids.size();
+    }
+
+    // The count, max and percentiles are computed by MySQL, one row comes back however long the backlog is.
+    // A quantile q is the smallest age whose cume_dist over the ages is at least q.
+    inline void reportAges()
+    {
+        static const std::string select_query =
+            "select count(*) as Pending, coalesce(max(Age), 0) as AgeMax, "
+            "coalesce(min(case when Dist >= 0.5 then Age end), 0) as AgeP50, "
+            "coalesce(min(case when Dist >= 0.9 then Age end), 0) as AgeP90, "
+            "coalesce(min(case when Dist >= 0.99 then Age end), 0) as AgeP99 "
+            "from (select timestampdiff(second, CreateTS, now()) as Age, cume_dist() over (order by CreateTS desc) as Dist "
+            "from FoodRecognitions where Status in (?, ?)) as Ages";
+
+        uint64_t pending{0};
+        uint64_t age_p50{0};
+        uint64_t age_p90{0};
+        uint64_t age_p99{0};
+        uint64_t age_max{0};
+        auto select_call = Metrics::getInstance().call("db_query", {{"query", "unfinished ages"}});
+        _pool.run([&](MysqlPool::Lease &lease)
+                  {
+                      auto &pstmt = lease.prepare(select_query);
+                      pstmt.setString(1, FoodRecognitions::Status::Waiting);
+                      pstmt.setString(2, FoodRecognitions::Status::Processing);
+                      std::unique_ptr<sql::ResultSet> rows{pstmt.executeQuery()};
+                      if (rows->next())
+                      {
+                          pending = rows->getUInt64("Pending");
+                          age_p50 = rows->getUInt64("AgeP50");
+                          age_p90 = rows->getUInt64("AgeP90");
+                          age_p99 = rows->getUInt64("AgeP99");
+                          age_max = rows->getUInt64("AgeMax");
+                      } });
+        select_call.succeed();
+
+        _pending.set(static_cast<int64_t>(pending));
+        _age_p50.set(static_cast<int64_t>(age_p50));
+        _age_p90.set(static_cast<int64_t>(age_p90));
+        _age_p99.set(static_cast<int64_t>(age_p99));
+        _age_max.set(static_cast<int64_t>(age_max));
+        if (pending)
+        {
+            LOG_INFOF("unfinished recognitions: %llu age s p50: %llu p90: %llu p99: %llu max: %llu", static_cast<unsigned long long>(pending), static_cast<unsigned long long>(age_p50),
+                      static_cast<unsigned long long>(age_p90), static_cast<unsigned long long>(age_p99), static_cast<unsigned long long>(age_max));
+        }
+    }
+
+    sql::mysql::MySQL_Driver *_driver{nullptr};
+    MysqlPool &_pool;
+    const std::string _queue{};
+    std::chrono::seconds _interval{30};
+    size_t _batch{100};
+    // Only the sweep thread publishes, the consumer channel belongs to the main thread.
+    ConfirmedPublisher _publisher{std::chrono::milliseconds{Cfg::getInstance().getCfgSizeT("requester_sweep_confirm_timeout_ms", 5000)}};
+
+    Metrics::Counter &_requeued{Metrics::getInstance().counter("requester_swept_leases_total", {}, "Rows with an expired lease sent back to recognize_food")};
+    Metrics::Gauge &_pending{Metrics::getInstance().gauge("requester_unfinished_recognitions", {}, "Rows in Waiting or Processing")};
+    Metrics::Gauge &_age_p50{Metrics::getInstance().gauge("requester_unfinished_age_seconds", {{"quantile", "0.5"}}, "Age of the rows in Waiting or Processing")};
+    Metrics::Gauge &_age_p90{Metrics::getInstance().gauge("requester_unfinished_age_seconds", {{"quantile", "0.9"}})};
+    Metrics::Gauge &_age_p99{Metrics::getInstance().gauge("requester_unfinished_age_seconds", {{"quantile", "0.99"}})};
+    Metrics::Gauge &_age_max{Metrics::getInstance().gauge("requester_unfinished_age_seconds", {{"quantile", "1"}})};
+
+    std::mutex _mut{};
+    std::condition_variable _cv{};
+    bool _stop{false};
+    std::thread _thread{};
+};
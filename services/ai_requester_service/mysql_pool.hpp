@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "functions.hpp"
+
+#include <mysql_driver.h>
+#include <mysql_connection.h>
+#include <cppconn/exception.h>
+#include <cppconn/prepared_statement.h>
+
+// Small pool of long lived MySQL connections for the requester workers.
+// Each connection keeps its prepared statements, so a message costs neither a handshake nor a prepare.
+// A connection that sat idle for a while is checked with isValid() before it is handed out,
+// a connection that failed with a connection level error is dropped and run() retries once on a fresh one.
+// A connection keeps at most requester_db_statements_per_connection (64) statements, the least recently used one
+// is closed first. MySQL allows max_prepared_stmt_count (16382) statements per server across all connections.
+class MysqlPool
+{
+private:
+    struct CachedStatement
+    {
+        std::unique_ptr<sql::PreparedStatement> statement{};
+        uint64_t last_used{0};
+    };
+
+    struct PooledConnection
+    {
+        std::unique_ptr<sql::Connection> connection{};
+        std::unordered_map<std::string, CachedStatement> statements{};
+        uint64_t statements_tick{0};
+        std::chrono::steady_clock::time_point last_used{};
+    };
+
+public:
+    class Lease
+    {
+    public:
+        Lease(MysqlPool &pool, std::unique_ptr<PooledConnection> con) : _pool(pool), _con(std::move(con)) {}
+
+        Lease(const Lease &l) = delete;
+        Lease(Lease &&l) = delete;
+        Lease &operator=(const Lease &l) = delete;
+        Lease &operator=(Lease &&l) = delete;
+
+        ~Lease()
+        {
+            _pool.release(std::move(_con), _broken);
+        }
+
+        // Cached per connection, parameters of the previous use are cleared.
+        inline sql::PreparedStatement &prepare(const std::string &query)
+        {
+            auto &statements = _con->statements;
+            auto it = statements.find(query);
+            if (it == statements.end())
+            {
+                if (statements.size() >= _pool._max_statements)
+                {
+                    statements.erase(std::min_element(statements.begin(), statements.end(), [](const auto &a, const auto &b)
+                                                      { return a.second.last_used < b.second.last_used; }));
+                }
+                std::unique_ptr<sql::PreparedStatement> stmt{_con->connection->prepareStatement(query)};
+                it = statements.emplace(query, CachedStatement{std::move(stmt), 0}).first;
+            }
+            else
+            {
+                it->second.statement->clearParameters();
+            }
+            it->second.last_used = ++_con->statements_tick;
+            return *it->second.statement;
+        }
+
+        inline sql::Connection &connection()
+        {
+            return *_con->connection;
+        }
+
+        inline void markBroken()
+        {
+            _broken = true;
+        }
+
+    private:
+        MysqlPool &_pool;
+        std::unique_ptr<PooledConnection> _con{};
+        bool _broken{false};
+    };
+
+    MysqlPool(sql::mysql::MySQL_Driver *driver, std::string host, std::string user, std::string pass, std::string schema, size_t max_connections)
+        : _driver(driver), _host(std::move(host)), _user(std::move(user)), _pass(std::move(pass)), _schema(std::move(schema)), _max_connections(std::max<size_t>(1, max_connections))
+    {
+        _validate_after = std::chrono::seconds{Cfg::getInstance().getCfgSizeT("requester_db_validate_after_sec", 30)};
+        _max_statements = std::max<size_t>(4, Cfg::getInstance().getCfgSizeT("requester_db_statements_per_connection", 64));
+    }
+
+    MysqlPool(const MysqlPool &l) = delete;
+    MysqlPool(MysqlPool &&l) = delete;
+    MysqlPool &operator=(const MysqlPool &l) = delete;
+    MysqlPool &operator=(MysqlPool &&l) = delete;
+
+    // Blocks while all connections are leased.
+    inline std::unique_ptr<Lease> acquire()
+    {
+        std::unique_ptr<PooledConnection> con{};
+        {
+            std::unique_lock lock{_mut};
+            _released.wait(lock, [&]()
+                           { return !_idle.empty() || _opened < _max_connections; });
+
+            if (!_idle.empty())
+            {
+                con = std::move(_idle.back());
+                _idle.pop_back();
+            }
+            else
+            {
+                ++_opened;
+            }
+        }
+
+        try
+        {
+            if (con && std::chrono::steady_clock::now() - con->last_used > _validate_after && !con->connection->isValid())
+            {
+                LOG_ERROR("if(!con->connection->isValid())");
+                con.reset();
+            }
+
+            if (!con)
+            {
+                con = open();
+            }
+        }
+        catch (...)
+        {
+            release(nullptr, true);
+            throw;
+        }
+
+        return std::make_unique<Lease>(*this, std::move(con));
+    }
+
+    // Length an IN list of count values is padded to, by repeating its last value. Lists then come in a few
+    // lengths and so do the statement texts built from them.
+    static inline size_t paddedCount(size_t count)
+    {
+        size_t res{1};
+        while (res < count)
+        {
+            res *= 2;
+        }
+        return res;
+    }
+
+    // "?, ?, ..." with count placeholders.
+    static inline std::string placeholders(size_t count)
+    {
+        std::string res{};
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i)
+            {
+                res += ", ";
+            }
+            res += "?";
+        }
+        return res;
+    }
+
+    // Runs f(Lease&) and retries once on a new connection when the old one was lost.
+    template <typename F>
+    inline auto run(F &&f)
+    {
+        for (int attempt = 0;; ++attempt)
+        {
+            auto lease = acquire();
+            try
+            {
+                return f(*lease);
+            }
+            catch (sql::SQLException &e)
+            {
+                if (!isConnectionError(e))
+                {
+                    throw;
+                }
+
+                lease->markBroken();
+                if (attempt > 0)
+                {
+                    throw;
+                }
+                LOG_ERROR("reconnecting after SQLException: " + e.what());
+            }
+        }
+    }
+
+    static inline bool isConnectionError(const sql::SQLException &e)
+    {
+        // CR_SERVER_GONE_ERROR, CR_SERVER_LOST, CR_SERVER_LOST_EXTENDED
+        const int code = e.getErrorCode();
+        return code == 2006 || code == 2013 || code == 2055;
+    }
+
+private:
+
+    inline std::unique_ptr<PooledConnection> open()
+    {
+        auto con = std::make_unique<PooledConnection>();
+        con->connection.reset(_driver->connect(_host, _user, _pass));
+        con->connection->setSchema(_schema);
+        return con;
+    }
+
+    inline void release(std::unique_ptr<PooledConnection> con, bool broken)
+    {
+        {
+            std::lock_guard lock{_mut};
+            if (!con || broken)
+            {
+                --_opened;
+            }
+            else
+            {
+                con->last_used = std::chrono::steady_clock::now();
+                _idle.push_back(std::move(con));
+            }
+        }
+        _released.notify_one();
+        // A broken connection is closed here, outside of the lock.
+    }
+
+    sql::mysql::MySQL_Driver *_driver{nullptr};
+    const std::string _host;
+    const std::string _user;
+    const std::string _pass;
+    const std::string _schema;
+    const size_t _max_connections;
+    std::chrono::steady_clock::duration _validate_after{};
+    size_t _max_statements{64};
+
+    std::mutex _mut{};
+    std::condition_variable _released{};
+    std::vector<std::unique_ptr<PooledConnection>> _idle{};
+    size_t _opened{0};
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "confirmed_publisher.hpp"
+#include "functions.hpp"
+#include "metrics.hpp"
+#include "mysql_pool.hpp"
+
+#include <mysql_driver.h>
+#include <cppconn/resultset.h>
+
+// Publishes the recognition jobs the web servers leave in RecognitionOutbox (mysql/RecognitionOutbox.sql).
+// The outbox row commits in the same transaction as its FoodRecognitions row, so a job is never lost and
+// the HTTP path never waits on RabbitMQ. Each round claims up to requester_outbox_batch (100) rows in a short
+// transaction (for update skip locked, then ClaimedUntilTS), publishes them, waits for the publisher confirms of
+// the whole batch and deletes the rows. Neither a row lock nor a pool connection is held during the confirm round.
+// Several requesters relay at once without taking each other's rows. A round that fails gives its rows back and
+// they go again, a duplicate finds the row claimed by the first delivery and is dropped. An empty outbox is
+// polled less and less often.
+class OutboxRelay
+{
+public:
+    inline OutboxRelay(sql::mysql::MySQL_Driver *driver, MysqlPool &pool, std::string queue) : _driver(driver), _pool(pool), _queue(std::move(queue))
+    {
+        _batch = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("requester_outbox_batch", 100));
+        _min_poll_interval = std::chrono::milliseconds{std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("requester_outbox_poll_ms", 200))};
+        _max_poll_interval = std::max(_min_poll_interval, std::chrono::milliseconds{Cfg::getInstance().getCfgSizeT("requester_outbox_max_poll_ms", 2000)});
+        _confirm_timeout = std::chrono::milliseconds{Cfg::getInstance().getCfgSizeT("requester_outbox_confirm_timeout_ms", 5000)};
+        // The claim has to outlive a whole confirm round, or a second relay publishes the rows again while they wait.
+        const size_t min_claim_sec = static_cast<size_t>(std::chrono::ceil<std::chrono::seconds>(_confirm_timeout).count()) * 2 + 1;
+        _claim_sec = std::max(min_claim_sec, Cfg::getInstance().getCfgSizeT("requester_outbox_claim_sec", 30));
+        _publisher = std::make_unique<ConfirmedPublisher>(_confirm_timeout);
+        _thread = std::thread([this]()
+                              { relayLoop(); });
+    }
+
+    inline ~OutboxRelay()
+    {
+        {
+            std::lock_guard lock{_mut};
+            _stop = true;
+        }
+        _cv.notify_all();
+        if (_thread.joinable())
+        {
+            _thread.join();
+        }
+    }
+
+    OutboxRelay(const OutboxRelay &l) = delete;
+    OutboxRelay(OutboxRelay &&l) = delete;
+    OutboxRelay &operator=(const OutboxRelay &l) = delete;
+    OutboxRelay &operator=(OutboxRelay &&l) = delete;
+
+private:
+    struct Row
+    {
+        std::string id{};
+        std::string request_id{};
+        std::string trace_id{};
+        int64_t enqueued_us{0};
+    };
+
+    inline void relayLoop()
+    {
+        _driver->threadInit();
+        const auto scope_exit = makeScopeExit([&]()
+                                              { _driver->threadEnd(); });
+
+        auto poll_interval = _min_poll_interval;
+        std::unique_lock lock{_mut};
+        while (!_stop)
+        {
+            lock.unlock();
+            size_t relayed{0};
+            try
+            {
+                relayed = relayBatch();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR(std::string{"outbox relay failed: "} + e.what());
+            }
+            lock.lock();
+
+            // A full batch means there are more rows, the next round goes right away.
+            // An empty outbox doubles the wait up to requester_outbox_max_poll_ms, any row resets it.
+            if (relayed)
+            {
+                poll_interval = _min_poll_interval;
+            }
+            if (relayed < _batch)
+            {
+                _cv.wait_for(lock, poll_interval, [&]()
+                             { return _stop; });
+                if (!relayed)
+                {
+                    poll_interval = std::min(poll_interval * 2, _max_poll_interval);
+                }
+            }
+        }
+    }
+
+    // Claims a batch, publishes it, waits for its confirms and deletes it. Returns the rows relayed.
+    // Only the claim is a transaction, the rows stay locked for two statements and not for the confirm round.
+    inline size_t relayBatch()
+    {
+        std::vector<Row> rows = claimBatch();
+        if (rows.empty())
+        {
+            return 0;
+        }
+
+        // Outside of pool.run: a connection lost later must not publish the batch a second time.
+        try
+        {
+            publishConfirmed(rows);
+        }
+        catch (...)
+        {
+            releaseClaim(rows);
+            throw;
+        }
+
+        // A lost connection retries the delete alone, a row that was already deleted is not there any more.
+        const std::string delete_query = "delete from RecognitionOutbox where ID in " + idList(rows.size());
+        _pool.run([&](MysqlPool::Lease &lease)
+                  {
+                      auto &delete_pstmt = lease.prepare(delete_query);
+                      setIds(delete_pstmt, 1, rows);
+                      delete_pstmt.executeUpdate(); });
+
+        _relayed.add(rows.size());
+        return rows.size();
+    }
+
+    // Locks up to _batch unclaimed rows with skip locked, sets their ClaimedUntilTS and commits.
+    // A relay that dies after the claim leaves the rows to whoever claims them once the claim ran out.
+    inline std::vector<Row> claimBatch()
+    {
+        static const std::string select_query = "select ID, FoodRecognitionID, TraceID, EnqueuedUs from RecognitionOutbox "
+                                                "where ClaimedUntilTS is null or ClaimedUntilTS < now() order by ID limit ? for update skip locked";
+
+        std::vector<Row> rows{};
+        _pool.run([&](MysqlPool::Lease &lease)
+                  {
+                      auto &connection = lease.connection();
+                      connection.setAutoCommit(false);
+                      try
+                      {
+                          auto &select_pstmt = lease.prepare(select_query);
+                          select_pstmt.setUInt64(1, _batch);
+                          std::unique_ptr<sql::ResultSet> res{select_pstmt.executeQuery()};
+
+                          rows.clear();
+                          while (res->next())
+                          {
+                              rows.push_back(Row{res->getString("ID"), res->getString("FoodRecognitionID"), res->getString("TraceID"), res->getInt64("EnqueuedUs")});
+                          }
+
+                          if (rows.size())
+                          {
+                              auto &claim_pstmt = lease.prepare("update RecognitionOutbox set ClaimedUntilTS = now() + interval ? second where ID in " + idList(rows.size()));
+                              claim_pstmt.setUInt64(1, _claim_sec);
+                              setIds(claim_pstmt, 2, rows);
+                              claim_pstmt.executeUpdate();
+                          }
+                          connection.commit();
+                          connection.setAutoCommit(true);
+                      }
+                      catch (...)
+                      {
+                          try
+                          {
+                              connection.rollback();
+                              connection.setAutoCommit(true);
+                          }
+                          catch (const sql::SQLException &e)
+                          {
+                              LOG_ERROR(std::string{"outbox rollback failed: "} + e.what());
+                              lease.markBroken();
+                          }
+                          throw;
+                      } });
+        return rows;
+    }
+
+    // Gives the rows of a failed round back right away instead of waiting for the claim to run out.
+    inline void releaseClaim(const std::vector<Row> &rows)
+    {
+        try
+        {
+            const std::string release_query = "update RecognitionOutbox set ClaimedUntilTS = null where ID in " + idList(rows.size());
+            _pool.run([&](MysqlPool::Lease &lease)
+                      {
+                          auto &pstmt = lease.prepare(release_query);
+                          setIds(pstmt, 1, rows);
+                          pstmt.executeUpdate(); });
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR(std::string{"outbox release failed, rows wait for their claim to run out: "} + e.what());
+        }
+    }
+
+    // "(?, ?, ...)" padded to MysqlPool::paddedCount, setIds fills it from the index of its first placeholder.
+    static inline std::string idList(size_t count)
+    {
+        return "(" + MysqlPool::placeholders(MysqlPool::paddedCount(count)) + ")";
+    }
+
+    static inline void setIds(sql::PreparedStatement &pstmt, int index, const std::vector<Row> &rows)
+    {
+        const size_t padded = MysqlPool::paddedCount(rows.size());
+        for (size_t i = 0; i < padded; ++i)
+        {
+            pstmt.setString(index++, rows[std::min(i, rows.size() - 1)].id);
+        }
+    }
+
+    // Publishes every row, then waits until the broker confirmed all of them. Throws on a nack or a timeout.
+    inline void publishConfirmed(const std::vector<Row> &rows)
+    {
+        const auto start_point = std::chrono::steady_clock::now();
+
+        std::vector<ConfirmedPublisher::Message> messages{};
+        for (const auto &row : rows)
+        {
+            nlohmann::json message{};
+            message["FoodRecognitionID"] = row.request_id;
+            if (row.trace_id.size())
+            {
+                message["TraceID"] = row.trace_id;
+                message["EnqueuedUs"] = row.enqueued_us;
+            }
+            messages.push_back(ConfirmedPublisher::Message{_queue, message.dump()});
+        }
+        _publisher->publish(messages);
+        _confirm_round.observe(std::chrono::steady_clock::now() - start_point);
+    }
+
+    sql::mysql::MySQL_Driver *_driver{nullptr};
+    MysqlPool &_pool;
+    const std::string _queue{};
+    size_t _batch{100};
+    std::chrono::milliseconds _min_poll_interval{200};
+    std::chrono::milliseconds _max_poll_interval{2000};
+    std::chrono::milliseconds _confirm_timeout{5000};
+    size_t _claim_sec{30};
+    // Only the relay thread publishes.
+    std::unique_ptr<ConfirmedPublisher> _publisher{};
+
+    Metrics::Counter &_relayed{Metrics::getInstance().counter("outbox_relayed_total", {}, "Outbox rows published to recognize_food")};
+    Metrics::Histogram &_confirm_round{Metrics::getInstance().histogram("outbox_confirm_round_seconds", {}, "Time to publish one outbox batch and get all its confirms")};
+
+    std::mutex _mut{};
+    std::condition_variable _cv{};
+    bool _stop{false};
+    std::thread _thread{};
+};
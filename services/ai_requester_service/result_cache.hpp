@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include "functions.hpp"
+#include "llm_router.hpp"
+#include "metrics.hpp"
+#include "mysql_pool.hpp"
+
+#include <cppconn/resultset.h>
+
+// Earlier recognitions keyed by image content, so a re-uploaded photo skips the LLM call.
+// Rows live in ResultCache (mysql/ResultCache.sql) under the SHA-256 of the base64 image, the prompt version
+// and the model that answered. A row only counts while the router would still use its model, the best ranked
+// one wins. "result_cache" (true by default) switches it off. A lookup or store that fails, e.g. because the
+// table is missing, is logged and counts as a miss, recognitions never depend on the cache.
+class ResultCache
+{
+public:
+    struct Entry
+    {
+        std::string model{};
+        nlohmann::json res_json{};
+        uint64_t llm_ms{0};
+    };
+
+    explicit ResultCache(MysqlPool &pool) : _pool(pool)
+    {
+        _enabled = Cfg::getInstance().getCfgBool("result_cache", true);
+    }
+
+    ResultCache(const ResultCache &l) = delete;
+    ResultCache(ResultCache &&l) = delete;
+    ResultCache &operator=(const ResultCache &l) = delete;
+    ResultCache &operator=(ResultCache &&l) = delete;
+
+    inline bool enabled() const
+    {
+        return _enabled;
+    }
+
+    // The base64 text is a function of the bytes, hashing it saves decoding the image again.
+    static inline std::string imageHashOf(const std::string &base64_string)
+    {
+        return sha256Hex(base64_string);
+    }
+
+    // Changes whenever the prompt or the schema does, so old answers are not served for a new question.
+    static inline const std::string &promptVersion()
+    {
+        static const std::string version = sha256Hex(Prompts::prompt + Prompts::nutrition_schema.dump()).substr(0, 16);
+        return version;
+    }
+
+    inline std::optional<Entry> find(const std::string &image_hash)
+    {
+        static const std::string select_query = "select Model, ResultJson, LlmMs from ResultCache where ImageHash = ? and PromptVersion = ?";
+
+        std::optional<Entry> res{};
+        try
+        {
+            std::vector<Entry> entries{};
+            auto select_call = Metrics::getInstance().call("db_query", {{"query", select_query}});
+            _pool.run([&](MysqlPool::Lease &lease)
+                      {
+                          auto &pstmt = lease.prepare(select_query);
+                          pstmt.setString(1, image_hash);
+                          pstmt.setString(2, promptVersion());
+                          std::unique_ptr<sql::ResultSet> rows{pstmt.executeQuery()};
+
+                          entries.clear();
+                          while (rows->next())
+                          {
+                              Entry entry{};
+                              entry.model = rows->getString("Model");
+                              entry.llm_ms = rows->getUInt64("LlmMs");
+                              if (parseJson(std::string{rows->getString("ResultJson")}, entry.res_json))
+                              {
+                                  entries.push_back(std::move(entry));
+                              }
+                          } });
+            select_call.succeed();
+
+            for (const auto &info : LlmRouter::getInstance().ranking())
+            {
+                const auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry &entry)
+                                             { return entry.model == info.model; });
+                if (it != entries.end())
+                {
+                    res = std::move(*it);
+                    break;
+                }
+            }
+        }
+        catch (sql::SQLException &e)
+        {
+            LOG_ERROR("result cache lookup failed: " + e.what());
+            _errors.add();
+            return std::nullopt;
+        }
+
+        if (res)
+        {
+            _hits.add();
+            _saved_ms.add(res->llm_ms);
+        }
+        else
+        {
+            _misses.add();
+        }
+        return res;
+    }
+
+    inline void store(const std::string &image_hash, const std::string &model, const nlohmann::json &res_json, uint64_t llm_ms)
+    {
+        static const std::string insert_query = "insert into ResultCache (ImageHash, PromptVersion, Model, ResultJson, LlmMs) values (?, ?, ?, ?, ?) "
+                                                "on duplicate key update ResultJson = values(ResultJson), LlmMs = values(LlmMs)";
+        try
+        {
+            auto insert_call = Metrics::getInstance().call("db_query", {{"query", insert_query}});
+            _pool.run([&](MysqlPool::Lease &lease)
+                      {
+                          auto &pstmt = lease.prepare(insert_query);
+                          pstmt.setString(1, image_hash);
+                          pstmt.setString(2, promptVersion());
+                          pstmt.setString(3, model);
+                          pstmt.setString(4, res_json.dump());
+                          pstmt.setUInt64(5, llm_ms);
+                          pstmt.executeUpdate(); });
+            insert_call.succeed();
+        }
+        catch (sql::SQLException &e)
+        {
+            LOG_ERROR("result cache store failed: " + e.what());
+            _errors.add();
+        }
+    }
+
+    // Totals since start for the periodic report.
+    inline uint64_t hits() const
+    {
+        return _hits.value();
+    }
+
+    inline uint64_t misses() const
+    {
+        return _misses.value();
+    }
+
+    inline uint64_t savedMs() const
+    {
+        return _saved_ms.value();
+    }
+
+private:
+    MysqlPool &_pool;
+    bool _enabled{true};
+    Metrics::Counter &_hits{Metrics::getInstance().counter("result_cache_lookups_total", {{"result", "hit"}}, "Result cache lookups by outcome")};
+    Metrics::Counter &_misses{Metrics::getInstance().counter("result_cache_lookups_total", {{"result", "miss"}})};
+    Metrics::Counter &_errors{Metrics::getInstance().counter("result_cache_lookups_total", {{"result", "error"}})};
+    Metrics::Counter &_saved_ms{Metrics::getInstance().counter("result_cache_saved_llm_ms_total", {}, "LLM time the cached answers took originally")};
+};
@@ -0,0 +1,100 @@
+#include "async_http_client.hpp"
+#include "bench_utils.hpp"
+#include "llm_router.hpp"
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+// Many LLM calls at once: one std::async thread per blocking call (the old model_tests_1 way) against
+// LlmRouter::jsonTextImgAsync, where the AsyncHttpClient loop thread drives every transfer.
+// Usage: ex_cfg_path=cfg.json async_llm_bench [calls=200]
+// The cfg points openai_base_url/gemini_base_url at mock_llm_server.py, e.g. with --delay-ms 500.
+
+static size_t threadsCount()
+{
+    std::ifstream file{"/proc/self/status"};
+    std::string line{};
+    while (std::getline(file, line))
+    {
+        if (line.rfind("Threads:", 0) == 0)
+        {
+            return stringToSizeT(trim(line.substr(8)));
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (getenv("ex_cfg_path"))
+    {
+        Cfg::getInstance().loadFromEnv();
+    }
+
+    const size_t calls = argc > 1 ? stringToSizeT(argv[1]) : 200;
+    const std::string base64_image(64 * 1024, 'A');
+    const auto shared_base64_image = std::make_shared<const std::string>(base64_image);
+    const nlohmann::json schema = {{"type", "object"}};
+    auto &router = LlmRouter::getInstance();
+    AsyncHttpClient::getInstance();
+
+    {
+        std::vector<std::future<std::pair<bool, double>>> futures{};
+        size_t peak_threads{0};
+        const auto start_point = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < calls; ++i)
+        {
+            futures.emplace_back(std::async(std::launch::async, [&]()
+                                            {
+                                                nlohmann::json res_json{};
+                                                std::string used_model{};
+                                                const auto call_start = std::chrono::steady_clock::now();
+                                                const bool ok = router.jsonTextImg("describe", "image/jpeg", base64_image, schema, res_json, used_model);
+                                                return std::pair{ok, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - call_start).count()}; }));
+            peak_threads = std::max(peak_threads, threadsCount());
+        }
+
+        std::vector<double> latencies_ms{};
+        size_t errors{0};
+        for (auto &future : futures)
+        {
+            const auto [ok, ms] = future.get();
+            ok ? latencies_ms.push_back(ms) : void(++errors);
+        }
+        const double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count();
+        reportLatencies("threads", latencies_ms, errors, "wall ms: " + floatToStringWithPrecision(wall_ms) + " peak threads: " + std::to_string(peak_threads));
+    }
+
+    {
+        std::mutex mut{};
+        std::vector<double> latencies_ms{};
+        size_t errors{0};
+        size_t peak_in_flight{0};
+        std::promise<void> all_done{};
+        auto all_done_future = all_done.get_future();
+        size_t left = calls;
+
+        const auto start_point = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < calls; ++i)
+        {
+            const auto call_start = std::chrono::steady_clock::now();
+            router.jsonTextImgAsync("describe", "image/jpeg", shared_base64_image, schema, [&, call_start](bool ok, nlohmann::json &&, std::string &&)
+                                    {
+                                        std::lock_guard lock{mut};
+                                        ok ? latencies_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - call_start).count()) : void(++errors);
+                                        if (--left == 0)
+                                        {
+                                            all_done.set_value();
+                                        } });
+        }
+        const size_t peak_threads = threadsCount();
+        do
+        {
+            peak_in_flight = std::max(peak_in_flight, AsyncHttpClient::getInstance().inFlight());
+        } while (all_done_future.wait_for(std::chrono::milliseconds{5}) != std::future_status::ready);
+        const double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count();
+        reportLatencies("async", latencies_ms, errors, "wall ms: " + floatToStringWithPrecision(wall_ms) + " peak threads: " + std::to_string(peak_threads));
+        LOG_INFOF("async peak in flight: %zu", peak_in_flight);
+    }
+    return 0;
+}
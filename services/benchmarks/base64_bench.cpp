@@ -0,0 +1,77 @@
+#include "functions.hpp"
+#include <chrono>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Encode/decode throughput of the base64 codec on real photos.
+// Usage: base64_bench [dataset_folder=../../model_tests_1/dataset] [rounds=20]
+// The codec is picked at startup, set ex_base64_codec=scalar|sse4.1|avx2 to compare them.
+
+int main(int argc, char *argv[])
+{
+    const std::string dataset_folder = argc > 1 ? argv[1] : "../../model_tests_1/dataset";
+    const size_t rounds = argc > 2 ? stringToSizeT(argv[2]) : 20;
+
+    std::vector<std::vector<unsigned char>> photos{};
+    size_t total_bytes{0};
+    for (const auto &entry : fs::directory_iterator(dataset_folder))
+    {
+        if (!entry.is_regular_file() || image_to_base64_data_uri(entry.path()).mime_type.empty())
+        {
+            continue;
+        }
+
+        photos.push_back(getFileAsStringVecU8(entry.path()));
+        total_bytes += photos.back().size();
+    }
+
+    if (photos.empty() || rounds == 0)
+    {
+        LOG_ERROR("if(photos.empty() || rounds == 0)");
+        return 1;
+    }
+
+    std::vector<std::string> encoded(photos.size());
+    for (size_t i = 0; i < photos.size(); ++i)
+    {
+        encoded[i] = base64_encode(photos[i]);
+        if (base64_decode(encoded[i]) != photos[i])
+        {
+            LOG_ERROR("round trip failed for photo " + std::to_string(i));
+            return 1;
+        }
+    }
+
+    size_t sink{0};
+
+    const auto encode_start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        for (const auto &photo : photos)
+        {
+            sink += base64_encode(photo).size();
+        }
+    }
+    const double encode_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - encode_start).count();
+
+    const auto decode_start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        for (const auto &str : encoded)
+        {
+            sink += base64_decode(str).size();
+        }
+    }
+    const double decode_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - decode_start).count();
+
+    const double gb = static_cast<double>(total_bytes) * rounds / 1e9;
+
+    LOG_INFO("codec: " + std::string{base64_codec_name()});
+    LOG_INFO("photos: " + std::to_string(photos.size()) + " bytes: " + std::to_string(total_bytes) + " rounds: " + std::to_string(rounds));
+    LOG_INFO("encode GB/s (binary side): " + floatToStringWithPrecision(gb / encode_sec));
+    LOG_INFO("decode GB/s (binary side): " + floatToStringWithPrecision(gb / decode_sec));
+    LOG_INFO("sink: " + std::to_string(sink));
+
+    return 0;
+}
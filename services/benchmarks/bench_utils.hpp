@@ -0,0 +1,62 @@
+#pragma once
+#include "functions.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Latency statistics shared by the benchmarks, a percentile p is sorted[size * p / 100].
+struct LatencySummary
+{
+    size_t count{0};
+    double avg_ms{0.0};
+    double p50_ms{0.0};
+    double p90_ms{0.0};
+    double p99_ms{0.0};
+    double max_ms{0.0};
+};
+
+inline double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size())))];
+}
+
+inline LatencySummary summarize(std::vector<double> latencies_ms)
+{
+    LatencySummary res{};
+    if (latencies_ms.empty())
+    {
+        return res;
+    }
+
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+    double sum{0.0};
+    for (const auto latency : latencies_ms)
+    {
+        sum += latency;
+    }
+    res.count = latencies_ms.size();
+    res.avg_ms = sum / static_cast<double>(latencies_ms.size());
+    res.p50_ms = percentile(latencies_ms, 50.0);
+    res.p90_ms = percentile(latencies_ms, 90.0);
+    res.p99_ms = percentile(latencies_ms, 99.0);
+    res.max_ms = latencies_ms.back();
+    return res;
+}
+
+// One log line per run: calls, errors, avg/p50/p99/max and whatever the benchmark appends in extra.
+inline void reportLatencies(const std::string &name, std::vector<double> latencies_ms, size_t errors, const std::string &extra = {})
+{
+    const LatencySummary summary = summarize(std::move(latencies_ms));
+    if (!summary.count)
+    {
+        LOG_INFO(name + " calls: 0 errors: " + std::to_string(errors) + (extra.size() ? " " + extra : std::string{}));
+        return;
+    }
+
+    LOG_INFOF("%-9s calls: %zu errors: %zu avg ms: %.1f p50 ms: %.1f p99 ms: %.1f max ms: %.1f%s%s", name.c_str(), summary.count, errors,
+              summary.avg_ms, summary.p50_ms, summary.p99_ms, summary.max_ms, extra.size() ? " " : "", extra.c_str());
+}
@@ -0,0 +1,47 @@
+#include "bench_utils.hpp"
+#include "llm_router.hpp"
+#include <algorithm>
+#include <chrono>
+
+// Time to result of LlmRouter::jsonTextImg against mock_llm_server.py with a latency tail.
+// Usage: ex_cfg_path=cfg.json hedge_bench [calls=200]
+// The cfg points openai_base_url/gemini_base_url at the mock and sets llm_hedge_percentile,
+// run it once with 0 and once with hedging on, e.g. against --delay-ms 50 --tail-ms 1000 --tail-ratio 0.05.
+
+int main(int argc, char *argv[])
+{
+    if (getenv("ex_cfg_path"))
+    {
+        Cfg::getInstance().loadFromEnv();
+    }
+
+    const size_t calls = argc > 1 ? stringToSizeT(argv[1]) : 200;
+    const std::string base64_image(64 * 1024, 'A');
+    const nlohmann::json schema = {{"type", "object"}};
+
+    auto &router = LlmRouter::getInstance();
+    std::vector<double> all_ms{};
+    size_t errors{0};
+    for (size_t i = 0; i < calls; ++i)
+    {
+        nlohmann::json res_json{};
+        std::string used_model{};
+        const auto start_point = std::chrono::steady_clock::now();
+        if (!router.jsonTextImg("describe", "image/jpeg", base64_image, schema, res_json, used_model))
+        {
+            ++errors;
+            continue;
+        }
+        all_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count());
+    }
+
+    reportLatencies("all", all_ms, errors);
+    for (const bool hedged : {false, true})
+    {
+        const auto &histogram = LlmRouter::timeToResult(hedged);
+        LOG_INFOF("%-9s calls: %llu p50 ms: %.1f p99 ms: %.1f", hedged ? "hedged" : "unhedged", static_cast<unsigned long long>(histogram.count()),
+                  static_cast<double>(histogram.quantileMicroseconds(0.5)) / 1000.0, static_cast<double>(histogram.quantileMicroseconds(0.99)) / 1000.0);
+    }
+    LOG_INFO("llm models: " + router.stats().dump());
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "bench_utils.hpp"
+#include "http_client.hpp"
+#include <algorithm>
+#include <chrono>
+
+// Per-call latency of a fresh curl handle per request (the old openai/gemini behaviour) against the pooled HttpClient.
+// Usage: http_client_bench <url> [calls=200] [body_kb=64]
+// Run mock_llm_server.py locally and pass e.g. http://127.0.0.1:8089/v1beta/models/mock:generateContent,
+// with --cert/--key and http_ca_info in the cfg (ex_cfg_path) to include the TLS handshake.
+
+static size_t WriteCallback(void *contents, size_t size, size_t nmemb, std::string *userp)
+{
+    size_t total_size = size * nmemb;
+    userp->append((char *)contents, total_size);
+    return total_size;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        LOG_ERROR("usage: http_client_bench <url> [calls] [body_kb]");
+        return 1;
+    }
+
+    if (getenv("ex_cfg_path"))
+    {
+        Cfg::getInstance().loadFromEnv();
+    }
+
+    const std::string url = argv[1];
+    const size_t calls = argc > 2 ? stringToSizeT(argv[2]) : 200;
+    const size_t body_kb = argc > 3 ? stringToSizeT(argv[3]) : 64;
+    const std::string body = "{\"data\":\"" + std::string(body_kb * 1024, 'A') + "\"}";
+    const std::string ca_info = Cfg::getInstance().getCfgValue("http_ca_info");
+
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    {
+        std::vector<double> latencies_ms{};
+        size_t errors{0};
+        for (size_t i = 0; i < calls; ++i)
+        {
+            const auto start_point = std::chrono::steady_clock::now();
+
+            CURL *curl = curl_easy_init();
+            std::string response_string{};
+            struct curl_slist *headers = curl_slist_append(nullptr, "Content-Type: application/json");
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_POST, 1L);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_string);
+            if (ca_info.size())
+            {
+                curl_easy_setopt(curl, CURLOPT_CAINFO, ca_info.c_str());
+            }
+            const CURLcode res = curl_easy_perform(curl);
+            curl_slist_free_all(headers);
+            curl_easy_cleanup(curl);
+
+            if (res != CURLE_OK)
+            {
+                ++errors;
+                continue;
+            }
+            latencies_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count());
+        }
+        reportLatencies("fresh handle", latencies_ms, errors);
+    }
+
+    {
+        std::vector<double> latencies_ms{};
+        size_t errors{0};
+        const std::vector<std::string> headers{"Content-Type: application/json"};
+        for (size_t i = 0; i < calls; ++i)
+        {
+            const auto start_point = std::chrono::steady_clock::now();
+
+            HttpClient::Response response{};
+            std::string error{};
+            if (!HttpClient::getInstance().post(url, headers, body, response, error))
+            {
+                ++errors;
+                continue;
+            }
+            latencies_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count());
+        }
+        reportLatencies("pooled HttpClient", latencies_ms, errors);
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "functions.hpp"
+#include <chrono>
+#include <filesystem>
+
+// What downscale_image costs and saves per max dimension, over a folder of photos.
+// Usage: image_bench <folder> [quality=85] [max_dimension...]
+// Bytes are the base64 request payload, the part every LLM call uploads.
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        LOG_ERROR("usage: image_bench <folder> [quality=85] [max_dimension...]");
+        return 1;
+    }
+
+    const int quality = argc > 2 ? static_cast<int>(stringToSizeT(argv[2])) : 85;
+    std::vector<size_t> max_dimensions{};
+    for (int i = 3; i < argc; ++i)
+    {
+        max_dimensions.push_back(stringToSizeT(argv[i]));
+    }
+    if (max_dimensions.empty())
+    {
+        max_dimensions = {2048, 1536, 1024, 768, 512};
+    }
+
+    std::vector<std::vector<unsigned char>> images{};
+    size_t original_bytes{0};
+    for (const auto &entry : std::filesystem::directory_iterator(argv[1]))
+    {
+        std::ifstream file(entry.path(), std::ios::binary);
+        std::vector<unsigned char> bytes{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+        if (!entry.is_regular_file() || mime_type_of_image(bytes.data(), bytes.size()).empty())
+        {
+            continue;
+        }
+        original_bytes += base64_encoded_size(bytes.size());
+        images.push_back(std::move(bytes));
+    }
+    LOG_INFOF("images: %zu original base64 KB: %.1f avg", images.size(), images.size() ? original_bytes / 1024.0 / images.size() : 0.0);
+
+    for (const size_t max_dimension : max_dimensions)
+    {
+        size_t sent_bytes{0};
+        size_t failed{0};
+        size_t resized{0};
+        const auto start_point = std::chrono::steady_clock::now();
+        for (const auto &bytes : images)
+        {
+            DownscaledImage out{};
+            std::string error{};
+            if (!downscale_image(bytes.data(), bytes.size(), max_dimension, quality, out, error))
+            {
+                LOG_ERROR(error);
+                ++failed;
+                sent_bytes += base64_encoded_size(bytes.size());
+                continue;
+            }
+            // The same choice image_to_llm_base64_data_uri makes.
+            const bool use_downscaled = out.resized || out.jpeg.size() < bytes.size();
+            resized += out.resized;
+            sent_bytes += base64_encoded_size(use_downscaled ? out.jpeg.size() : bytes.size());
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count();
+        LOG_INFOF("max %4zu q%d: avg base64 KB %7.1f (%5.1f%% of original) avg ms %6.2f resized %zu failed %zu", max_dimension, quality,
+                  sent_bytes / 1024.0 / std::max<size_t>(1, images.size()), original_bytes ? 100.0 * sent_bytes / original_bytes : 0.0,
+                  ms / std::max<size_t>(1, images.size()), resized, failed);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "functions.hpp"
+#include <chrono>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// json::accept() followed by json::parse() against the single pass parseJson() on stored LLM answers.
+// Every answer is measured as is and wrapped in a chat/completions envelope, the shape openai.cpp parses first.
+// Usage: json_bench [results_folder=../../model_tests_1/results] [rounds=50]
+
+int main(int argc, char *argv[])
+{
+    const std::string results_folder = argc > 1 ? argv[1] : "../../model_tests_1/results";
+    const size_t rounds = argc > 2 ? stringToSizeT(argv[2]) : 50;
+
+    std::vector<std::string> documents{};
+    size_t total_bytes{0};
+    for (const auto &entry : fs::recursive_directory_iterator(results_folder))
+    {
+        if (!entry.is_regular_file() || entry.path().extension() != ".json")
+        {
+            continue;
+        }
+
+        std::string answer = getFileAsString(entry.path());
+        if (!parseJson(answer))
+        {
+            continue;
+        }
+
+        nlohmann::json envelope{};
+        envelope["choices"] = {{{"index", 0}, {"message", {{"role", "assistant"}, {"content", answer}}}, {"finish_reason", "stop"}}};
+        documents.push_back(envelope.dump());
+        documents.push_back(std::move(answer));
+        total_bytes += documents[documents.size() - 2].size() + documents.back().size();
+    }
+
+    if (documents.empty() || rounds == 0)
+    {
+        LOG_ERROR("if(documents.empty() || rounds == 0)");
+        return 1;
+    }
+
+    size_t sink{0};
+
+    const auto twice_start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        for (const auto &document : documents)
+        {
+            if (!nlohmann::json::accept(document))
+            {
+                continue;
+            }
+            sink += nlohmann::json::parse(document).size();
+        }
+    }
+    const double twice_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - twice_start).count();
+
+    const auto once_start = std::chrono::steady_clock::now();
+    nlohmann::json reused{};
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        for (const auto &document : documents)
+        {
+            if (!parseJson(document, reused))
+            {
+                continue;
+            }
+            sink += reused.size();
+        }
+    }
+    const double once_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - once_start).count();
+
+    const double total_mb = double(total_bytes) * rounds / (1024.0 * 1024.0);
+    const double docs = double(documents.size()) * rounds;
+    LOG_INFO("documents: " + std::to_string(documents.size()) + " bytes: " + std::to_string(total_bytes) + " rounds: " + std::to_string(rounds));
+    LOG_INFO("accept+parse MB/s: " + floatToStringWithPrecision(total_mb / twice_sec) + " us/doc: " + floatToStringWithPrecision(twice_sec * 1e6 / docs));
+    LOG_INFO("parseJson    MB/s: " + floatToStringWithPrecision(total_mb / once_sec) + " us/doc: " + floatToStringWithPrecision(once_sec * 1e6 / docs));
+    LOG_INFO("sink: " + std::to_string(sink));
+    return 0;
+}
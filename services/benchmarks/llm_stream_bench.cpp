@@ -0,0 +1,99 @@
+#include "bench_utils.hpp"
+#include "gemini.hpp"
+#include "openai.hpp"
+#include <algorithm>
+#include <chrono>
+
+// Buffered jsonTextImg against jsonTextImgStream: total latency and time until the first product is known.
+// Usage: llm_stream_bench <openai|gemini> <model> <image_path> [calls=20]
+// Run mock_llm_server.py --delay-ms 1000 and point openai_base_url / gemini_base_url (ex_cfg_path) at it.
+
+static void report(const std::string &name, const std::vector<double> &first_product_ms, const std::vector<double> &total_ms, size_t errors)
+{
+    const LatencySummary first_product = summarize(first_product_ms);
+    const LatencySummary total = summarize(total_ms);
+    LOG_INFO(name + " calls: " + std::to_string(total_ms.size()) + " errors: " + std::to_string(errors) +
+             " first product p50 ms: " + floatToStringWithPrecision(first_product.p50_ms) +
+             " p99 ms: " + floatToStringWithPrecision(first_product.p99_ms) +
+             " total p50 ms: " + floatToStringWithPrecision(total.p50_ms) +
+             " p99 ms: " + floatToStringWithPrecision(total.p99_ms));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        LOG_ERROR("usage: llm_stream_bench <openai|gemini> <model> <image_path> [calls]");
+        return 1;
+    }
+
+    if (getenv("ex_cfg_path"))
+    {
+        Cfg::getInstance().loadFromEnv();
+    }
+
+    const std::string provider = argv[1];
+    const std::string model = argv[2];
+    const size_t calls = argc > 4 ? stringToSizeT(argv[4]) : 20;
+    const bool is_openai = provider == "openai";
+
+    const auto mime_and_base64 = image_to_base64_data_uri(argv[3]);
+    if (mime_and_base64.base64_string.empty() || mime_and_base64.mime_type.empty())
+    {
+        LOG_ERROR("if(mime_and_base64.base64_string.empty() || mime_and_base64.mime_type.empty())");
+        return 1;
+    }
+
+    {
+        std::vector<double> total_ms{};
+        size_t errors{0};
+        for (size_t i = 0; i < calls; ++i)
+        {
+            const auto start_point = std::chrono::steady_clock::now();
+            nlohmann::json res_json{};
+            const bool ok = is_openai ? openai::jsonTextImg(model, Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, res_json)
+                                      : gemini::jsonTextImg(model, Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, res_json);
+            if (!ok)
+            {
+                ++errors;
+                continue;
+            }
+            total_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count());
+        }
+        // Nothing is known before the whole body is parsed.
+        report("buffered", total_ms, total_ms, errors);
+    }
+
+    {
+        std::vector<double> first_product_ms{};
+        std::vector<double> total_ms{};
+        size_t errors{0};
+        for (size_t i = 0; i < calls; ++i)
+        {
+            const auto start_point = std::chrono::steady_clock::now();
+            double first_ms{-1.0};
+            const auto on_product = [&](const nlohmann::json &)
+            {
+                if (first_ms < 0.0)
+                {
+                    first_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count();
+                }
+            };
+
+            nlohmann::json res_json{};
+            const bool ok = is_openai ? openai::jsonTextImgStream(model, Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, on_product, res_json)
+                                      : gemini::jsonTextImgStream(model, Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, on_product, res_json);
+            if (!ok)
+            {
+                ++errors;
+                continue;
+            }
+            const double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count();
+            first_product_ms.push_back(first_ms < 0.0 ? total : first_ms);
+            total_ms.push_back(total);
+        }
+        report("streamed", first_product_ms, total_ms, errors);
+    }
+
+    return 0;
+}
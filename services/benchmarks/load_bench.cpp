@@ -0,0 +1,118 @@
+#include "bench_utils.hpp"
+#include "functions.hpp"
+#include <curl/curl.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Fixed-concurrency load generator for the web_server routes.
+// Usage: load_bench <url> <form_data> [concurrency=64] [duration_sec=30]
+// Every worker keeps one keep-alive connection and sends the next request as soon as the previous one is answered,
+// so the reported requests/s and latency percentiles are measured at exactly <concurrency> requests in flight.
+
+static size_t DiscardCallback(void *, size_t size, size_t nmemb, void *)
+{
+    return size * nmemb;
+}
+
+struct WorkerStats
+{
+    std::vector<double> latencies_ms{};
+    size_t errors{0};
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        LOG_ERROR("usage: load_bench <url> <form_data> [concurrency] [duration_sec]");
+        return 1;
+    }
+
+    const std::string url = argv[1];
+    const std::string form_data = argv[2];
+    const size_t concurrency = argc > 3 ? stringToSizeT(argv[3]) : 64;
+    const size_t duration_sec = argc > 4 ? stringToSizeT(argv[4]) : 30;
+
+    if (concurrency == 0 || duration_sec == 0)
+    {
+        LOG_ERROR("if(concurrency == 0 || duration_sec == 0)");
+        return 1;
+    }
+
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    std::vector<WorkerStats> stats(concurrency);
+    std::vector<std::thread> workers{};
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{duration_sec};
+    const auto start_point = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < concurrency; ++i)
+    {
+        workers.emplace_back(
+            [&, i]()
+            {
+                CURL *curl = curl_easy_init();
+                if (!curl)
+                {
+                    LOG_ERROR("if(!curl)");
+                    return;
+                }
+
+                curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+                curl_easy_setopt(curl, CURLOPT_POSTFIELDS, form_data.c_str());
+                curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "GET");
+                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, DiscardCallback);
+                curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+                auto &worker_stats = stats[i];
+                while (std::chrono::steady_clock::now() < deadline)
+                {
+                    const auto req_start = std::chrono::steady_clock::now();
+                    const CURLcode res = curl_easy_perform(curl);
+                    const auto req_end = std::chrono::steady_clock::now();
+
+                    long http_code{0};
+                    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+                    if (res != CURLE_OK || http_code != 200)
+                    {
+                        ++worker_stats.errors;
+                        continue;
+                    }
+
+                    worker_stats.latencies_ms.push_back(std::chrono::duration<double, std::milli>(req_end - req_start).count());
+                }
+
+                curl_easy_cleanup(curl);
+            });
+    }
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    const double elapsed_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_point).count();
+
+    std::vector<double> all_latencies{};
+    size_t errors{0};
+    for (const auto &worker_stats : stats)
+    {
+        all_latencies.insert(all_latencies.end(), worker_stats.latencies_ms.begin(), worker_stats.latencies_ms.end());
+        errors += worker_stats.errors;
+    }
+    const LatencySummary summary = summarize(all_latencies);
+
+    LOG_INFO("url: " + url);
+    LOG_INFO("concurrency: " + std::to_string(concurrency) + " duration_sec: " + floatToStringWithPrecision(elapsed_sec));
+    LOG_INFO("requests: " + std::to_string(all_latencies.size()) + " errors: " + std::to_string(errors));
+    LOG_INFO("requests/s: " + floatToStringWithPrecision(all_latencies.size() / elapsed_sec));
+    LOG_INFO("p50 ms: " + floatToStringWithPrecision(summary.p50_ms));
+    LOG_INFO("p90 ms: " + floatToStringWithPrecision(summary.p90_ms));
+    LOG_INFO("p99 ms: " + floatToStringWithPrecision(summary.p99_ms));
+
+    curl_global_cleanup();
+    return 0;
+}
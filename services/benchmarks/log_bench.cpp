@@ -0,0 +1,96 @@
+#include "functions.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Caller side cost of a log line: the previous synchronous logger (std::string concatenation, then
+// stream << line << std::endl under a lock) against the ring buffer logger, both writing to a file.
+// Usage: log_bench [threads=4] [lines_per_thread=200000] [out_file=/tmp/log_bench.log]
+// The ring is sized to bench_ring_slots unless ex_log_ring_slots is set. A dropped line is not written, so a run
+// that dropped any is reported as failed: its ns/line would compare less work against the sync logger.
+
+namespace
+{
+    std::mutex sync_mut{};
+
+    void syncLine(std::ostream &stream, const std::string &str)
+    {
+        std::lock_guard lock{sync_mut};
+        stream << str << std::endl;
+    }
+
+    template <typename F>
+    double runThreads(size_t threads_count, F f)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads{};
+        for (size_t t = 0; t < threads_count; ++t)
+        {
+            threads.emplace_back(f, t);
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // Has to happen before the first log line creates the logger.
+    constexpr const char *bench_ring_slots = "65536";
+    setenv("ex_log_ring_slots", bench_ring_slots, 0);
+
+    const size_t threads_count = argc > 1 ? stringToSizeT(argv[1]) : 4;
+    const size_t lines = argc > 2 ? stringToSizeT(argv[2]) : 200000;
+    const std::string out_file = argc > 3 ? argv[3] : "/tmp/log_bench.log";
+
+    if (threads_count == 0 || lines == 0)
+    {
+        LOG_ERROR("if(threads_count == 0 || lines == 0)");
+        return 1;
+    }
+
+    const std::string req_id = "1234567";
+    std::ofstream out{out_file, std::ios::trunc};
+
+    const double sync_sec = runThreads(threads_count, [&](size_t t)
+                                       {
+        for (size_t i = 0; i < lines; ++i)
+        {
+            syncLine(out, std::string{__FILE__} + ":" + std::to_string(__LINE__) + " " + std::string{__FUNCTION__} + " " + "processed " + req_id + " thread=" + std::to_string(t) + " i=" + std::to_string(i));
+        } });
+
+    Logger::getInstance().bindInfo(&out);
+    const size_t dropped_before = Logger::getInstance().dropped();
+    const double ring_sec = runThreads(threads_count, [&](size_t t)
+                                       {
+        for (size_t i = 0; i < lines; ++i)
+        {
+            LOG_INFOF("processed %s thread=%zu i=%zu", req_id.c_str(), t, i);
+        } });
+    const auto drain_start = std::chrono::steady_clock::now();
+    Logger::getInstance().flush();
+    const double drain_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - drain_start).count();
+    Logger::getInstance().bindInfo(&std::cout);
+
+    const size_t dropped = Logger::getInstance().dropped() - dropped_before;
+    const double total = double(threads_count * lines);
+    const double written = total - double(dropped);
+    LOG_INFO("threads: " + std::to_string(threads_count) + " lines/thread: " + std::to_string(lines) + " ring slots: " + std::to_string(Logger::getInstance().slotsCount()));
+    LOG_INFO("sync ns/line: " + floatToStringWithPrecision(sync_sec * 1e9 / total));
+    // Producers and the drain together, per line that reached the file.
+    LOG_INFO("ring ns/written line: " + floatToStringWithPrecision((ring_sec + drain_sec) * 1e9 / std::max(1.0, written)) + " producers only: " + floatToStringWithPrecision(ring_sec * 1e9 / std::max(1.0, written)) +
+             " drain after producers ms: " + floatToStringWithPrecision(drain_sec * 1e3) + " written: " + std::to_string(static_cast<size_t>(written)));
+    if (dropped)
+    {
+        LOG_ERROR("ring dropped " + std::to_string(dropped) + " of " + std::to_string(static_cast<size_t>(total)) + " lines, the numbers above are not comparable. Raise ex_log_ring_slots.");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+# Local stand-in for api.openai.com and generativelanguage.googleapis.com.
+# Answers chat/completions and generateContent with a canned nutrition result after an optional delay.
+# "stream": true and streamGenerateContent are answered as SSE, the delay is spread over the chunks.
+# Point openai_base_url / gemini_base_url in the credentials json at it for benchmarks.
+#
+# --tail-ms/--tail-ratio replace the delay of that share of the requests to give the latency a long tail.
+#
+# python3 mock_llm_server.py --port 8089 --delay-ms 0 [--tail-ms 2000 --tail-ratio 0.05] [--cert cert.pem --key key.pem]
+
+import argparse
+import json
+import random
+import ssl
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+RESULT = {"products": [{"name": "Macaroni Salad", "grams": 200, "carbs": 47},
+                       {"name": "Cherry Tomatoes", "grams": 80, "carbs": 3},
+                       {"name": "Bread", "grams": 50, "carbs": 24}]}
+STREAM_CHUNK_CHARS = 16
+
+
+class Server(ThreadingHTTPServer):
+    # socketserver listens with a backlog of 5, a burst of new connections beyond it waits for the
+    # client's SYN retry a second later and shows up as a one second tail.
+    request_queue_size = 1024
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    # SSE chunks are small writes, Nagle would hold each one until the previous is acked.
+    disable_nagle_algorithm = True
+    delay_ms = 0
+    tail_ms = 0
+    tail_ratio = 0.0
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", 0))
+        request = self.rfile.read(length)
+        delay_ms = self.tail_ms if self.tail_ratio and random.random() < self.tail_ratio else self.delay_ms
+
+        if "chat/completions" in self.path and b'"stream":true' in request:
+            self.send_stream([{"choices": [{"delta": {"content": text}}]} for text in self.result_pieces()], b"data: [DONE]\n\n", delay_ms)
+            return
+        if ":streamGenerateContent" in self.path:
+            self.send_stream([{"candidates": [{"content": {"parts": [{"text": text}]}}]} for text in self.result_pieces()], b"", delay_ms)
+            return
+
+        if delay_ms:
+            time.sleep(delay_ms / 1000.0)
+
+        if "chat/completions" in self.path:
+            body = {"choices": [{"message": {"role": "assistant", "content": json.dumps(RESULT)}}]}
+        elif ":generateContent" in self.path:
+            body = {"candidates": [{"content": {"parts": [{"text": json.dumps(RESULT)}]}}]}
+        else:
+            self.send_response(404)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+
+        data = json.dumps(body).encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        # Headers and body in one segment, a split write stalls on delayed ACK of a reused connection.
+        self._headers_buffer.append(b"\r\n")
+        self._headers_buffer.append(data)
+        self.wfile.write(b"".join(self._headers_buffer))
+        self._headers_buffer = []
+
+    @staticmethod
+    def result_pieces():
+        text = json.dumps(RESULT)
+        return [text[i:i + STREAM_CHUNK_CHARS] for i in range(0, len(text), STREAM_CHUNK_CHARS)]
+
+    def send_stream(self, events, tail, delay_ms):
+        self.send_response(200)
+        self.send_header("Content-Type", "text/event-stream")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+
+        step = delay_ms / 1000.0 / max(1, len(events))
+        for event in events:
+            if step:
+                time.sleep(step)
+            self.write_chunk(b"data: " + json.dumps(event).encode() + b"\n\n")
+        if tail:
+            self.write_chunk(tail)
+        self.wfile.write(b"0\r\n\r\n")
+        self.wfile.flush()
+
+    def write_chunk(self, data):
+        self.wfile.write(b"%x\r\n%s\r\n" % (len(data), data))
+        self.wfile.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=8089)
+    parser.add_argument("--delay-ms", type=int, default=0)
+    parser.add_argument("--tail-ms", type=int, default=0)
+    parser.add_argument("--tail-ratio", type=float, default=0.0)
+    parser.add_argument("--cert", default="")
+    parser.add_argument("--key", default="")
+    args = parser.parse_args()
+
+    Handler.delay_ms = args.delay_ms
+    Handler.tail_ms = args.tail_ms
+    Handler.tail_ratio = args.tail_ratio
+    server = Server(("127.0.0.1", args.port), Handler)
+    if args.cert:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.key)
+        server.socket = context.wrap_socket(server.socket, server_side=True)
+
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
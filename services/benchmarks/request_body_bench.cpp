@@ -0,0 +1,80 @@
+#include "openai.hpp"
+#include <chrono>
+
+// Peak memory of building and sending one LLM request with a large image.
+// copy:   the construction the providers used before HttpClient::Body, the image is concatenated into the
+//         data URI, copied into the json tree and dumped into one string for CURLOPT_POSTFIELDS.
+// shared: openai::jsonTextImg, the body is sent around the caller's base64 string.
+// VmHWM is per process, run each mode on its own.
+// Usage: ex_cfg_path=cfg.json request_body_bench <copy|shared> [image_mb=8] [calls=4]
+// The cfg points openai_base_url at mock_llm_server.py.
+
+static size_t statusKb(const std::string &key)
+{
+    std::ifstream file{"/proc/self/status"};
+    std::string line{};
+    while (std::getline(file, line))
+    {
+        if (line.rfind(key, 0) == 0)
+        {
+            return stringToSizeT(trim(line.substr(key.size())));
+        }
+    }
+    return 0;
+}
+
+static bool postCopied(const std::string &base64_image, const nlohmann::json &schema)
+{
+    nlohmann::json messages = nlohmann::json::array();
+    messages.push_back({{"role", "system"}, {"content", "Your response must follow this JSON schema: " + schema.dump()}});
+    nlohmann::json user_message = {{"role", "user"}, {"content", nlohmann::json::array()}};
+    user_message["content"].push_back({{"type", "text"}, {"text", "describe"}});
+    user_message["content"].push_back({{"type", "image_url"}, {"image_url", {{"url", "data:image/jpeg;base64," + base64_image}}}});
+    messages.push_back(user_message);
+    const nlohmann::json request_json = {{"model", "gpt-4.1-mini"}, {"messages", messages}, {"response_format", {{"type", "json_object"}}}};
+    const std::string body = request_json.dump();
+
+    static const std::string base_url = Cfg::getInstance().getCfgValueOr("openai_base_url", "https://api.openai.com");
+    HttpClient::Response response{};
+    std::string error{};
+    return HttpClient::getInstance().post(base_url + "/v1/chat/completions", {"Content-Type: application/json"}, body, response, error) && response.status_code < 300;
+}
+
+int main(int argc, char *argv[])
+{
+    if (getenv("ex_cfg_path"))
+    {
+        Cfg::getInstance().loadFromEnv();
+    }
+    if (argc < 2)
+    {
+        LOG_ERROR("usage: request_body_bench <copy|shared> [image_mb=8] [calls=4]");
+        return 1;
+    }
+
+    const std::string mode = argv[1];
+    const size_t image_mb = argc > 2 ? stringToSizeT(argv[2]) : 8;
+    const size_t calls = argc > 3 ? stringToSizeT(argv[3]) : 4;
+    const nlohmann::json schema = {{"type", "object"}};
+
+    // Warms up the connection so its buffers are in the baseline too.
+    nlohmann::json res_json{};
+    openai::jsonTextImg("gpt-4.1-mini", "describe", "image/jpeg", "AAAA", schema, res_json);
+
+    const std::string base64_image(image_mb * 1024 * 1024, 'A');
+    const size_t baseline_kb = statusKb("VmRSS:");
+
+    size_t errors{0};
+    const auto start_point = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; ++i)
+    {
+        const bool ok = mode == "copy" ? postCopied(base64_image, schema) : openai::jsonTextImg("gpt-4.1-mini", "describe", "image/jpeg", base64_image, schema, res_json);
+        errors += !ok;
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_point).count();
+
+    const size_t peak_kb = statusKb("VmHWM:");
+    LOG_INFOF("%-6s image MB: %zu calls: %zu errors: %zu avg ms: %.1f peak RSS over baseline MB: %.1f (%.1f x image)", mode.c_str(), image_mb, calls, errors,
+              ms / std::max<size_t>(1, calls), (peak_kb - std::min(peak_kb, baseline_kb)) / 1024.0, (peak_kb - std::min(peak_kb, baseline_kb)) / 1024.0 / std::max<size_t>(1, image_mb));
+    return 0;
+}
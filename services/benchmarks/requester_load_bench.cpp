@@ -0,0 +1,65 @@
+#include <SimpleAmqpClient/SimpleAmqpClient.h>
+#include "functions.hpp"
+#include <chrono>
+#include <thread>
+
+// Fixed-rate publisher for recognize_food, the synthetic load for ai_requester_service.
+// Usage: ex_cfg_path=cfg.json requester_load_bench <first_id> <last_id> [rate=1000] [duration_sec=30]
+// Cycles through the FoodRecognitions rows first_id..last_id. With rows that all point at one photo and
+// result_cache on, only the first message calls the LLM and the requester runs at the speed of its
+// database writes and acks. Its 10 s report logs db commits/s, rows per commit, ack frames/s and messages per ack,
+// the same numbers are on its metrics port.
+
+int main(int argc, char *argv[])
+{
+    if (!Cfg::getInstance().loadFromEnv())
+    {
+        LOG_ERROR("if(!Cfg::getInstance().loadFromEnv())");
+        return 1;
+    }
+    if (argc < 3)
+    {
+        LOG_ERROR("usage: requester_load_bench <first_id> <last_id> [rate=1000] [duration_sec=30]");
+        return 1;
+    }
+
+    const size_t first_id = stringToSizeT(argv[1]);
+    const size_t last_id = std::max(first_id, stringToSizeT(argv[2]));
+    const size_t rate = std::max<size_t>(1, argc > 3 ? stringToSizeT(argv[3]) : 1000);
+    const size_t duration_sec = argc > 4 ? stringToSizeT(argv[4]) : 30;
+
+    try
+    {
+        auto channel = AmqpClient::Channel::Create("localhost", 5672, Cfg::getInstance().getCfgValue("rabbitmq_user"), Cfg::getInstance().getCfgValue("rabbitmq_pass"), "/");
+
+        // Messages go out in 1 ms ticks, each tick catches up to where the rate says the count should be.
+        size_t published{0};
+        size_t next_id{first_id};
+        const size_t total = rate * duration_sec;
+        const auto start_point = std::chrono::steady_clock::now();
+        auto tick = start_point;
+        while (published < total)
+        {
+            tick += std::chrono::milliseconds{1};
+            std::this_thread::sleep_until(tick);
+            const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_point).count();
+            const size_t due = std::min(total, static_cast<size_t>(elapsed * static_cast<double>(rate)));
+            for (; published < due; ++published)
+            {
+                nlohmann::json message{};
+                message["FoodRecognitionID"] = std::to_string(next_id);
+                channel->BasicPublish("", "recognize_food", AmqpClient::BasicMessage::Create(message.dump()));
+                next_id = next_id == last_id ? first_id : next_id + 1;
+            }
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_point).count();
+        LOG_INFOF("published: %zu in s: %.1f rate: %.1f/s", published, seconds, static_cast<double>(published) / seconds);
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR(e.what());
+        return 1;
+    }
+    return 0;
+}
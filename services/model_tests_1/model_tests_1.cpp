@@ -1,13 +1,98 @@
-#include "openai.hpp"
-#include "gemini.hpp"
+#include "async_http_client.hpp"
+#include "llm_provider.hpp"
 #include <filesystem>
 #include <cstdlib>
 #include <ctime>
 #include <thread>
 #include <future>
+#include <latch>
 
 namespace fs = std::filesystem;
 
+static const std::vector<std::pair<std::string, std::vector<std::string>>> models_by_provider{
+    {"openai", {
+                   "gpt-4o",
+                   "gpt-4o-mini",
+                   "gpt-4.1",
+                   "gpt-4.1-mini",
+                   "o4-mini",
+               }},
+    {"gemini", {
+                   "gemini-2.0-flash",
+                   "gemini-2.0-flash-lite",
+                   "gemini-1.5-flash",
+                   "gemini-2.0-flash-exp",
+                   "gemini-2.5-flash-preview-05-20",
+                   "gemini-2.5-pro-preview-05-06",
+               }},
+};
+
+static void writeResult(const std::string &res_file_path, nlohmann::json &res_json, size_t image_base64_size, std::chrono::system_clock::time_point start_point, std::chrono::system_clock::time_point end_point, std::chrono::system_clock::time_point first_product_point)
+{
+    res_json["time_spent"] = std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(end_point - start_point).count());
+    res_json["image_base64_size"] = std::to_string(image_base64_size);
+    if (first_product_point != std::chrono::system_clock::time_point{})
+    {
+        res_json["time_to_first_product"] = std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(first_product_point - start_point).count());
+    }
+
+    std::ofstream file{res_file_path};
+    if (!file)
+    {
+        LOG_ERROR("if(!file)");
+        return;
+    }
+    file << res_json.dump();
+}
+
+// One model on one image through the AsyncHttpClient loop, retried until the model answers.
+struct AsyncRun
+{
+    const LlmProvider *provider{nullptr};
+    HttpClient::Request request{};
+    size_t image_base64_size{0};
+    std::string res_file_path{};
+    std::latch *done{nullptr};
+};
+
+static void postUntilSuccess(const std::shared_ptr<AsyncRun> &run)
+{
+    const auto start_point = std::chrono::system_clock::now();
+    AsyncHttpClient::getInstance().post(run->request, [run, start_point](HttpClient::Attempt &&attempt)
+                                        {
+                                            nlohmann::json res_json{};
+                                            if (attempt.error.size() || attempt.response.status_code >= 300 || !run->provider->parse_json_text_img(attempt.response.body, res_json))
+                                            {
+                                                LOG_ERROR("retrying " + run->res_file_path + " " + attempt.error + " HTTP " + std::to_string(attempt.response.status_code));
+                                                postUntilSuccess(run);
+                                                return;
+                                            }
+
+                                            writeResult(run->res_file_path, res_json, run->image_base64_size, start_point, std::chrono::system_clock::now(), std::chrono::system_clock::time_point{});
+                                            run->done->count_down(); });
+}
+
+// The image at one size of the sweep, shrunk in memory so the dataset folder stays as it is.
+// 0 is the original file.
+static MimeTypeAndBase64 loadImage(const fs::path &image_file, size_t max_dimension, int jpeg_quality)
+{
+    if (!max_dimension)
+    {
+        return image_to_base64_data_uri(image_file);
+    }
+
+    std::ifstream file(image_file, std::ios::binary);
+    const std::vector<unsigned char> bytes{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    DownscaledImage downscaled{};
+    std::string error{};
+    if (!downscale_image(bytes.data(), bytes.size(), max_dimension, jpeg_quality, downscaled, error))
+    {
+        LOG_ERROR(image_file.string() + " " + error);
+        return {};
+    }
+    return MimeTypeAndBase64{"image/jpeg", base64_encode(downscaled.jpeg)};
+}
+
 int main()
 {
     if (!Cfg::getInstance().loadFromEnv())
@@ -29,11 +114,37 @@ int main()
     LOG_INFO("dataset_folder: " + dataset_folder);
     LOG_INFO("results_folder: " + results_folder);
 
-    const bool only_new = true;
+    // model_tests_image_sizes sweeps the max dimension the photos are shrunk to, e.g. [0, 1024, 768, 512],
+    // model_tests_do_stats then puts accuracy and time of every size side by side. Results of size 0,
+    // the original photo, stay in results/<model>, the others go to results/<model>@<size>.
+    std::vector<size_t> image_sizes{};
+    const nlohmann::json image_sizes_json = Cfg::getInstance().getCfgJson("model_tests_image_sizes");
+    if (image_sizes_json.is_array())
+    {
+        for (const auto &size : image_sizes_json)
+        {
+            if (size.is_number_unsigned())
+            {
+                image_sizes.push_back(size.get<size_t>());
+            }
+        }
+    }
+    if (image_sizes.empty())
+    {
+        image_sizes.push_back(0);
+    }
+    const int jpeg_quality = static_cast<int>(Cfg::getInstance().getCfgSizeT("llm_image_jpeg_quality", 85));
+    const auto size_suffix_of = [](size_t image_size)
+    {
+        return image_size ? "@" + std::to_string(image_size) : std::string{};
+    };
+
+    const bool only_new = image_sizes.size() == 1;
     std::set<std::string> used_pathes{};
     if (only_new)
     {
-        static const std::string tmp_f{"../results/o4-mini"};
+        const std::string tmp_f{"../results/o4-mini" + size_suffix_of(image_sizes.front())};
+        fs::create_directories(tmp_f);
         for (const auto &entry : std::filesystem::directory_iterator(tmp_f))
         {
             if (entry.is_regular_file())
@@ -61,7 +172,14 @@ int main()
 
     LOG_INFO("image_files: " + std::to_string(image_files.size()));
 
+    // With llm_streaming the streamed API is used and the time until the first product is stored as well,
+    // every streamed call blocks a thread of its own. Buffered calls all run on the AsyncHttpClient loop,
+    // model_tests_images_in_flight images at a time with every model.
+    const bool streaming = Cfg::getInstance().getCfgBool("llm_streaming", false);
+    const size_t images_in_flight = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("model_tests_images_in_flight", 1));
+
     const bool only_not_food = false;
+    std::vector<fs::path> selected_files{};
     for (const auto &image_file : image_files)
     {
         if (only_not_food)
@@ -71,129 +189,96 @@ int main()
                 continue;
             }
         }
+        selected_files.push_back(image_file);
+    }
 
-        const auto mime_and_base64 = image_to_base64_data_uri(image_file);
-        if (mime_and_base64.base64_string.empty() || mime_and_base64.mime_type.empty())
-        {
-            LOG_ERROR("if(mime_and_base64.base64_string.empty() || mime_and_base64.mime_type.empty())");
-            continue;
-        }
-
-        std::vector<std::future<void>> futures{};
+    size_t models_count{0};
+    for (const auto &[provider_name, models] : models_by_provider)
+    {
+        models_count += models.size();
+    }
 
+    for (const size_t image_size : image_sizes)
+    {
+        LOG_INFO("image size: " + std::to_string(image_size));
+        for (size_t batch_begin = 0; batch_begin < selected_files.size(); batch_begin += images_in_flight)
         {
-            std::vector<std::string> models{
-                "gpt-4o",
-                "gpt-4o-mini",
-                "gpt-4.1",
-                "gpt-4.1-mini",
-                "o4-mini",
-            };
-
-            for (const auto &model : models)
-            {
-                const auto func_process = [=]()
-                {
-                    // std::this_thread::sleep_for(std::chrono::seconds{1});
-                    std::string folder_path = results_folder + "/" + model;
-                    std::string res_file_path = folder_path + "/" + image_file.filename().string() + ".json";
-                    LOG_INFO("Processing: " + res_file_path);
-
-                    fs::create_directories(folder_path);
-
-                    std::chrono::time_point start_point = std::chrono::system_clock::now();
-                    std::chrono::time_point end_point = std::chrono::system_clock::now();
-
-                    nlohmann::json res_json{};
-                    bool sucuess{false};
-                    while (!sucuess)
-                    {
-                        // std::this_thread::sleep_for(std::chrono::seconds{1});
-                        start_point = std::chrono::system_clock::now();
-                        if (!openai::jsonTextImg(model, Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, res_json))
-                        {
-                            LOG_ERROR("if (!openai::jsonTextImg(Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, res_json))");
-                            continue;
-                        }
-                        sucuess = true;
-                        end_point = std::chrono::system_clock::now();
-                    }
-
-                    res_json["time_spent"] = std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(end_point - start_point).count());
-
-                    std::ofstream file{res_file_path};
-                    if (!file)
-                    {
-                        LOG_ERROR("if(!file)");
-                        return;
-                    }
-                    file << res_json.dump();
-                };
+            const size_t batch_end = std::min(selected_files.size(), batch_begin + images_in_flight);
+            std::latch done{static_cast<std::ptrdiff_t>((batch_end - batch_begin) * models_count)};
+            std::vector<std::future<void>> futures{};
 
-                futures.emplace_back(std::async(func_process));
-            }
-        }
-
-        {
-            std::vector<std::string> models{
-                "gemini-2.0-flash",
-                "gemini-2.0-flash-lite",
-                "gemini-1.5-flash",
-                "gemini-2.0-flash-exp",
-                "gemini-2.5-flash-preview-05-20",
-                "gemini-2.5-pro-preview-05-06",
-            };
-
-            for (const auto &model : models)
+            for (size_t i = batch_begin; i < batch_end; ++i)
             {
-                const auto func_process = [=]()
+                const auto &image_file = selected_files[i];
+                const auto mime_and_base64 = loadImage(image_file, image_size, jpeg_quality);
+                if (mime_and_base64.base64_string.empty() || mime_and_base64.mime_type.empty())
                 {
-                    // std::this_thread::sleep_for(std::chrono::seconds{1});
-                    std::string folder_path = results_folder + "/" + model;
-                    std::string res_file_path = folder_path + "/" + image_file.filename().string() + ".json";
-                    LOG_INFO("Processing: " + res_file_path);
-
-                    fs::create_directories(folder_path);
-
-                    std::chrono::time_point start_point = std::chrono::system_clock::now();
-                    std::chrono::time_point end_point = std::chrono::system_clock::now();
+                    LOG_ERROR("if(mime_and_base64.base64_string.empty() || mime_and_base64.mime_type.empty())");
+                    done.count_down(static_cast<std::ptrdiff_t>(models_count));
+                    continue;
+                }
+                // Shared by the requests of every model instead of a copy each.
+                const auto base64_image = std::make_shared<const std::string>(mime_and_base64.base64_string);
+
+                for (const auto &[provider_name, models] : models_by_provider)
+                {
+                    const LlmProvider *provider = llmProviderOf(provider_name);
+                    for (const auto &model : models)
+                    {
+                        std::string folder_path = results_folder + "/" + model + size_suffix_of(image_size);
+                        std::string res_file_path = folder_path + "/" + image_file.filename().string() + ".json";
+                        LOG_INFO("Processing: " + res_file_path);
 
-                    nlohmann::json res_json{};
+                        fs::create_directories(folder_path);
 
-                    bool sucuess{false};
-                    while (!sucuess)
-                    {
-                        // std::this_thread::sleep_for(std::chrono::seconds{1});
-                        start_point = std::chrono::system_clock::now();
-                        if (!gemini::jsonTextImg(model, Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, res_json))
+                        if (!streaming)
                         {
-                            LOG_ERROR("if (!gemini::jsonTextImg(Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, res_json))");
+                            auto run = std::make_shared<AsyncRun>();
+                            run->provider = provider;
+                            run->request = provider->json_text_img_request(model, Prompts::prompt, mime_and_base64.mime_type, base64_image, Prompts::nutrition_schema);
+                            run->image_base64_size = mime_and_base64.base64_string.size();
+                            run->res_file_path = std::move(res_file_path);
+                            run->done = &done;
+                            postUntilSuccess(run);
                             continue;
                         }
-                        sucuess = true;
-                        end_point = std::chrono::system_clock::now();
-                    }
 
-                    res_json["time_spent"] = std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(end_point - start_point).count());
-
-                    std::ofstream file{res_file_path};
-                    if (!file)
-                    {
-                        LOG_ERROR("if(!file)");
-                        return;
+                        const auto func_process = [=, &done]()
+                        {
+                            std::chrono::time_point start_point = std::chrono::system_clock::now();
+                            std::chrono::system_clock::time_point first_product_point{};
+
+                            nlohmann::json res_json{};
+                            while (true)
+                            {
+                                start_point = std::chrono::system_clock::now();
+                                first_product_point = std::chrono::system_clock::time_point{};
+                                const auto on_product = [&](const nlohmann::json &)
+                                {
+                                    if (first_product_point == std::chrono::system_clock::time_point{})
+                                    {
+                                        first_product_point = std::chrono::system_clock::now();
+                                    }
+                                };
+                                if (provider->json_text_img_stream(model, Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, on_product, res_json))
+                                {
+                                    break;
+                                }
+                                LOG_ERROR("if (!provider->json_text_img_stream(model, Prompts::prompt, mime_and_base64.mime_type, mime_and_base64.base64_string, Prompts::nutrition_schema, on_product, res_json))");
+                            }
+
+                            writeResult(res_file_path, res_json, mime_and_base64.base64_string.size(), start_point, std::chrono::system_clock::now(), first_product_point);
+                            done.count_down();
+                        };
+
+                        futures.emplace_back(std::async(std::launch::async, func_process));
                     }
-                    file << res_json.dump();
-                };
-
-                futures.emplace_back(std::async(func_process));
+                }
             }
-        }
 
-        for(const auto& fut : futures)
-        {
-            fut.wait();
+            done.wait();
         }
     }
 
     return 0;
-}
\ No newline at end of file
+}
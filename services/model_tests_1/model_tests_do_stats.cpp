@@ -80,6 +80,24 @@ int main()
         return res;
     };
 
+    // The sizes model_tests_1 ran with, see model_tests_image_sizes there.
+    std::vector<size_t> image_sizes{};
+    const nlohmann::json image_sizes_json = Cfg::getInstance().getCfgJson("model_tests_image_sizes");
+    if (image_sizes_json.is_array())
+    {
+        for (const auto &size : image_sizes_json)
+        {
+            if (size.is_number_unsigned())
+            {
+                image_sizes.push_back(size.get<size_t>());
+            }
+        }
+    }
+    if (image_sizes.empty())
+    {
+        image_sizes.push_back(0);
+    }
+
     struct PhotoStats
     {
         std::string image_path{};
@@ -87,17 +105,30 @@ int main()
         float carbs{0.0f};
         float accuracy{0.0f};
         float time_ms{0.0f};
+        float image_kb{0.0f};
     };
 
     struct ModelStats
     {
         std::string model_name{};
+        size_t image_size{0};
         float accuracy{0.0f};
         float avg_time_ms{0.0f};
+        float avg_image_kb{0.0f};
     };
 
     std::unordered_map<std::string, std::vector<PhotoStats>> model_photo_stats{};
-    for (const auto &model : models)
+    // Results of the original photo are under the model name, the other sizes under <model>@<size>.
+    std::unordered_map<std::string, size_t> image_size_of_model{};
+    for (const size_t image_size : image_sizes)
+    {
+        for (const auto &model : models)
+        {
+            image_size_of_model[model + (image_size ? "@" + std::to_string(image_size) : std::string{})] = image_size;
+        }
+    }
+
+    for (const auto &[model, image_size] : image_size_of_model)
     {
         for (const auto &image_file : image_files)
         {
@@ -116,14 +147,13 @@ int main()
                 continue;
             }
 
-            if (!nlohmann::json::accept(json_str))
+            nlohmann::json json_obj{};
+            if (!parseJson(json_str, json_obj))
             {
-                LOG_ERROR("if(!nlohmann::json::accept(json_str))");
+                LOG_ERROR("if(!parseJson(json_str, json_obj))");
                 continue;
             }
 
-            nlohmann::json json_obj = nlohmann::json::parse(json_str);
-
             float total_carbs{0.0f};
             if (json_obj.contains("products") && json_obj["products"].is_array() && json_obj["products"].size())
             {
@@ -157,6 +187,16 @@ int main()
                 }
             }
 
+            float image_kb{0.0f};
+            if (json_obj.contains("image_base64_size"))
+            {
+                auto val_opt = get_float_smart(json_obj, "image_base64_size");
+                if (val_opt)
+                {
+                    image_kb = val_opt.value() / 1024.0f;
+                }
+            }
+
             float true_total_carbs{0.0f};
             {
                 std::string true_carbs_str = getFileAsString(true_result_file_path);
@@ -177,6 +217,7 @@ int main()
             stats.true_carbs = true_total_carbs;
             stats.image_path = image_file.filename().string();
             stats.time_ms = time_ms;
+            stats.image_kb = image_kb;
 
             model_photo_stats[model].push_back(stats);
         }
@@ -188,25 +229,30 @@ int main()
     {
         ModelStats model_stats{};
         model_stats.model_name = model;
+        model_stats.image_size = image_size_of_model[model];
         
         for(const auto& stat : stats)
         {
             model_stats.avg_time_ms += stat.time_ms;
             model_stats.accuracy += stat.accuracy;
+            model_stats.avg_image_kb += stat.image_kb;
         }
 
         model_stats.avg_time_ms /= stats.size();
         model_stats.accuracy /= stats.size();
+        model_stats.avg_image_kb /= stats.size();
 
         all_model_stats[model_stats.model_name] = model_stats;
     }
 
     std::string res_csv_string{};
-    res_csv_string += "\"Model\",\"AvgTime\",\"Accuracy\"\n";
+    res_csv_string += "\"Model\",\"ImageSize\",\"AvgImageKB\",\"AvgTime\",\"Accuracy\"\n";
 
     for(const auto& [model, stats] : all_model_stats)
     {
         res_csv_string += "\"" + stats.model_name + "\",";
+        res_csv_string += "\"" + std::to_string(stats.image_size) + "\",";
+        res_csv_string += "\"" + floatToStringWithPrecision(stats.avg_image_kb) + "\",";
         res_csv_string += "\"" + floatToStringWithPrecision(stats.avg_time_ms) + "\",";
         res_csv_string += "\"" + floatToStringWithPrecision(stats.accuracy) + "\"";
         res_csv_string += "\n";
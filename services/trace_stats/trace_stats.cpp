@@ -0,0 +1,135 @@
+#include "functions.hpp"
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+// Aggregates the spans written by TraceWriter into per stage latency percentiles.
+// Stages are listed in pipeline order (mean offset from the start of their trace), "end_to_end" spans
+// from the first to the last span of every trace that reached the requester.
+// Usage: trace_stats [trace_file], defaults to the "trace_file_path" cfg key.
+
+struct StageStats
+{
+    std::vector<int64_t> durations_us{};
+    size_t errors{0};
+    double offset_sum_us{0.0};
+};
+
+static double percentileMs(std::vector<int64_t> &sorted_us, double p)
+{
+    if (sorted_us.empty())
+    {
+        return 0.0;
+    }
+    const size_t index = std::min(sorted_us.size() - 1, static_cast<size_t>(p / 100.0 * static_cast<double>(sorted_us.size())));
+    return static_cast<double>(sorted_us[index]) / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string trace_file = argc > 1 ? argv[1] : "";
+    if (trace_file.empty())
+    {
+        if (!Cfg::getInstance().loadFromEnv())
+        {
+            LOG_ERROR("if(!Cfg::getInstance().loadFromEnv())");
+            return 1;
+        }
+        trace_file = Cfg::getInstance().getCfgValueOr("trace_file_path", "");
+    }
+
+    std::ifstream file{trace_file};
+    if (!file)
+    {
+        LOG_ERROR("can not open trace file: " + trace_file);
+        return 1;
+    }
+
+    struct Span
+    {
+        std::string stage{};
+        int64_t start_us{0};
+        int64_t duration_us{0};
+        bool ok{false};
+    };
+
+    std::unordered_map<std::string, std::vector<Span>> traces{};
+    size_t bad_lines{0};
+    std::string line{};
+    nlohmann::json obj{};
+    while (std::getline(file, line))
+    {
+        if (line.empty())
+        {
+            continue;
+        }
+        if (!parseJson(line, obj) || !obj.contains("trace_id") || !obj.contains("stage") || !obj.contains("start_us") || !obj.contains("duration_us"))
+        {
+            ++bad_lines;
+            continue;
+        }
+        traces[obj["trace_id"].get<std::string>()].push_back(Span{obj["stage"].get<std::string>(), obj["start_us"].get<int64_t>(), obj["duration_us"].get<int64_t>(), obj.value("ok", false)});
+    }
+
+    std::map<std::string, StageStats> stages{};
+    std::vector<int64_t> end_to_end_us{};
+    for (const auto &[trace_id, spans] : traces)
+    {
+        int64_t first_us = spans.front().start_us;
+        int64_t last_us = spans.front().start_us + spans.front().duration_us;
+        bool has_requester_stage{false};
+        for (const auto &span : spans)
+        {
+            first_us = std::min(first_us, span.start_us);
+            last_us = std::max(last_us, span.start_us + span.duration_us);
+            has_requester_stage = has_requester_stage || span.stage == "queue_wait";
+        }
+
+        for (const auto &span : spans)
+        {
+            auto &stage = stages[span.stage];
+            stage.durations_us.push_back(span.duration_us);
+            stage.errors += span.ok ? 0 : 1;
+            stage.offset_sum_us += static_cast<double>(span.start_us - first_us);
+        }
+
+        if (has_requester_stage)
+        {
+            end_to_end_us.push_back(last_us - first_us);
+        }
+    }
+
+    std::vector<std::pair<double, std::string>> order{};
+    for (auto &[name, stage] : stages)
+    {
+        std::sort(stage.durations_us.begin(), stage.durations_us.end());
+        order.emplace_back(stage.offset_sum_us / static_cast<double>(stage.durations_us.size()), name);
+    }
+    std::sort(order.begin(), order.end());
+    std::sort(end_to_end_us.begin(), end_to_end_us.end());
+
+    double end_to_end_mean_ms{0.0};
+    for (const auto us : end_to_end_us)
+    {
+        end_to_end_mean_ms += static_cast<double>(us) / 1000.0 / static_cast<double>(end_to_end_us.size());
+    }
+
+    LOG_INFOF("traces: %zu complete: %zu bad lines: %zu", traces.size(), end_to_end_us.size(), bad_lines);
+    LOG_INFOF("%-16s %8s %6s %10s %10s %10s %10s %10s %7s", "stage", "count", "errors", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms", "share");
+    for (const auto &[offset, name] : order)
+    {
+        auto &stage = stages[name];
+        double mean_ms{0.0};
+        for (const auto us : stage.durations_us)
+        {
+            mean_ms += static_cast<double>(us) / 1000.0 / static_cast<double>(stage.durations_us.size());
+        }
+        // Share of the mean end to end time, stages that overlap (web_total) add up to more than 100%.
+        const double share = end_to_end_mean_ms > 0.0 ? mean_ms / end_to_end_mean_ms * 100.0 : 0.0;
+        LOG_INFOF("%-16s %8zu %6zu %10.2f %10.2f %10.2f %10.2f %10.2f %6.1f%%", name.c_str(), stage.durations_us.size(), stage.errors, mean_ms,
+                  percentileMs(stage.durations_us, 50.0), percentileMs(stage.durations_us, 90.0), percentileMs(stage.durations_us, 99.0), percentileMs(stage.durations_us, 100.0), share);
+    }
+    LOG_INFOF("%-16s %8zu %6s %10.2f %10.2f %10.2f %10.2f %10.2f", "end_to_end", end_to_end_us.size(), "-", end_to_end_mean_ms,
+              percentileMs(end_to_end_us, 50.0), percentileMs(end_to_end_us, 90.0), percentileMs(end_to_end_us, 99.0), percentileMs(end_to_end_us, 100.0));
+    return 0;
+}
@@ -1,6 +1,6 @@
 #include "AuthenticatorController.h"
 
-void AuthenticatorController::register_user(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const
+Task<> AuthenticatorController::register_user(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
 {
     const std::string &email = req->getParameter("email");
     const std::string &password = req->getParameter("password");
@@ -11,21 +11,21 @@ void AuthenticatorController::register_user(const HttpRequestPtr &req, std::func
     else
     {
         responseWithErrorMsg(callback, "Incorrect email or password.");
-        return;
+        co_return;
     }
 
-    auto client = drogon::app().getDbClient("dd");
+    auto client = getDdDbClient();
     std::string uuid{};
 
     try
     {
         {
             static const std::string query = "select count(*) from Users where Email = ?";
-            const auto result = client->execSqlSync(query, email);
+            const auto result = co_await execSqlMeasured(client, query, email);
             if (result[0][0].as<size_t>() >= 1)
             {
                 responseWithErrorMsg(callback, "There is already user with such email.");
-                return;
+                co_return;
             }
         }
 
@@ -33,7 +33,7 @@ void AuthenticatorController::register_user(const HttpRequestPtr &req, std::func
         {
             uuid = drogon::utils::getUuid();
             static const std::string query = "select count(*) from Users where UUID = ?";
-            const auto result = client->execSqlSync(query, uuid);
+            const auto result = co_await execSqlMeasured(client, query, uuid);
             if (result[0][0].as<size_t>() <= 0)
             {
                 break;
@@ -42,21 +42,25 @@ void AuthenticatorController::register_user(const HttpRequestPtr &req, std::func
 
         {
             static const std::string query = "insert into Users (Email, Password, UUID) values (?, ?, ?)";
-            client->execSqlSync(query, email, password, uuid);
+            const auto result = co_await execSqlMeasured(client, query, email, password, uuid);
+            if (result.insertId())
+            {
+                SessionCache::getInstance().put(uuid, result.insertId());
+            }
         }
 
         responseWithSuccess(callback, {{"UUID", uuid}});
-        return;
+        co_return;
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
         LOG_ERROR(e.base().what());
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return;
     }
 }
 
-void AuthenticatorController::login_user(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const
+Task<> AuthenticatorController::login_user(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
 {
     const std::string &email = req->getParameter("email");
     const std::string &password = req->getParameter("password");
@@ -68,41 +72,42 @@ void AuthenticatorController::login_user(const HttpRequestPtr &req, std::functio
     else
     {
         responseWithErrorMsg(callback, "Incorrect email or password.");
-        return;
+        co_return;
     }
 
-    auto client = drogon::app().getDbClient("dd");
+    auto client = getDdDbClient();
 
     try
     {
-        static const std::string query = "select UUID from Users where Email = ? and Password = ?";
-        const auto result = client->execSqlSync(query, email, password);
+        static const std::string query = "select ID, UUID from Users where Email = ? and Password = ?";
+        const auto result = co_await execSqlMeasured(client, query, email, password);
         if (result.empty())
         {
             responseWithErrorMsg(callback, "Wrong email or password");
-            return;
+            co_return;
         }
 
         std::string uuid = result[0]["UUID"].as<std::string>();
+        SessionCache::getInstance().put(uuid, result[0]["ID"].as<size_t>());
 
         responseWithSuccess(callback, {{"UUID", uuid}});
-        return;
+        co_return;
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
         LOG_ERROR(e.base().what());
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return;
     }
 }
 
-void AuthenticatorController::add_record(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const
+Task<> AuthenticatorController::add_record(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
 {
-    const auto user_identity = getUserIdentity(req);
+    const auto user_identity = co_await getUserIdentity(req);
     if (!user_identity.isCorrect())
     {
         responseWithNotLoggedIn(callback);
-        return;
+        co_return;
     }
 
     std::string time_coefficient = req->getParameter("time_coefficient");
@@ -140,35 +145,35 @@ void AuthenticatorController::add_record(const HttpRequestPtr &req, std::functio
     if (!isFloat(time_coefficient))
     {
         responseWithErrorMsg(callback, "time_coefficient is not NULL and not float.");
-        return;
+        co_return;
     }
     if (!isFloat(sport_coefficient))
     {
         responseWithErrorMsg(callback, "sport_coefficient is not NULL and not float.");
-        return;
+        co_return;
     }
     if (!isFloat(personal_coefficient))
     {
         responseWithErrorMsg(callback, "personal_coefficient is not NULL and not float.");
-        return;
+        co_return;
     }
     if (!isFloat(insulin))
     {
         responseWithErrorMsg(callback, "insulin is not NULL and not float.");
-        return;
+        co_return;
     }
     if (!isFloat(carbohydrates))
     {
         responseWithErrorMsg(callback, "carbohydrates is not NULL and not float.");
-        return;
+        co_return;
     }
     if(request_id != "NULL" && stringToSizeT(request_id) <= 0)
     {
         responseWithErrorMsg(callback, "Incorrect request_id.");
-        return;
+        co_return;
     }
 
-    auto client = drogon::app().getDbClient("dd");
+    auto client = getDdDbClient();
 
     try
     {
@@ -176,60 +181,60 @@ void AuthenticatorController::add_record(const HttpRequestPtr &req, std::functio
             "insert into Records "
             "(UserID,FoodRecognitionID,Insulin,Carbohydrates,TimeCoefficient,SportCoefficient,PersonalCoefficient) "
             "values (?, " + request_id + ", ?, ?, ?, ?, ?)";
-        const auto result = client->execSqlSync(
-            query, std::to_string(user_identity.id), insulin, carbohydrates, time_coefficient, sport_coefficient, personal_coefficient);
+        const auto result = co_await execSqlMeasured(
+            client, query, std::to_string(user_identity.id), insulin, carbohydrates, time_coefficient, sport_coefficient, personal_coefficient);
 
         responseWithSuccess(callback, "{}");
-        return;
+        co_return;
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
         LOG_ERROR(e.base().what());
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return;
     }
 }
 
-void AuthenticatorController::get_record_ids(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const
+Task<> AuthenticatorController::get_record_ids(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
 {
-    const auto user_identity = getUserIdentity(req);
+    const auto user_identity = co_await getUserIdentity(req);
     if (!user_identity.isCorrect())
     {
         responseWithNotLoggedIn(callback);
-        return;
+        co_return;
     }
 
-    auto client = drogon::app().getDbClient("dd");
+    auto client = getDdDbClient();
 
     try
     {
         nlohmann::json res_json = nlohmann::json::array();
 
         static const std::string query = "select ID from Records where UserID = ? order by ID desc";
-        const auto result = client->execSqlSync(query, std::to_string(user_identity.id));
+        const auto result = co_await execSqlMeasured(client, query, std::to_string(user_identity.id));
         for(auto& res : result)
         {
             res_json.push_back(res["ID"].as<std::string>());
         }
 
         responseWithSuccess(callback, res_json);
-        return;
+        co_return;
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
         LOG_ERROR(e.base().what());
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return;
     }
 }
 
-void AuthenticatorController::get_records_by_ids(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const
+Task<> AuthenticatorController::get_records_by_ids(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
 {
-    const auto user_identity = getUserIdentity(req);
+    const auto user_identity = co_await getUserIdentity(req);
     if (!user_identity.isCorrect())
     {
         responseWithNotLoggedIn(callback);
-        return;
+        co_return;
     }
 
     std::vector<size_t> ids_int_vec{};
@@ -238,7 +243,7 @@ void AuthenticatorController::get_records_by_ids(const HttpRequestPtr &req, std:
         if(ids_str.empty())
         {
             responseWithErrorMsg(callback, "ids is empty.");
-            return;
+            co_return;
         }
 
         auto ids_vec = split_trim(ids_str, ",");
@@ -250,7 +255,7 @@ void AuthenticatorController::get_records_by_ids(const HttpRequestPtr &req, std:
         if(ids_vec.empty())
         {
             responseWithErrorMsg(callback, "ids is empty.");
-            return;
+            co_return;
         }
         
         for(auto& id : ids_vec)
@@ -265,7 +270,7 @@ void AuthenticatorController::get_records_by_ids(const HttpRequestPtr &req, std:
         if(ids_int_vec.empty())
         {
             responseWithErrorMsg(callback, "ids is empty.");
-            return;
+            co_return;
         }
     }
 
@@ -279,7 +284,7 @@ void AuthenticatorController::get_records_by_ids(const HttpRequestPtr &req, std:
         ids_int_str += std::to_string(id_int);
     }
 
-    auto client = drogon::app().getDbClient("dd");
+    auto client = getDdDbClient();
 
     try
     {
@@ -288,7 +293,7 @@ void AuthenticatorController::get_records_by_ids(const HttpRequestPtr &req, std:
         std::unordered_map<size_t, nlohmann::json> id_to_obj{};
 
         const std::string query = "select * from Records where UserID = ? and ID in (" + ids_int_str + ")";
-        const auto result = client->execSqlSync(query, std::to_string(user_identity.id));
+        const auto result = co_await execSqlMeasured(client, query, std::to_string(user_identity.id));
         for(auto& res : result)
         {
             nlohmann::json tmp_obj{};
@@ -319,12 +324,12 @@ void AuthenticatorController::get_records_by_ids(const HttpRequestPtr &req, std:
         }
 
         responseWithSuccess(callback, res_json);
-        return;
+        co_return;
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
         LOG_ERROR(e.base().what());
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return;
     }
-}
\ No newline at end of file
+}
@@ -16,9 +16,9 @@ public:
   ADD_METHOD_TO(AuthenticatorController::get_records_by_ids, "/get_records_by_ids", {Post, Get});
   METHOD_LIST_END
 
-  void register_user(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const;
-  void login_user(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const;
-  void add_record(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const;
-  void get_record_ids(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const;
-  void get_records_by_ids(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const;
+  Task<> register_user(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
+  Task<> login_user(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
+  Task<> add_record(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
+  Task<> get_record_ids(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
+  Task<> get_records_by_ids(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
 };
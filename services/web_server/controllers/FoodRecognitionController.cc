@@ -1,16 +1,41 @@
 #include "FoodRecognitionController.h"
+#include "result_notifier.hpp"
+#include "trace.hpp"
 
-void FoodRecognitionController::recognize_food(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const
+// Name of a FoodRecognitions.Status value as returned to clients, empty for an unknown value.
+static std::string statusNameOf(const std::string &status)
 {
-    const auto user_identity = getUserIdentity(req);
-    if (!user_identity.isCorrect())
+    if(FoodRecognitions::Status::Waiting == status)
     {
-        responseWithNotLoggedIn(callback);
-        return;
+        return "Waiting";
+    }
+    else if(FoodRecognitions::Status::Processing == status)
+    {
+        return "Processing";
+    }
+    else if(FoodRecognitions::Status::Error == status)
+    {
+        return "Error";
+    }
+    else if(FoodRecognitions::Status::Done == status)
+    {
+        return "Done";
     }
+    return {};
+}
 
+// Common tail of recognize_food and recognize_food_binary.
+// photo_bytes must stay valid until the returned task completes, it is written to photos storage as is.
+// Returns false once an error response was sent. trace_id travels with the AMQP message so the
+// requester's stages join the same trace.
+// The message is not published here: its RecognitionOutbox row commits together with the recognition and
+// the requester's OutboxRelay publishes it, so the response never waits on RabbitMQ or fails with it.
+static Task<bool> submitRecognition(const UserIdentity &user_identity, const std::string &mime_type, std::string_view photo_bytes, const std::string &trace_id, std::function<void(const HttpResponsePtr &)> &callback)
+{
+    // Every failure below sets is_error and returns. The rows are written in one transaction that is rolled back
+    // on failure, so the photo is all there is to undo.
     bool is_error{false};
-    auto client = drogon::app().getDbClient("dd");
+    auto client = getDdDbClient();
     std::string request_id{};
     std::string full_photo_path{};
 
@@ -21,22 +46,6 @@ void FoodRecognitionController::recognize_food(const HttpRequestPtr &req, std::f
             {
                 return;
             }
-            auto client = drogon::app().getDbClient("dd");
-            if (request_id.size())
-            {
-                try
-                {
-                    static const std::string query = "delete from FoodRecognitions where id = ?";
-                    client->execSqlSync(query, request_id);
-                }
-                catch (const drogon::orm::DrogonDbException &e)
-                {
-                    LOG_ERROR(e.base().what());
-                    responseWithErrorMsg(callback, "Internal server error.");
-                    return;
-                }
-            }
-
             if (full_photo_path.size())
             {
                 try
@@ -51,114 +60,202 @@ void FoodRecognitionController::recognize_food(const HttpRequestPtr &req, std::f
         });
 
     static const std::string photos_folder_path = Cfg::getInstance().getCfgValue("photos_storage_absolute_path");
-    const auto &base64_string = req->getParameter("base64_string");
-    const auto &mime_type = req->getParameter("mime_type");
 
-    if (base64_string.empty() || base64_string.empty())
+    const std::string photo_ext = ext_of_mime_type(mime_type);
+    if(photo_ext.empty())
     {
         is_error = true;
-        responseWithErrorMsg(callback, "base64_string or mime_type is empty.");
-        return;
+        LOG_ERROR("if(photo_ext.empty())");
+        responseWithErrorMsg(callback, "Unsupported mime_type.");
+        co_return false;
     }
-
-    const auto decoded_image_data = base64_decode(base64_string);
-    if(decoded_image_data.empty())
+    
+    // The file name does not depend on the row, so the file is written first and the row is inserted
+    // complete with its ImagePath in one statement.
+    const std::string photo_name = newUuidV4();
+    if(photo_name.empty())
     {
         is_error = true;
-        LOG_ERROR("if(decoded_image_data.empty())");
+        LOG_ERROR("if(photo_name.empty())");
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return false;
     }
 
-    const std::string photo_ext = ext_of_mime_type(mime_type);
-    if(photo_ext.empty())
+    full_photo_path = photos_folder_path + "/" + photo_name + "." + photo_ext;
     {
-        is_error = true;
-        LOG_ERROR("if(photo_ext.empty())");
-        responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        TraceSpan span{trace_id, "file_write"};
+        if(!writeBytesToFile(full_photo_path, photo_bytes))
+        {
+            is_error = true;
+            LOG_ERROR("if(!writeBytesToFile(full_photo_path, photo_bytes))");
+            responseWithErrorMsg(callback, "Internal server error.");
+            co_return false;
+        }
+        span.succeed();
     }
-    
+
     try
     {
+        TraceSpan span{trace_id, "db_insert"};
+        auto transaction = co_await client->newTransactionCoro();
+        static const std::string query = "insert into FoodRecognitions (UserID, Status, ImagePath) values (?, ?, ?)";
+        const auto result = co_await execSqlMeasured(transaction, query, std::to_string(user_identity.id), FoodRecognitions::Status::Waiting, full_photo_path);
+
+        // LAST_INSERT_ID() is per connection, a follow-up select may land on another connection of the pool.
+        const size_t request_id_int = result.insertId();
+        if (request_id_int == 0)
         {
-            static const std::string query = "insert into FoodRecognitions (UserID, Status) values (?, ?)";
-            client->execSqlSync(query, std::to_string(user_identity.id), FoodRecognitions::Status::Waiting);
+            is_error = true;
+            transaction->rollback();
+            LOG_ERROR("if (request_id_int == 0)");
+            responseWithErrorMsg(callback, "Internal server error.");
+            co_return false;
         }
 
-        {
-            static const std::string query = "SELECT LAST_INSERT_ID()";
-            const auto result = client->execSqlSync(query);
-            size_t request_id_int = result[0][0].as<size_t>();
-            if (request_id_int == 0)
-            {
-                LOG_ERROR("if (request_id_int == 0)");
-                responseWithError(callback, "Internal server error.");
-                return;
-            }
+        // EnqueuedUs lets the requester record how long the message waited, in the outbox and in the queue.
+        static const std::string outbox_query = "insert into RecognitionOutbox (FoodRecognitionID, TraceID, EnqueuedUs) values (?, ?, ?)";
+        co_await execSqlMeasured(transaction, outbox_query, std::to_string(request_id_int), trace_id, TraceWriter::nowUs());
+        co_await commitTransaction(std::move(transaction));
 
-            request_id = std::to_string(request_id_int);
-        }
+        request_id = std::to_string(request_id_int);
+        span.succeed();
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
         is_error = true;
         LOG_ERROR(e.base().what());
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return false;
+    }
+    catch (const std::exception &e)
+    {
+        is_error = true;
+        LOG_ERROR(e.what());
+        responseWithErrorMsg(callback, "Internal server error.");
+        co_return false;
     }
 
+    nlohmann::json food_obj{};
+    food_obj["FoodRecognitionID"] = request_id;
 
+    is_error = false;
+    responseWithSuccess(callback, food_obj);
+    co_return true;
+}
 
-    full_photo_path = photos_folder_path + "/" + request_id + "." + photo_ext;
-    if(!writeBytesToFile(full_photo_path, decoded_image_data))
+Task<> FoodRecognitionController::recognize_food(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
+{
+    const auto user_identity = co_await getUserIdentity(req);
+    if (!user_identity.isCorrect())
     {
-        is_error = true;
-        LOG_ERROR("if(!writeBytesToFile(full_photo_path, decoded_image_data))");
-        responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        responseWithNotLoggedIn(callback);
+        co_return;
     }
 
-    try
+    const auto &base64_string = req->getParameter("base64_string");
+    const auto &mime_type = req->getParameter("mime_type");
+
+    if (base64_string.empty() || mime_type.empty())
     {
-        static const std::string query = "update FoodRecognitions set ImagePath = ? where id = ?";
-        client->execSqlSync(query, full_photo_path, request_id);
+        responseWithErrorMsg(callback, "base64_string or mime_type is empty.");
+        co_return;
     }
-    catch (const drogon::orm::DrogonDbException &e)
+
+    const std::string trace_id = TraceWriter::newTraceId();
+    TraceSpan total_span{trace_id, "web_total"};
+
+    std::vector<unsigned char> decoded_image_data{};
     {
-        is_error = true;
-        LOG_ERROR(e.base().what());
-        responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        TraceSpan span{trace_id, "decode"};
+        decoded_image_data = base64_decode(base64_string);
+        if(decoded_image_data.empty())
+        {
+            LOG_ERROR("if(decoded_image_data.empty())");
+            responseWithErrorMsg(callback, "Internal server error.");
+            co_return;
+        }
+        span.succeed();
     }
 
-    nlohmann::json food_obj{};
-    food_obj["FoodRecognitionID"] = request_id;
+    const std::string_view photo_bytes{reinterpret_cast<const char *>(decoded_image_data.data()), decoded_image_data.size()};
+    if (co_await submitRecognition(user_identity, mime_type, photo_bytes, trace_id, callback))
+    {
+        total_span.succeed();
+    }
+}
 
-    if(!getRabbitMqPublisher().publish("recognize_food", food_obj.dump()))
+Task<> FoodRecognitionController::recognize_food_binary(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
+{
+    const auto user_identity = co_await getUserIdentity(req);
+    if (!user_identity.isCorrect())
     {
-        is_error = true;
-        LOG_ERROR("failed to publish");
-        responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        responseWithNotLoggedIn(callback);
+        co_return;
     }
 
-    is_error = false;
-    responseWithSuccess(callback, food_obj);
-    return;
+    // Bodies above drogon's client_max_memory_body_size are spooled to a temp file and body() maps it,
+    // so the photo is copied once from that mapping into photos storage and never held as base64.
+    std::string mime_type{};
+    std::string_view photo_bytes{};
+    MultiPartParser parser{};
+
+    const std::string trace_id = TraceWriter::newTraceId();
+    TraceSpan total_span{trace_id, "web_total"};
+
+    if (req->contentType() == CT_MULTIPART_FORM_DATA)
+    {
+        TraceSpan span{trace_id, "decode"};
+        if (parser.parse(req) != 0 || parser.getFiles().empty())
+        {
+            responseWithErrorMsg(callback, "No photo in multipart body.");
+            co_return;
+        }
+
+        const auto &file = parser.getFiles()[0];
+        photo_bytes = file.fileContent();
+
+        const auto &params = parser.getParameters();
+        const auto mime_type_it = params.find("mime_type");
+        if (mime_type_it != params.end())
+        {
+            mime_type = mime_type_it->second;
+        }
+        else
+        {
+            mime_type = mime_type_of_ext(std::string{file.getFileExtension()});
+        }
+        span.succeed();
+    }
+    else
+    {
+        const std::string &content_type = req->getHeader("content-type");
+        mime_type = trim(content_type.substr(0, content_type.find(';')));
+        photo_bytes = req->body();
+    }
+
+    if (photo_bytes.empty() || mime_type.empty())
+    {
+        responseWithErrorMsg(callback, "photo or mime_type is empty.");
+        co_return;
+    }
+
+    if (co_await submitRecognition(user_identity, mime_type, photo_bytes, trace_id, callback))
+    {
+        total_span.succeed();
+    }
 }
 
-void FoodRecognitionController::edit_result(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const
+Task<> FoodRecognitionController::edit_result(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
 {
     LOG_INFO("here");
-    const auto user_identity = getUserIdentity(req);
+    const auto user_identity = co_await getUserIdentity(req);
     if (!user_identity.isCorrect())
     {
         responseWithNotLoggedIn(callback);
-        return;
+        co_return;
     }
 
-    auto client = drogon::app().getDbClient("dd");
+    auto client = getDdDbClient();
 
     const std::string req_id = req->getParameter("request_id");
     const std::string new_json_str = req->getParameter("new_json");
@@ -167,155 +264,213 @@ void FoodRecognitionController::edit_result(const HttpRequestPtr &req, std::func
     if (req_id.empty() || stringToSizeT(req_id) <= 0)
     {
         responseWithErrorMsg(callback, "request_id is empty.");
-        return;
+        co_return;
     }
 
     if (new_json_str.empty())
     {
         responseWithErrorMsg(callback, "new_json is empty.");
-        return;
+        co_return;
     }
 
-    if (!nlohmann::json::accept(new_json_str))
+    nlohmann::json new_json{};
+    if (!parseJson(new_json_str, new_json))
     {
         responseWithErrorMsg(callback, "new_json is not complete json.");
-        return;
+        co_return;
     }
 
-    nlohmann::json new_json = nlohmann::json::parse(new_json_str);
-
     try
     {
         static const std::string query = "update FoodRecognitions set ResultJson = ? where id = ?";
-        const auto result = client->execSqlSync(query, new_json.dump(), req_id);
+        const auto result = co_await execSqlMeasured(client, query, new_json.dump(), req_id);
 
         responseWithSuccess(callback, "{}");
-        return;
+        co_return;
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
         LOG_ERROR(e.base().what());
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return;
     }
 }
 
-void FoodRecognitionController::get_status(const HttpRequestPtr & req, std::function<void(const HttpResponsePtr&)>&& callback) const
+Task<> FoodRecognitionController::get_status(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
 {
-    const auto user_identity = getUserIdentity(req);
+    const auto user_identity = co_await getUserIdentity(req);
     if (!user_identity.isCorrect())
     {
         responseWithNotLoggedIn(callback);
-        return;
+        co_return;
     }
 
-    auto client = drogon::app().getDbClient("dd");
+    auto client = getDdDbClient();
 
     const std::string req_id = req->getParameter("request_id");
     if(req_id.empty() || stringToSizeT(req_id) <= 0)
     {
         responseWithErrorMsg(callback, "req_id is empty.");
-        return;
+        co_return;
     }
 
     try
     {
         static const std::string query = "select Status from FoodRecognitions where id = ?";
-        const auto result = client->execSqlSync(query, req_id);
+        const auto result = co_await execSqlMeasured(client, query, req_id);
 
         if(result.size() <= 0)
         {
             responseWithErrorMsg(callback, "No such reqeust.");
-            return;
+            co_return;
         }
 
         nlohmann::json res_json{};
 
         for(auto& row : result)
         {
-            std::string status_int = row["Status"].as<std::string>();
-            if(FoodRecognitions::Status::Waiting == status_int)
-            {
-                res_json["Status"] = "Waiting";
-            }
-            else if(FoodRecognitions::Status::Processing == status_int)
-            {
-                res_json["Status"] = "Processing";
-            }
-            else if(FoodRecognitions::Status::Error == status_int)
-            {
-                res_json["Status"] = "Error";
-            }
-            else if(FoodRecognitions::Status::Done == status_int)
-            {
-                res_json["Status"] = "Done";
-            }
-            else
+            const std::string status_name = statusNameOf(row["Status"].as<std::string>());
+            if(status_name.empty())
             {
                 responseWithErrorMsg(callback, "Internal server error.");
-                return;
+                co_return;
             }
+            res_json["Status"] = status_name;
             responseWithSuccess(callback, res_json);
-            return;
+            co_return;
         }
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
         LOG_ERROR(e.base().what());
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return;
     }
 }
 
-void FoodRecognitionController::get_result(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const
+Task<> FoodRecognitionController::get_result(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
 {
-    const auto user_identity = getUserIdentity(req);
+    const auto user_identity = co_await getUserIdentity(req);
     if (!user_identity.isCorrect())
     {
         responseWithNotLoggedIn(callback);
-        return;
+        co_return;
     }
 
-    auto client = drogon::app().getDbClient("dd");
+    auto client = getDdDbClient();
 
     const std::string req_id = req->getParameter("request_id");
     if(req_id.empty() || stringToSizeT(req_id) <= 0)
     {
         responseWithErrorMsg(callback, "request_id is empty.");
-        return;
+        co_return;
     }
 
     try
     {
         static const std::string query = "select ResultJson from FoodRecognitions where id = ? and Status = ?";
-        const auto result = client->execSqlSync(query, req_id, FoodRecognitions::Status::Done);
+        const auto result = co_await execSqlMeasured(client, query, req_id, FoodRecognitions::Status::Done);
 
         if(result.size() <= 0)
         {
             responseWithErrorMsg(callback, "No such reqeust.");
-            return;
+            co_return;
         }
 
         nlohmann::json res_json{};
 
         for(auto& row : result)
         {
-            std::string result_json_str = row["ResultJson"].as<std::string>();
-
-            if(!nlohmann::json::accept(result_json_str))
+            const auto info_json = parseJson(row["ResultJson"].as<std::string>());
+            if(!info_json)
             {
                 responseWithErrorMsg(callback, "Internal server error.");
-                return;
+                co_return;
             }
-            auto info_json = nlohmann::json::parse(result_json_str);
-            responseWithSuccess(callback, info_json);
-            return;
+            responseWithSuccess(callback, *info_json);
+            co_return;
         }
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
         LOG_ERROR(e.base().what());
         responseWithErrorMsg(callback, "Internal server error.");
-        return;
+        co_return;
     }
 }
+
+Task<> FoodRecognitionController::wait_result(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const
+{
+    const auto user_identity = co_await getUserIdentity(req);
+    if (!user_identity.isCorrect())
+    {
+        responseWithNotLoggedIn(callback);
+        co_return;
+    }
+
+    auto client = getDdDbClient();
+
+    const std::string req_id = req->getParameter("request_id");
+    if(req_id.empty() || stringToSizeT(req_id) <= 0)
+    {
+        responseWithErrorMsg(callback, "request_id is empty.");
+        co_return;
+    }
+
+    static const double default_timeout_sec = Cfg::getInstance().getCfgDouble("wait_result_timeout_sec", 25.0);
+    static const double max_timeout_sec = Cfg::getInstance().getCfgDouble("wait_result_max_timeout_sec", 60.0);
+    double timeout_sec = default_timeout_sec;
+    const std::string &timeout_str = req->getParameter("timeout_sec");
+    if(timeout_str.size())
+    {
+        timeout_sec = std::clamp<double>(stringToFloat(timeout_str), 0.0, max_timeout_sec);
+    }
+
+    // Subscribed before the select, a notification published in between is not lost.
+    auto &notifier = ResultNotifier::getInstance();
+    auto waiter = notifier.subscribe(req_id);
+    const auto scope_exit = makeScopeExit([&]()
+                                          { notifier.unsubscribe(req_id, waiter); });
+
+    std::string status{};
+    try
+    {
+        static const std::string query = "select Status from FoodRecognitions where id = ?";
+        const auto result = co_await execSqlMeasured(client, query, req_id);
+
+        if(result.size() <= 0)
+        {
+            responseWithErrorMsg(callback, "No such reqeust.");
+            co_return;
+        }
+        status = result[0]["Status"].as<std::string>();
+    }
+    catch (const drogon::orm::DrogonDbException &e)
+    {
+        LOG_ERROR(e.base().what());
+        responseWithErrorMsg(callback, "Internal server error.");
+        co_return;
+    }
+
+    if(status != FoodRecognitions::Status::Done && status != FoodRecognitions::Status::Error && timeout_sec > 0.0)
+    {
+        // On timeout the status read above is returned, the client simply calls again.
+        const std::string notified_status = co_await ResultNotifier::wait(waiter, timeout_sec);
+        if(notified_status.size())
+        {
+            status = notified_status;
+        }
+    }
+
+    const std::string status_name = statusNameOf(status);
+    if(status_name.empty())
+    {
+        responseWithErrorMsg(callback, "Internal server error.");
+        co_return;
+    }
+
+    nlohmann::json res_json{};
+    res_json["Status"] = status_name;
+    responseWithSuccess(callback, res_json);
+    co_return;
+}
@@ -10,13 +10,17 @@ class FoodRecognitionController : public drogon::HttpController<FoodRecognitionC
 public:
   METHOD_LIST_BEGIN
   ADD_METHOD_TO(FoodRecognitionController::recognize_food, "/recognize_food", Post);
+  ADD_METHOD_TO(FoodRecognitionController::recognize_food_binary, "/recognize_food_binary", Post);
   ADD_METHOD_TO(FoodRecognitionController::edit_result, "/edit_result", Get);
   ADD_METHOD_TO(FoodRecognitionController::get_status, "/get_status", Get);
   ADD_METHOD_TO(FoodRecognitionController::get_result, "/get_result", Get);
+  ADD_METHOD_TO(FoodRecognitionController::wait_result, "/wait_result", Get);
   METHOD_LIST_END
 
-  void recognize_food(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const;
-  void edit_result(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const;
-  void get_status(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const;
-  void get_result(const HttpRequestPtr &req, std::function<void(const HttpResponsePtr &)> &&callback) const;
+  Task<> recognize_food(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
+  Task<> recognize_food_binary(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
+  Task<> edit_result(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
+  Task<> get_status(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
+  Task<> get_result(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
+  Task<> wait_result(HttpRequestPtr req, std::function<void(const HttpResponsePtr &)> callback) const;
 };
@@ -3,10 +3,11 @@
 #include "nlohmann/json.hpp"
 #include <drogon/orm/Exception.h>
 #include <drogon/drogon.h>
+#include <drogon/utils/coroutine.h>
 #include <string>
-#include <SimpleAmqpClient/SimpleAmqpClient.h>
 #include "functions.hpp"
-#include <mutex>
+#include "metrics.hpp"
+#include "session_cache.hpp"
 
 using namespace drogon;
 
@@ -48,6 +49,60 @@ inline void responseWithNotLoggedIn(std::function<void(const HttpResponsePtr &)>
     responseWithErrorMsg(callback, "You are not logged in.");
 }
 
+// main.cc registers "dd" either as a regular pool or, with db_is_fast, as one pool per IO loop.
+// Fast clients only exist on IO threads, which is where every controller coroutine runs.
+inline orm::DbClientPtr getDdDbClient()
+{
+    static const bool is_fast = Cfg::getInstance().getCfgBool("db_is_fast", false);
+    if (is_fast)
+    {
+        return drogon::app().getFastDbClient("dd");
+    }
+    return drogon::app().getDbClient("dd");
+}
+
+// Metrics label of a query. Numbers become ? and lists of ? collapse into one, so queries built with
+// inlined ids such as "ID in (1,2,3)" share a single series.
+inline std::string queryLabelOf(const std::string &query)
+{
+    std::string label{};
+    label.reserve(query.size());
+    for (size_t i = 0; i < query.size(); ++i)
+    {
+        const char c = query[i];
+        const bool starts_number = std::isdigit(static_cast<unsigned char>(c)) && (label.empty() || !(std::isalnum(static_cast<unsigned char>(label.back())) || label.back() == '_'));
+        if (c != '?' && !starts_number)
+        {
+            label.push_back(c);
+            continue;
+        }
+
+        while (starts_number && i + 1 < query.size() && std::isdigit(static_cast<unsigned char>(query[i + 1])))
+        {
+            ++i;
+        }
+
+        const size_t trimmed = label.find_last_not_of(' ');
+        if (trimmed != std::string::npos && label[trimmed] == ',' && trimmed > 0 && label[trimmed - 1] == '?')
+        {
+            label.resize(trimmed);
+            continue;
+        }
+        label.push_back('?');
+    }
+    return label;
+}
+
+// execSqlCoro timed into db_query_duration_seconds, failures counted into db_query_errors_total.
+template <typename... Arguments>
+inline Task<orm::Result> execSqlMeasured(orm::DbClientPtr client, const std::string &query, Arguments... args)
+{
+    auto db_call = Metrics::getInstance().call("db_query", {{"query", queryLabelOf(query)}});
+    auto result = co_await client->execSqlCoro(query, std::move(args)...);
+    db_call.succeed();
+    co_return result;
+}
+
 struct UserIdentity
 {
     size_t id{0};
@@ -59,84 +114,78 @@ struct UserIdentity
     }
 };
 
-inline UserIdentity getUserIdentity(const HttpRequestPtr &req)
+inline drogon::Task<UserIdentity> getUserIdentity(HttpRequestPtr req)
 {
     UserIdentity user_identity{};
 
     const std::string &uuid = req->getParameter("uuid");
     if (uuid.empty())
     {
-        return UserIdentity{};
+        co_return UserIdentity{};
     }
 
-    auto client = drogon::app().getDbClient("dd");
+    size_t cached_id{0};
+    switch (SessionCache::getInstance().find(uuid, cached_id))
+    {
+    case SessionCache::LookupResult::Hit:
+        user_identity.id = cached_id;
+        user_identity.uuid = uuid;
+        co_return user_identity;
+    case SessionCache::LookupResult::NegativeHit:
+        co_return UserIdentity{};
+    case SessionCache::LookupResult::Miss:
+        break;
+    }
+
+    auto client = getDdDbClient();
     try
     {
         static const std::string query = "select ID from Users where UUID = ?";
-        const auto result = client->execSqlSync(query, uuid);
+        const auto result = co_await execSqlMeasured(client, query, uuid);
         if (result.empty())
         {
-            return UserIdentity{};
+            SessionCache::getInstance().putNegative(uuid);
+            co_return UserIdentity{};
         }
 
         user_identity.id = result[0]["ID"].as<size_t>();
         user_identity.uuid = uuid;
 
-        return user_identity;
+        SessionCache::getInstance().put(uuid, user_identity.id);
+        co_return user_identity;
     }
     catch (const drogon::orm::DrogonDbException &e)
     {
-        return UserIdentity{};
+        co_return UserIdentity{};
     }
 }
 
-class RabbitMqPublisher
+// Gives up the transaction and completes once drogon has committed it, drogon commits when the last reference
+// goes away. Throws when the commit failed, the statements of the transaction are then rolled back.
+class TransactionCommitAwaiter : public CallbackAwaiter<void>
 {
 public:
-    inline RabbitMqPublisher()
+    explicit TransactionCommitAwaiter(std::shared_ptr<orm::Transaction> transaction) : _transaction(std::move(transaction))
     {
-        try
-        {
-            const auto user = Cfg::getInstance().getCfgValue("rabbitmq_user");
-            const auto pass = Cfg::getInstance().getCfgValue("rabbitmq_pass");
-
-            const std::string hostname = "localhost";
-            const int port = 5672;
-            const std::string username = user;
-            const std::string password = pass;
-            const std::string vhost = "/";
-
-            _channel = AmqpClient::Channel::Create(hostname, port, username, password, vhost);
-        }
-        catch (const std::exception &e)
-        {
-            LOG_ERROR(e.what());
-        }
     }
 
-    inline bool publish(const std::string &queue, const std::string &message)
+    inline void await_suspend(std::coroutine_handle<> handle)
     {
-        try
-        {
-            std::lock_guard{_channel_mut};
-            AmqpClient::BasicMessage::ptr_t msg = AmqpClient::BasicMessage::Create(message);
-            _channel->BasicPublish("", queue, msg);
-        }
-        catch (const std::exception &e)
-        {
-            LOG_ERROR(e.what());
-            return false;
-        }
-        return true;
+        _transaction->setCommitCallback([this, handle](bool committed)
+                                        {
+                                            if (!committed)
+                                            {
+                                                setException(std::make_exception_ptr(std::runtime_error("transaction commit failed")));
+                                            }
+                                            handle.resume(); });
+        _transaction.reset();
     }
 
 private:
-    AmqpClient::Channel::ptr_t _channel{};
-    std::mutex _channel_mut{};
+    std::shared_ptr<orm::Transaction> _transaction{};
 };
 
-inline RabbitMqPublisher &getRabbitMqPublisher()
+inline TransactionCommitAwaiter commitTransaction(std::shared_ptr<orm::Transaction> transaction)
 {
-    static RabbitMqPublisher s{};
-    return s;
+    return TransactionCommitAwaiter{std::move(transaction)};
 }
\ No newline at end of file
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <drogon/drogon.h>
+#include <SimpleAmqpClient/SimpleAmqpClient.h>
+#include <atomic>
+#include <coroutine>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "functions.hpp"
+#include "metrics.hpp"
+
+// Wakes /wait_result requests when ai_requester_service finishes a recognition.
+// The requester publishes {"FoodRecognitionID", "Status"} to the "recognition_results" fanout exchange,
+// every web server binds its own exclusive queue to it and consumes on a dedicated thread.
+// A waiter must be subscribed before the handler reads the status from the DB, otherwise a
+// notification sent between that read and the subscription would be lost.
+class ResultNotifier
+{
+public:
+    static inline const std::string exchange_name = "recognition_results";
+
+    class Waiter
+    {
+    public:
+        struct Awaiter
+        {
+            std::shared_ptr<Waiter> waiter{};
+            double timeout_sec{0.0};
+
+            inline bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            inline bool await_suspend(std::coroutine_handle<> handle)
+            {
+                std::lock_guard lock{waiter->_mut};
+                if (waiter->_fired)
+                {
+                    return false;
+                }
+
+                waiter->_handle = handle;
+                waiter->_loop = trantor::EventLoop::getEventLoopOfCurrentThread();
+                waiter->_timer_id = waiter->_loop->runAfter(timeout_sec, [w = waiter]()
+                                                            { w->fire(std::string{}); });
+                return true;
+            }
+
+            // Status of the notification, empty when the wait timed out.
+            inline std::string await_resume()
+            {
+                std::lock_guard lock{waiter->_mut};
+                return waiter->_status;
+            }
+        };
+
+        // Resumes the waiting coroutine once, on the event loop it was suspended on.
+        inline void fire(const std::string &status)
+        {
+            std::coroutine_handle<> handle{};
+            trantor::EventLoop *loop{nullptr};
+            trantor::TimerId timer_id{0};
+            {
+                std::lock_guard lock{_mut};
+                if (_fired)
+                {
+                    return;
+                }
+                _fired = true;
+                _status = status;
+                handle = _handle;
+                loop = _loop;
+                timer_id = _timer_id;
+            }
+
+            if (!handle)
+            {
+                return;
+            }
+
+            if (status.size())
+            {
+                loop->invalidateTimer(timer_id);
+            }
+            loop->queueInLoop([handle]()
+                              { handle.resume(); });
+        }
+
+    private:
+        std::mutex _mut{};
+        bool _fired{false};
+        std::string _status{};
+        std::coroutine_handle<> _handle{};
+        trantor::EventLoop *_loop{nullptr};
+        trantor::TimerId _timer_id{0};
+    };
+
+    ResultNotifier(const ResultNotifier &l) = delete;
+    ResultNotifier(ResultNotifier &&l) = delete;
+    ResultNotifier &operator=(const ResultNotifier &l) = delete;
+    ResultNotifier &operator=(ResultNotifier &&l) = delete;
+
+    static inline ResultNotifier &getInstance()
+    {
+        static ResultNotifier s{};
+        return s;
+    }
+
+    // Starts the consumer thread, called once from main before the app runs.
+    inline void start()
+    {
+        if (_consumer.joinable())
+        {
+            return;
+        }
+        _consumer = std::thread([this]()
+                                { consumeLoop(); });
+    }
+
+    inline std::shared_ptr<Waiter> subscribe(const std::string &request_id)
+    {
+        auto waiter = std::make_shared<Waiter>();
+        std::lock_guard lock{_mut};
+        _waiters[request_id].push_back(waiter);
+        _waiters_gauge.add();
+        return waiter;
+    }
+
+    inline void unsubscribe(const std::string &request_id, const std::shared_ptr<Waiter> &waiter)
+    {
+        std::lock_guard lock{_mut};
+        const auto it = _waiters.find(request_id);
+        if (it == _waiters.end())
+        {
+            return;
+        }
+
+        auto &waiters = it->second;
+        const auto removed_it = std::remove(waiters.begin(), waiters.end(), waiter);
+        _waiters_gauge.sub(waiters.end() - removed_it);
+        waiters.erase(removed_it, waiters.end());
+        if (waiters.empty())
+        {
+            _waiters.erase(it);
+        }
+    }
+
+    static inline Waiter::Awaiter wait(std::shared_ptr<Waiter> waiter, double timeout_sec)
+    {
+        return Waiter::Awaiter{std::move(waiter), timeout_sec};
+    }
+
+    inline void notify(const std::string &request_id, const std::string &status)
+    {
+        std::vector<std::shared_ptr<Waiter>> waiters{};
+        {
+            std::lock_guard lock{_mut};
+            const auto it = _waiters.find(request_id);
+            if (it == _waiters.end())
+            {
+                return;
+            }
+            waiters = std::move(it->second);
+            _waiters.erase(it);
+            _waiters_gauge.sub(static_cast<int64_t>(waiters.size()));
+        }
+
+        for (auto &waiter : waiters)
+        {
+            waiter->fire(status);
+        }
+    }
+
+private:
+    inline ResultNotifier() = default;
+
+    inline ~ResultNotifier()
+    {
+        _stop = true;
+        if (_consumer.joinable())
+        {
+            _consumer.join();
+        }
+    }
+
+    inline void consumeLoop()
+    {
+        const auto user = Cfg::getInstance().getCfgValue("rabbitmq_user");
+        const auto pass = Cfg::getInstance().getCfgValue("rabbitmq_pass");
+
+        while (!_stop)
+        {
+            try
+            {
+                auto channel = AmqpClient::Channel::Create("localhost", 5672, user, pass, "/");
+                channel->DeclareExchange(exchange_name, AmqpClient::Channel::EXCHANGE_TYPE_FANOUT);
+
+                // Server named, exclusive and auto deleted: one queue per web server process.
+                const std::string queue = channel->DeclareQueue("", false, false, true, true);
+                channel->BindQueue(queue, exchange_name);
+                const std::string consumer_tag = channel->BasicConsume(queue, "", true, true, true);
+
+                while (!_stop)
+                {
+                    AmqpClient::Envelope::ptr_t envelope{};
+                    if (!channel->BasicConsumeMessage(consumer_tag, envelope, 500) || !envelope)
+                    {
+                        continue;
+                    }
+
+                    nlohmann::json obj{};
+                    if (!parseJson(envelope->Message()->Body(), obj))
+                    {
+                        LOG_ERROR("if(!parseJson(envelope->Message()->Body(), obj))");
+                        continue;
+                    }
+
+                    if (!obj.count("FoodRecognitionID") || !obj["FoodRecognitionID"].is_string() || !obj.count("Status") || !obj["Status"].is_string())
+                    {
+                        LOG_ERROR("if(!obj.count(\"FoodRecognitionID\") || !obj[\"FoodRecognitionID\"].is_string() || !obj.count(\"Status\") || !obj[\"Status\"].is_string())");
+                        continue;
+                    }
+
+                    _notifications.add();
+                    notify(obj["FoodRecognitionID"].get<std::string>(), obj["Status"].get<std::string>());
+                }
+            }
+            catch (const std::exception &e)
+            {
+                // Waiters fall back to their timeout while the broker is unreachable.
+                LOG_ERROR(e.what());
+                std::this_thread::sleep_for(std::chrono::seconds{1});
+            }
+        }
+    }
+
+    std::mutex _mut{};
+    std::unordered_map<std::string, std::vector<std::shared_ptr<Waiter>>> _waiters{};
+    Metrics::Gauge &_waiters_gauge{Metrics::getInstance().gauge("wait_result_waiters", {}, "Requests parked in /wait_result")};
+    Metrics::Counter &_notifications{Metrics::getInstance().counter("recognition_notifications_total", {}, "Completion notifications received from the requester")};
+
+    std::atomic<bool> _stop{false};
+    std::thread _consumer{};
+};
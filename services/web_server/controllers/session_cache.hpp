@@ -0,0 +1,169 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "functions.hpp"
+#include "metrics.hpp"
+
+// UUID -> user id cache in front of "select ID from Users where UUID = ?".
+// The map is split into shards with their own mutex so IO threads only contend when they hash to the same shard.
+// Unknown UUIDs are remembered for a short time as well, so a client with a stale UUID does not hit MySQL on every call.
+// Lookups, evictions and the entry count are exported on /metrics as session_cache_*.
+class SessionCache
+{
+public:
+    enum class LookupResult
+    {
+        Miss,
+        Hit,
+        NegativeHit,
+    };
+
+    SessionCache(const SessionCache &l) = delete;
+    SessionCache(SessionCache &&l) = delete;
+    SessionCache &operator=(const SessionCache &l) = delete;
+    SessionCache &operator=(SessionCache &&l) = delete;
+
+    static inline SessionCache &getInstance()
+    {
+        static SessionCache s{};
+        return s;
+    }
+
+    inline LookupResult find(const std::string &uuid, size_t &user_id)
+    {
+        auto &shard = shardOf(uuid);
+        const auto now = Clock::now();
+
+        std::lock_guard lock{shard.mut};
+        const auto it = shard.entries.find(uuid);
+        if (it == shard.entries.end())
+        {
+            _misses.add();
+            return LookupResult::Miss;
+        }
+
+        if (it->second.expires_at <= now)
+        {
+            shard.entries.erase(it);
+            _entries.sub();
+            _misses.add();
+            return LookupResult::Miss;
+        }
+
+        if (it->second.user_id == 0)
+        {
+            _negative_hits.add();
+            return LookupResult::NegativeHit;
+        }
+
+        user_id = it->second.user_id;
+        _hits.add();
+        return LookupResult::Hit;
+    }
+
+    inline void put(const std::string &uuid, size_t user_id)
+    {
+        insert(uuid, user_id, _ttl);
+    }
+
+    inline void putNegative(const std::string &uuid)
+    {
+        insert(uuid, 0, _negative_ttl);
+    }
+
+    inline void erase(const std::string &uuid)
+    {
+        auto &shard = shardOf(uuid);
+        std::lock_guard lock{shard.mut};
+        _entries.sub(static_cast<int64_t>(shard.entries.erase(uuid)));
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t shards_count = 16;
+
+    struct Entry
+    {
+        size_t user_id{0};
+        Clock::time_point expires_at{};
+    };
+
+    struct Shard
+    {
+        std::mutex mut{};
+        std::unordered_map<std::string, Entry> entries{};
+    };
+
+    inline SessionCache()
+    {
+        _ttl = std::chrono::seconds{Cfg::getInstance().getCfgSizeT("session_cache_ttl_sec", 300)};
+        _negative_ttl = std::chrono::seconds{Cfg::getInstance().getCfgSizeT("session_cache_negative_ttl_sec", 5)};
+        const size_t max_entries = Cfg::getInstance().getCfgSizeT("session_cache_max_entries", 100000);
+        _max_entries_per_shard = std::max<size_t>(1, max_entries / shards_count);
+    }
+
+    inline Shard &shardOf(const std::string &uuid)
+    {
+        return _shards[std::hash<std::string>{}(uuid) % shards_count];
+    }
+
+    inline void insert(const std::string &uuid, size_t user_id, Clock::duration ttl)
+    {
+        if (ttl <= Clock::duration::zero())
+        {
+            return;
+        }
+
+        auto &shard = shardOf(uuid);
+        const auto now = Clock::now();
+
+        std::lock_guard lock{shard.mut};
+        if (shard.entries.size() >= _max_entries_per_shard && !shard.entries.count(uuid))
+        {
+            evictLocked(shard, now);
+        }
+        if (shard.entries.insert_or_assign(uuid, Entry{user_id, now + ttl}).second)
+        {
+            _entries.add();
+        }
+    }
+
+    inline void evictLocked(Shard &shard, Clock::time_point now)
+    {
+        for (auto it = shard.entries.begin(); it != shard.entries.end();)
+        {
+            if (it->second.expires_at <= now)
+            {
+                it = shard.entries.erase(it);
+                _entries.sub();
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        if (shard.entries.size() >= _max_entries_per_shard)
+        {
+            shard.entries.erase(shard.entries.begin());
+            _entries.sub();
+            _evictions.add();
+        }
+    }
+
+    std::array<Shard, shards_count> _shards{};
+    Clock::duration _ttl{};
+    Clock::duration _negative_ttl{};
+    size_t _max_entries_per_shard{1};
+
+    Metrics::Counter &_hits{Metrics::getInstance().counter("session_cache_lookups_total", {{"result", "hit"}}, "UUID lookups in the session cache")};
+    Metrics::Counter &_negative_hits{Metrics::getInstance().counter("session_cache_lookups_total", {{"result", "negative_hit"}})};
+    Metrics::Counter &_misses{Metrics::getInstance().counter("session_cache_lookups_total", {{"result", "miss"}})};
+    Metrics::Counter &_evictions{Metrics::getInstance().counter("session_cache_evictions_total", {}, "Live entries dropped because their shard was full")};
+    Metrics::Gauge &_entries{Metrics::getInstance().gauge("session_cache_entries", {}, "Entries in the session cache, expired ones included until they are found")};
+};
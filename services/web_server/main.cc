@@ -1,7 +1,12 @@
 #include "functions.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "controllers/result_notifier.hpp"
 #include <drogon/drogon.h>
 #include <drogon/HttpAppFramework.h>
 #include <drogon/utils/Utilities.h>
+#include <thread>
+#include <unordered_set>
 
 int main()
 {
@@ -10,6 +15,16 @@ int main()
         return false;
     }
 
+    // Optional topology keys in the credentials json:
+    //   web_server_io_threads   - drogon IO threads, 0 means one per CPU core
+    //   db_connection_number    - MySQL connections, per IO thread when db_is_fast is set
+    //   db_is_fast              - one pool per event loop, controllers must stay fully async
+    //   db_query_timeout_sec    - per query timeout, 0 or negative disables it
+    const size_t io_threads = Cfg::getInstance().getCfgSizeT("web_server_io_threads", 1);
+    const size_t db_connection_number = std::max<size_t>(1, Cfg::getInstance().getCfgSizeT("db_connection_number", 1));
+    const bool db_is_fast = Cfg::getInstance().getCfgBool("db_is_fast", false);
+    const double db_query_timeout_sec = Cfg::getInstance().getCfgDouble("db_query_timeout_sec", -1.0);
+
     {
         const auto db_user = Cfg::getInstance().getCfgValue("db_user");
         const auto db_pass = Cfg::getInstance().getCfgValue("db_pass");
@@ -20,14 +35,76 @@ int main()
         cfg.databaseName = "dd";
         cfg.username = db_user;
         cfg.password = db_pass;
-        cfg.connectionNumber = 1;
+        cfg.connectionNumber = db_connection_number;
         cfg.name = "dd";
+        cfg.isFast = db_is_fast;
+        cfg.timeout = db_query_timeout_sec > 0.0 ? db_query_timeout_sec : -1.0;
 
         drogon::app().addDbClient(cfg);
     }
 
+    drogon::app().setThreadNum(io_threads);
+
+    const size_t effective_io_threads = io_threads ? io_threads : std::max(1u, std::thread::hardware_concurrency());
+    const size_t total_db_connections = db_is_fast ? db_connection_number * effective_io_threads : db_connection_number;
+    LOG_INFO("topology: io_threads=" + std::to_string(effective_io_threads) +
+             " db_is_fast=" + std::string{db_is_fast ? "true" : "false"} +
+             " db_connections_per_pool=" + std::to_string(db_connection_number) +
+             " db_connections_total=" + std::to_string(total_db_connections) +
+             " db_query_timeout_sec=" + (db_query_timeout_sec > 0.0 ? floatToStringWithPrecision(db_query_timeout_sec) : std::string{"none"}));
+
     drogon::app().setClientMaxBodySize(20 * 1024 * 1024);
+    // Larger bodies go to a temp file instead of RAM, recognize_food_binary reads photos straight from it.
+    drogon::app().setClientMaxMemoryBodySize(256 * 1024);
     drogon::app().addListener("0.0.0.0", 5050);
+
+    // Drogon matches paths case-insensitively, so req->path() is not a bounded label. The route label is the
+    // lower-cased path when it is one of the registered handler paths and "other" otherwise.
+    // The set is filled by the beginning advice, before any IO thread handles a request, and only read afterwards.
+    // Durations are taken from the request's arrival and include the time spent in the handler.
+    static std::unordered_set<std::string> route_labels{};
+    const auto lower = [](std::string str)
+    {
+        std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c)
+                       { return std::tolower(c); });
+        return str;
+    };
+    drogon::app().registerBeginningAdvice(
+        [lower]()
+        {
+            for (const auto &handler : drogon::app().getHandlersInfo())
+            {
+                route_labels.insert(lower(std::get<0>(handler)));
+            }
+        });
+    drogon::app().registerPostHandlingAdvice(
+        [lower](const drogon::HttpRequestPtr &req, const drogon::HttpResponsePtr &resp)
+        {
+            std::string route = lower(req->path());
+            if (!route_labels.count(route))
+            {
+                route = "other";
+            }
+            const int64_t elapsed_us = trantor::Date::now().microSecondsSinceEpoch() - req->creationDate().microSecondsSinceEpoch();
+            Metrics::getInstance().histogram("http_request_duration_seconds", {{"route", route}}).observeMicroseconds(elapsed_us > 0 ? static_cast<uint64_t>(elapsed_us) : 0);
+            Metrics::getInstance().counter("http_responses_total", {{"route", route}, {"code", std::to_string(static_cast<int>(resp->statusCode()))}}).add();
+        });
+
+    drogon::app().registerHandler(
+        "/metrics",
+        [](const drogon::HttpRequestPtr &, std::function<void(const drogon::HttpResponsePtr &)> &&callback)
+        {
+            auto response = drogon::HttpResponse::newHttpResponse();
+            response->setBody(Metrics::getInstance().render());
+            response->setContentTypeString("text/plain; version=0.0.4");
+            callback(response);
+        },
+        {drogon::Get});
+
+    TraceWriter::getInstance().setService("web_server");
+
+    // Feeds /wait_result from the requester's completion notifications.
+    ResultNotifier::getInstance().start();
     drogon::app().run();
     return 0;
 }
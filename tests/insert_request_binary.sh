@@ -0,0 +1,8 @@
+curl -X POST "http://localhost:5050/recognize_food_binary?uuid=7bc2e395-b58e-45c9-90f4-b9e5b5e671bd" \
+     -H "Content-Type: image/jpeg" \
+     --data-binary "@../services/model_tests_1/dataset/not_food_1.jpg" \
+     -i 
+
+curl -X POST "http://localhost:5050/recognize_food_binary?uuid=7bc2e395-b58e-45c9-90f4-b9e5b5e671bd" \
+     -F "photo=@../services/model_tests_1/dataset/not_food_1.jpg" \
+     -i 
@@ -0,0 +1,12 @@
+# Run before and after a web_server change and compare requests/s and p99.
+# Build first: cd ../services/benchmarks && mkdir -p build && cd build && cmake .. && make
+
+../services/benchmarks/build/load_bench \
+     http://localhost:5050/get_status \
+     "uuid=7bc2e395-b58e-45c9-90f4-b9e5b5e671bd&request_id=132" \
+     64 30
+
+../services/benchmarks/build/load_bench \
+     http://localhost:5050/get_record_ids \
+     "uuid=7bc2e395-b58e-45c9-90f4-b9e5b5e671bd" \
+     64 30
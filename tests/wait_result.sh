@@ -0,0 +1,6 @@
+curl -X GET http://localhost:5050/wait_result \
+     -H "Content-Type: application/x-www-form-urlencoded" \
+     -d "uuid=7bc2e395-b58e-45c9-90f4-b9e5b5e671bd" \
+     -d "request_id=132" \
+     -d "timeout_sec=25" \
+     -i